@@ -2,61 +2,6 @@
 
 #include "uECC.h"
 
-#ifndef uECC_PLATFORM
-    #if __AVR__
-        #define uECC_PLATFORM uECC_avr
-    #elif defined(__thumb2__) || defined(_M_ARMT) /* I think MSVC only supports Thumb-2 targets */
-        #define uECC_PLATFORM uECC_arm_thumb2
-    #elif defined(__thumb__)
-        #define uECC_PLATFORM uECC_arm_thumb
-    #elif defined(__arm__) || defined(_M_ARM)
-        #define uECC_PLATFORM uECC_arm
-    #elif defined(__i386__) || defined(_M_IX86) || defined(_X86_) || defined(__I86__)
-        #define uECC_PLATFORM uECC_x86
-    #elif defined(__amd64__) || defined(_M_X64)
-        #define uECC_PLATFORM uECC_x86_64
-    #else
-        #define uECC_PLATFORM uECC_arch_other
-    #endif
-#endif
-
-#ifndef uECC_WORD_SIZE
-    #if uECC_PLATFORM == uECC_avr
-        #define uECC_WORD_SIZE 1
-    #elif (uECC_PLATFORM == uECC_x86_64)
-        #define uECC_WORD_SIZE 8
-    #else
-        #define uECC_WORD_SIZE 4
-    #endif
-#endif
-
-#if (uECC_CURVE == uECC_secp160r1 || uECC_CURVE == uECC_secp224r1) && (uECC_WORD_SIZE == 8)
-    #undef uECC_WORD_SIZE
-    #define uECC_WORD_SIZE 4
-    #if (uECC_PLATFORM == uECC_x86_64)
-        #undef uECC_PLATFORM
-        #define uECC_PLATFORM uECC_x86
-    #endif
-#endif
-
-#if (uECC_WORD_SIZE != 1) && (uECC_WORD_SIZE != 4) && (uECC_WORD_SIZE != 8)
-    #error "Unsupported value for uECC_WORD_SIZE"
-#endif
-
-#if (uECC_ASM && (uECC_PLATFORM == uECC_avr) && (uECC_WORD_SIZE != 1))
-    #pragma message ("uECC_WORD_SIZE must be 1 when using AVR asm")
-    #undef uECC_WORD_SIZE
-    #define uECC_WORD_SIZE 1
-#endif
-
-#if (uECC_ASM && \
-     (uECC_PLATFORM == uECC_arm || uECC_PLATFORM == uECC_arm_thumb) && \
-     (uECC_WORD_SIZE != 4))
-    #pragma message ("uECC_WORD_SIZE must be 4 when using ARM asm")
-    #undef uECC_WORD_SIZE
-    #define uECC_WORD_SIZE 4
-#endif
-
 #if __STDC_VERSION__ >= 199901L
     #define RESTRICT restrict
 #else
@@ -465,12 +410,68 @@ static int default_RNG(uint8_t *dest, unsigned size) {
 
 #endif
 
-static uECC_RNG_Function g_rng_function = &default_RNG;
+static uECC_THREAD_LOCAL uECC_RNG_Function g_rng_function = &default_RNG;
 
 void uECC_set_rng(uECC_RNG_Function rng_function) {
     g_rng_function = rng_function;
 }
 
+static uECC_THREAD_LOCAL uECC_word_t *g_scratch = 0;
+static uECC_THREAD_LOCAL unsigned g_scratch_size = 0;   /* Arena size in bytes */
+static uECC_THREAD_LOCAL uint16_t g_scratch_top = 0;    /* Words currently in use */
+static uECC_THREAD_LOCAL uint16_t g_scratch_peak = 0;   /* Highest g_scratch_top since uECC_scratch_peak() */
+static uECC_THREAD_LOCAL uint8_t g_scratch_overflow = 0; /* An allocation did not fit since scratch_begin() */
+
+int uECC_set_scratch(void *scratch, unsigned size) {
+    g_scratch_top = 0;
+    g_scratch_peak = 0;
+    g_scratch_overflow = 0;
+    if (size < uECC_SCRATCH_SIZE) {
+        g_scratch = 0; /* Refused: every function fails until a large enough arena is set */
+        g_scratch_size = 0;
+        return 0;
+    }
+    g_scratch = (uECC_word_t *)scratch;
+    g_scratch_size = size;
+    return 1;
+}
+
+unsigned uECC_scratch_peak(void) {
+    unsigned peak = g_scratch_peak * uECC_WORD_SIZE;
+    g_scratch_peak = g_scratch_top;
+    return peak;
+}
+
+/* Temporaries are taken from the scratch arena in LIFO order. A function records the top of
+   the arena with SCRATCH_MARK(), takes what it needs with scratch_alloc() and gives it all
+   back with SCRATCH_RELEASE() before returning. */
+#define SCRATCH_MARK() uint16_t scratch_mark = g_scratch_top
+#define SCRATCH_RELEASE() (g_scratch_top = scratch_mark)
+
+/* Called on entry by the public functions that use the arena. Returns 0 if no arena is set. */
+static int scratch_begin(void) {
+    g_scratch_overflow = 0;
+    return g_scratch != 0;
+}
+
+/* An allocation that does not fit in the arena (uECC_SCRATCH_SIZE too small for a code path)
+   is given the start of the arena instead: its results are garbage, but nothing outside the
+   arena is written, and the public function fails (SCRATCH_OK()). */
+static uECC_word_t *scratch_alloc(uint16_t words) {
+    uECC_word_t *result = g_scratch + g_scratch_top;
+    if ((unsigned)(g_scratch_top + words) * uECC_WORD_SIZE > g_scratch_size) {
+        g_scratch_overflow = 1;
+        return g_scratch;
+    }
+    g_scratch_top += words;
+    if (g_scratch_top > g_scratch_peak) {
+        g_scratch_peak = g_scratch_top;
+    }
+    return result;
+}
+
+#define SCRATCH_OK() (!g_scratch_overflow)
+
 #ifdef __GNUC__ /* Only support GCC inline asm for now */
     #if (uECC_ASM && (uECC_PLATFORM == uECC_avr))
         #include "asm_avr.inc"
@@ -825,7 +826,8 @@ static void omega_mult(uECC_word_t * RESTRICT result, const uECC_word_t * RESTRI
 
     Note that this only works if log2(omega) < log2(p) / 2 */
 static void vli_mmod_fast(uECC_word_t *RESTRICT result, uECC_word_t *RESTRICT product) {
-    uECC_word_t tmp[2 * uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *tmp = scratch_alloc(2 * uECC_WORDS);
     uECC_word_t carry;
 
     vli_clear(tmp);
@@ -845,6 +847,7 @@ static void vli_mmod_fast(uECC_word_t *RESTRICT result, uECC_word_t *RESTRICT pr
     if (vli_cmp(result, curve_p) > 0) {
         vli_sub(result, result, curve_p);
     }
+    SCRATCH_RELEASE();
 }
 
 #endif
@@ -1443,18 +1446,22 @@ void vli_mmod_fast(uint32_t *RESTRICT result, uint32_t *RESTRICT product)
 static void vli_modMult_fast(uECC_word_t *result,
                              const uECC_word_t *left,
                              const uECC_word_t *right) {
-    uECC_word_t product[2 * uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *product = scratch_alloc(2 * uECC_WORDS);
     vli_mult(product, left, right);
     vli_mmod_fast(result, product);
+    SCRATCH_RELEASE();
 }
 
 #if uECC_SQUARE_FUNC
 
 /* Computes result = left^2 % curve_p. */
 static void vli_modSquare_fast(uECC_word_t *result, const uECC_word_t *left) {
-    uECC_word_t product[2 * uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *product = scratch_alloc(2 * uECC_WORDS);
     vli_square(product, left);
     vli_mmod_fast(result, product);
+    SCRATCH_RELEASE();
 }
 
 #else /* uECC_SQUARE_FUNC */
@@ -1470,12 +1477,17 @@ static void vli_modSquare_fast(uECC_word_t *result, const uECC_word_t *left) {
    https://labs.oracle.com/techrep/2001/smli_tr-2001-95.pdf */
 #if !asm_modInv
 static void vli_modInv(uECC_word_t *result, const uECC_word_t *input, const uECC_word_t *mod) {
-    uECC_word_t a[uECC_WORDS], b[uECC_WORDS], u[uECC_WORDS], v[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *a = scratch_alloc(uECC_WORDS);
+    uECC_word_t *b = scratch_alloc(uECC_WORDS);
+    uECC_word_t *u = scratch_alloc(uECC_WORDS);
+    uECC_word_t *v = scratch_alloc(uECC_WORDS);
     uECC_word_t carry;
     cmpresult_t cmpResult;
 
     if (vli_isZero(input)) {
         vli_clear(result);
+        SCRATCH_RELEASE();
         return;
     }
 
@@ -1535,9 +1547,75 @@ static void vli_modInv(uECC_word_t *result, const uECC_word_t *input, const uECC
         }
     }
     vli_set(result, u);
+    SCRATCH_RELEASE();
 }
 #endif /* !asm_modInv */
 
+#if (uECC_CURVE == uECC_secp160r1)
+
+/* Computes result = input^(2^n) % curve_p. */
+static void vli_modSquare_times_fast(uECC_word_t *result, const uECC_word_t *input, bitcount_t n) {
+    vli_modSquare_fast(result, input);
+    while (--n) {
+        vli_modSquare_fast(result, result);
+    }
+}
+
+#endif /* (uECC_CURVE == uECC_secp160r1) */
+
+#if (uECC_CURVE == uECC_secp160r1) && uECC_CONST_TIME_INV
+
+/* Computes result = (1 / input) % curve_p as input^(curve_p - 2) (Fermat's little theorem).
+   Unlike vli_modInv(), the sequence of operations does not depend on the input.
+
+   curve_p - 2 = (2^128 - 1) * 2^32 + (2^29 - 1) * 2^2 + 1. Writing x_k = input^(2^k - 1),
+   x_128 and x_29 are computed with the addition chain 1, 2, 4, 8, 16, (24, 28, 29), 32, 64, 128,
+   for a total of 172 squarings and 12 multiplications (square-and-multiply needs 159
+   squarings and 157 multiplications). */
+static void vli_modInv_fast(uECC_word_t *result, const uECC_word_t *input) {
+    SCRATCH_MARK();
+    uECC_word_t *r = scratch_alloc(uECC_WORDS);
+    uECC_word_t *t = scratch_alloc(uECC_WORDS);
+    uECC_word_t *x4 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *x8 = scratch_alloc(uECC_WORDS);
+    bitcount_t k;
+
+    vli_modSquare_fast(t, input);
+    vli_modMult_fast(r, t, input);        /* r = x_2 */
+    vli_modSquare_times_fast(t, r, 2);
+    vli_modMult_fast(r, t, r);            /* r = x_4 */
+    vli_set(x4, r);
+    vli_modSquare_times_fast(t, r, 4);
+    vli_modMult_fast(r, t, r);            /* r = x_8 */
+    vli_set(x8, r);
+    vli_modSquare_times_fast(t, r, 8);
+    vli_modMult_fast(r, t, r);            /* r = x_16 */
+
+    vli_modSquare_times_fast(t, r, 8);
+    vli_modMult_fast(t, t, x8);           /* t = x_24 */
+    vli_modSquare_times_fast(t, t, 4);
+    vli_modMult_fast(t, t, x4);           /* t = x_28 */
+    vli_modSquare_fast(t, t);
+    vli_modMult_fast(x4, t, input);       /* x4 = x_29 */
+
+    for (k = 16; k < 128; k <<= 1) {
+        vli_modSquare_times_fast(t, r, k);
+        vli_modMult_fast(r, t, r);        /* r = x_(2k) */
+    }
+
+    vli_modSquare_times_fast(r, r, 30);
+    vli_modMult_fast(r, r, x4);           /* r = x_128 * 2^30 + x_29 */
+    vli_modSquare_times_fast(r, r, 2);
+    vli_modMult_fast(result, r, input);   /* result = input^(curve_p - 2) */
+    SCRATCH_RELEASE();
+}
+
+#else
+
+#define vli_modInv_fast(result, input) vli_modInv((result), (input), curve_p)
+
+#endif /* (uECC_CURVE == uECC_secp160r1) && uECC_CONST_TIME_INV */
+
 /* ------ Point operations ------ */
 
 /* Returns 1 if 'point' is the point at infinity, 0 otherwise. */
@@ -1555,10 +1633,12 @@ static void EccPoint_double_jacobian(uECC_word_t * RESTRICT X1,
                                      uECC_word_t * RESTRICT Y1,
                                      uECC_word_t * RESTRICT Z1) {
     /* t1 = X, t2 = Y, t3 = Z */
-    uECC_word_t t4[uECC_WORDS];
-    uECC_word_t t5[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *t4 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *t5 = scratch_alloc(uECC_WORDS);
 
     if (vli_isZero(Z1)) {
+        SCRATCH_RELEASE();
         return;
     }
 
@@ -1586,16 +1666,19 @@ static void EccPoint_double_jacobian(uECC_word_t * RESTRICT X1,
     vli_modSub(t4, t4, X1, curve_p); /* t4 = A - x3 */
     vli_modMult_fast(Y1, Y1, t4);    /* t2 = B * (A - x3) */
     vli_modSub(Y1, Y1, t5, curve_p); /* t2 = B * (A - x3) - y1^4 = y3 */
+    SCRATCH_RELEASE();
 }
 #else
 static void EccPoint_double_jacobian(uECC_word_t * RESTRICT X1,
                                      uECC_word_t * RESTRICT Y1,
                                      uECC_word_t * RESTRICT Z1) {
     /* t1 = X, t2 = Y, t3 = Z */
-    uECC_word_t t4[uECC_WORDS];
-    uECC_word_t t5[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *t4 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *t5 = scratch_alloc(uECC_WORDS);
 
     if (vli_isZero(Z1)) {
+        SCRATCH_RELEASE();
         return;
     }
 
@@ -1631,6 +1714,7 @@ static void EccPoint_double_jacobian(uECC_word_t * RESTRICT X1,
     vli_set(X1, Z1);
     vli_set(Z1, Y1);
     vli_set(Y1, t4);
+    SCRATCH_RELEASE();
 }
 #endif
 
@@ -1638,12 +1722,14 @@ static void EccPoint_double_jacobian(uECC_word_t * RESTRICT X1,
 static void apply_z(uECC_word_t * RESTRICT X1,
                     uECC_word_t * RESTRICT Y1,
                     const uECC_word_t * RESTRICT Z) {
-    uECC_word_t t1[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *t1 = scratch_alloc(uECC_WORDS);
 
     vli_modSquare_fast(t1, Z);    /* z^2 */
     vli_modMult_fast(X1, X1, t1); /* x1 * z^2 */
     vli_modMult_fast(t1, t1, Z);  /* z^3 */
     vli_modMult_fast(Y1, Y1, t1); /* y1 * z^3 */
+    SCRATCH_RELEASE();
 }
 
 /* P = (x1, y1) => 2P, (x2, y2) => P' */
@@ -1652,7 +1738,8 @@ static void XYcZ_initial_double(uECC_word_t * RESTRICT X1,
                                 uECC_word_t * RESTRICT X2,
                                 uECC_word_t * RESTRICT Y2,
                                 const uECC_word_t * RESTRICT initial_Z) {
-    uECC_word_t z[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *z = scratch_alloc(uECC_WORDS);
     if (initial_Z) {
         vli_set(z, initial_Z);
     } else {
@@ -1666,6 +1753,7 @@ static void XYcZ_initial_double(uECC_word_t * RESTRICT X1,
     apply_z(X1, Y1, z);
     EccPoint_double_jacobian(X1, Y1, z);
     apply_z(X2, Y2, z);
+    SCRATCH_RELEASE();
 }
 
 /* Input P = (x1, y1, Z), Q = (x2, y2, Z)
@@ -1677,7 +1765,8 @@ static void XYcZ_add(uECC_word_t * RESTRICT X1,
                      uECC_word_t * RESTRICT X2,
                      uECC_word_t * RESTRICT Y2) {
     /* t1 = X1, t2 = Y1, t3 = X2, t4 = Y2 */
-    uECC_word_t t5[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *t5 = scratch_alloc(uECC_WORDS);
 
     vli_modSub_fast(t5, X2, X1);  /* t5 = x2 - x1 */
     vli_modSquare_fast(t5, t5);   /* t5 = (x2 - x1)^2 = A */
@@ -1695,6 +1784,7 @@ static void XYcZ_add(uECC_word_t * RESTRICT X1,
     vli_modSub_fast(Y2, Y2, Y1);  /* t4 = y3 */
 
     vli_set(X2, t5);
+    SCRATCH_RELEASE();
 }
 
 /* Input P = (x1, y1, Z), Q = (x2, y2, Z)
@@ -1706,9 +1796,10 @@ static void XYcZ_addC(uECC_word_t * RESTRICT X1,
                       uECC_word_t * RESTRICT X2,
                       uECC_word_t * RESTRICT Y2) {
     /* t1 = X1, t2 = Y1, t3 = X2, t4 = Y2 */
-    uECC_word_t t5[uECC_WORDS];
-    uECC_word_t t6[uECC_WORDS];
-    uECC_word_t t7[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *t5 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *t6 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *t7 = scratch_alloc(uECC_WORDS);
 
     vli_modSub_fast(t5, X2, X1);     /* t5 = x2 - x1 */
     vli_modSquare_fast(t5, t5);      /* t5 = (x2 - x1)^2 = A */
@@ -1734,6 +1825,7 @@ static void XYcZ_addC(uECC_word_t * RESTRICT X1,
     vli_modSub_fast(Y1, t6, Y1);  /* t2 = (y2 + y1)*(x3' - B) - E = y3' */
 
     vli_set(X1, t7);
+    SCRATCH_RELEASE();
 }
 
 static void EccPoint_mult(EccPoint * RESTRICT result,
@@ -1741,13 +1833,19 @@ static void EccPoint_mult(EccPoint * RESTRICT result,
                           const uECC_word_t * RESTRICT scalar,
                           const uECC_word_t * RESTRICT initialZ,
                           bitcount_t numBits) {
-    /* R0 and R1 */
-    uECC_word_t Rx[2][uECC_WORDS];
-    uECC_word_t Ry[2][uECC_WORDS];
-    uECC_word_t z[uECC_WORDS];
+    /* R0 and R1. R0 is built in place in result. */
+    SCRATCH_MARK();
+    uECC_word_t *Rx[2];
+    uECC_word_t *Ry[2];
+    uECC_word_t *z = scratch_alloc(uECC_WORDS);
     bitcount_t i;
     uECC_word_t nb;
 
+    Rx[0] = result->x;
+    Ry[0] = result->y;
+    Rx[1] = scratch_alloc(uECC_WORDS);
+    Ry[1] = scratch_alloc(uECC_WORDS);
+
     vli_set(Rx[1], point->x);
     vli_set(Ry[1], point->y);
 
@@ -1766,26 +1864,26 @@ static void EccPoint_mult(EccPoint * RESTRICT result,
     vli_modSub_fast(z, Rx[1], Rx[0]);   /* X1 - X0 */
     vli_modMult_fast(z, z, Ry[1 - nb]); /* Yb * (X1 - X0) */
     vli_modMult_fast(z, z, point->x); /* xP * Yb * (X1 - X0) */
-    vli_modInv(z, z, curve_p);          /* 1 / (xP * Yb * (X1 - X0)) */
+    vli_modInv_fast(z, z);              /* 1 / (xP * Yb * (X1 - X0)) */
     vli_modMult_fast(z, z, point->y); /* yP / (xP * Yb * (X1 - X0)) */
     vli_modMult_fast(z, z, Rx[1 - nb]); /* Xb * yP / (xP * Yb * (X1 - X0)) */
     /* End 1/Z calculation */
 
     XYcZ_add(Rx[nb], Ry[nb], Rx[1 - nb], Ry[1 - nb]);
     apply_z(Rx[0], Ry[0], z);
-
-    vli_set(result->x, Rx[0]);
-    vli_set(result->y, Ry[0]);
+    SCRATCH_RELEASE();
 }
 
 static int EccPoint_compute_public_key(EccPoint *result, uECC_word_t *private) {
-    uECC_word_t tmp1[uECC_WORDS];
-    uECC_word_t tmp2[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *tmp1 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *tmp2 = scratch_alloc(uECC_WORDS);
     uECC_word_t *p2[2] = {tmp1, tmp2};
     uECC_word_t carry;
 
     /* Make sure the private key is in the range [1, n-1]. */
     if (vli_isZero(private)) {
+        SCRATCH_RELEASE();
         return 0;
     }
 
@@ -1797,6 +1895,7 @@ static int EccPoint_compute_public_key(EccPoint *result, uECC_word_t *private) {
     EccPoint_mult(result, &curve_G, private, 0, vli_numBits(private, uECC_WORDS));
 #else
     if (vli_cmp(curve_n, private) != 1) {
+        SCRATCH_RELEASE();
         return 0;
     }
 
@@ -1807,6 +1906,7 @@ static int EccPoint_compute_public_key(EccPoint *result, uECC_word_t *private) {
     EccPoint_mult(result, &curve_G, p2[!carry], 0, (uECC_BYTES * 8) + 1);
 #endif
 
+    SCRATCH_RELEASE();
     if (EccPoint_isZero(result)) {
         return 0;
     }
@@ -1822,7 +1922,8 @@ static void mod_sqrt_secp224r1_rs(uECC_word_t *d1,
                                   const uECC_word_t *d0,
                                   const uECC_word_t *e0,
                                   const uECC_word_t *f0) {
-    uECC_word_t t[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *t = scratch_alloc(uECC_WORDS);
 
     vli_modSquare_fast(t, d0);                 /* t <-- d0 ^ 2 */
     vli_modMult_fast(e1, d0, e0);              /* e1 <-- d0 * e0 */
@@ -1831,6 +1932,7 @@ static void mod_sqrt_secp224r1_rs(uECC_word_t *d1,
     vli_modMult_fast(f1, t, f0);               /* f1 <-- t  * f0 */
     vli_modAdd(f1, f1, f1, curve_p);           /* f1 <-- f1 + f1 */
     vli_modAdd(f1, f1, f1, curve_p);           /* f1 <-- f1 + f1 */
+    SCRATCH_RELEASE();
 }
 
 /* Routine 3.2.5 RSS;  from http://www.nsa.gov/ia/_files/nist-routines.pdf */
@@ -1860,8 +1962,9 @@ static void mod_sqrt_secp224r1_rm(uECC_word_t *d2,
                                   const uECC_word_t *e0,
                                   const uECC_word_t *d1,
                                   const uECC_word_t *e1) {
-    uECC_word_t t1[uECC_WORDS];
-    uECC_word_t t2[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *t1 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *t2 = scratch_alloc(uECC_WORDS);
 
     vli_modMult_fast(t1, e0, e1);              /* t1 <-- e0 * e1 */
     vli_modMult_fast(t1, t1, c);               /* t1 <-- t1 * c */
@@ -1875,6 +1978,7 @@ static void mod_sqrt_secp224r1_rm(uECC_word_t *d2,
     vli_modMult_fast(f2, f2, c);               /* f2 <-- f2 * c */
     vli_modSub_fast(f2, curve_p, f2);          /* f2 <-- p  - f2 */
     vli_set(d2, t2);                           /* d2 <-- t2 */
+    SCRATCH_RELEASE();
 }
 
 /* Routine 3.2.7 RP;  from http://www.nsa.gov/ia/_files/nist-routines.pdf */
@@ -1885,9 +1989,13 @@ static void mod_sqrt_secp224r1_rp(uECC_word_t *d1,
                                   const uECC_word_t *r) {
     wordcount_t i;
     wordcount_t pow2i = 1;
-    uECC_word_t d0[uECC_WORDS];
-    uECC_word_t e0[uECC_WORDS] = {1};          /* e0 <-- 1 */
-    uECC_word_t f0[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *d0 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *e0 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *f0 = scratch_alloc(uECC_WORDS);
+
+    vli_clear(e0);
+    e0[0] = 1;                                 /* e0 <-- 1 */
 
     vli_set(d0, r);                            /* d0 <-- r */
     vli_modSub_fast(f0, curve_p, c);           /* f0 <-- p  - c */
@@ -1899,18 +2007,20 @@ static void mod_sqrt_secp224r1_rp(uECC_word_t *d1,
         vli_set(f0, f1);                       /* f0 <-- f1 */
         pow2i *= 2;
     }
+    SCRATCH_RELEASE();
 }
 
 /* Compute a = sqrt(a) (mod curve_p). */
 /* Routine 3.2.8 mp_mod_sqrt_224; from http://www.nsa.gov/ia/_files/nist-routines.pdf */
 static void mod_sqrt(uECC_word_t *a) {
     bitcount_t i;
-    uECC_word_t e1[uECC_WORDS];
-    uECC_word_t f1[uECC_WORDS];
-    uECC_word_t d0[uECC_WORDS];
-    uECC_word_t e0[uECC_WORDS];
-    uECC_word_t f0[uECC_WORDS];
-    uECC_word_t d1[uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *e1 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *f1 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *d0 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *e0 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *f0 = scratch_alloc(uECC_WORDS);
+    uECC_word_t *d1 = scratch_alloc(uECC_WORDS);
 
     // s = a; using constant instead of random value
     mod_sqrt_secp224r1_rp(d0, e0, f0, a, a);           /* RP (d0, e0, f0, c, s) */
@@ -1926,6 +2036,32 @@ static void mod_sqrt(uECC_word_t *a) {
     }
     vli_modInv(f1, e0, curve_p);                       /* f1 <-- 1 / e0 */
     vli_modMult_fast(a, d0, f1);                       /* a  <-- d0 / e0 */
+    SCRATCH_RELEASE();
+}
+
+#elif uECC_CURVE == uECC_secp160r1
+
+/* Compute a = sqrt(a) (mod curve_p).
+   Since curve_p == 3 (mod 4), sqrt(a) = a^((curve_p + 1) / 4) = a^(2^158 - 2^29)
+                                       = (a^(2^129 - 1))^(2^29).
+   a^(2^129 - 1) uses the addition chain 1, 2, 4, ..., 128, 129 on exponents of the form
+   2^k - 1, for a total of 157 squarings and 8 multiplications (instead of 158 squarings and
+   128 multiplications with square-and-multiply). */
+static void mod_sqrt(uECC_word_t *a) {
+    bitcount_t k;
+    SCRATCH_MARK();
+    uECC_word_t *x = scratch_alloc(uECC_WORDS);
+    uECC_word_t *t = scratch_alloc(uECC_WORDS);
+
+    vli_set(x, a); /* x = a^(2^1 - 1) */
+    for (k = 1; k < 128; k <<= 1) {
+        vli_modSquare_times_fast(t, x, k);
+        vli_modMult_fast(x, t, x); /* x = a^(2^(2k) - 1) */
+    }
+    vli_modSquare_fast(x, x);
+    vli_modMult_fast(x, x, a); /* x = a^(2^129 - 1) */
+    vli_modSquare_times_fast(a, x, 29);
+    SCRATCH_RELEASE();
 }
 
 #else /* uECC_CURVE */
@@ -2015,21 +2151,70 @@ static void vli_bytesToNative(uint64_t *native, const uint8_t *bytes) {
 #include "../uart.h"
 
 int uECC_make_key(uint8_t public_key[uECC_BYTES*2], uint8_t private_key[uECC_BYTES]) {
-    uECC_word_t private[uECC_WORDS];
-    EccPoint public;
+    if (!scratch_begin()) {
+        return 0;
+    }
+    SCRATCH_MARK();
+    uECC_word_t *private = scratch_alloc(uECC_WORDS);
+    EccPoint *public = (EccPoint *)scratch_alloc(2 * uECC_WORDS);
     uECC_word_t tries;
     for (tries = 0; tries < MAX_TRIES; ++tries) {
-        if (g_rng_function((uint8_t *)private, sizeof(private)) &&
-                EccPoint_compute_public_key(&public, private)) {
+        if (g_rng_function((uint8_t *)private, uECC_WORDS * uECC_WORD_SIZE) &&
+                EccPoint_compute_public_key(public, private)) {
             vli_nativeToBytes(private_key, private);
-            vli_nativeToBytes(public_key, public.x);
-            vli_nativeToBytes(public_key + uECC_BYTES, public.y);
-            return 1;
+            vli_nativeToBytes(public_key, public->x);
+            vli_nativeToBytes(public_key + uECC_BYTES, public->y);
+            SCRATCH_RELEASE();
+            return SCRATCH_OK();
         }
     }
+    SCRATCH_RELEASE();
     return 0;
 }
 
+void uECC_compress(const uint8_t public_key[uECC_BYTES*2], uint8_t compressed[uECC_BYTES+1]) {
+    wordcount_t i;
+    for (i = 0; i < uECC_BYTES; ++i) {
+        compressed[i+1] = public_key[i];
+    }
+    compressed[0] = 2 + (public_key[uECC_BYTES * 2 - 1] & 0x01);
+}
+
+/* Computes result = x^3 + b. result must not overlap x. */
+static void curve_x_side(uECC_word_t * RESTRICT result, const uECC_word_t * RESTRICT x) {
+#if (uECC_CURVE == uECC_secp256k1)
+    vli_modSquare_fast(result, x); /* r = x^2 */
+    vli_modMult_fast(result, result, x); /* r = x^3 */
+    vli_modAdd(result, result, curve_b, curve_p); /* r = x^3 + b */
+#else
+    uECC_word_t _3[uECC_WORDS] = {3}; /* -a = 3 */
+
+    vli_modSquare_fast(result, x); /* r = x^2 */
+    vli_modSub_fast(result, result, _3); /* r = x^2 - 3 */
+    vli_modMult_fast(result, result, x); /* r = x^3 - 3x */
+    vli_modAdd(result, result, curve_b, curve_p); /* r = x^3 - 3x + b */
+#endif
+}
+
+void uECC_decompress(const uint8_t compressed[uECC_BYTES+1], uint8_t public_key[uECC_BYTES*2]) {
+    if (!scratch_begin()) {
+        return;
+    }
+    SCRATCH_MARK();
+    EccPoint *point = (EccPoint *)scratch_alloc(2 * uECC_WORDS);
+    vli_bytesToNative(point->x, compressed + 1);
+    curve_x_side(point->y, point->x);
+    mod_sqrt(point->y);
+
+    if ((point->y[0] & 0x01) != (compressed[0] & 0x01)) {
+        vli_sub(point->y, curve_p, point->y);
+    }
+
+    vli_nativeToBytes(public_key, point->x);
+    vli_nativeToBytes(public_key + uECC_BYTES, point->y);
+    SCRATCH_RELEASE();
+}
+
 int uECC_bytes(void) {
     return uECC_BYTES;
 }
@@ -2144,12 +2329,17 @@ static void vli_modAdd_n(uECC_word_t *result,
 }
 
 static void vli_modInv_n(uECC_word_t *result, const uECC_word_t *input, const uECC_word_t *mod) {
-    uECC_word_t a[uECC_N_WORDS], b[uECC_N_WORDS], u[uECC_N_WORDS], v[uECC_N_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *a = scratch_alloc(uECC_N_WORDS);
+    uECC_word_t *b = scratch_alloc(uECC_N_WORDS);
+    uECC_word_t *u = scratch_alloc(uECC_N_WORDS);
+    uECC_word_t *v = scratch_alloc(uECC_N_WORDS);
     uECC_word_t carry;
     cmpresult_t cmpResult;
 
     if (vli_isZero_n(input)) {
         vli_clear_n(result);
+        SCRATCH_RELEASE();
         return;
     }
 
@@ -2209,6 +2399,7 @@ static void vli_modInv_n(uECC_word_t *result, const uECC_word_t *input, const uE
         }
     }
     vli_set_n(result, u);
+    SCRATCH_RELEASE();
 }
 
 static void vli2_rshift1_n(uECC_word_t *vli) {
@@ -2235,9 +2426,10 @@ static uECC_word_t vli2_sub_n(uECC_word_t *result,
 /* Computes result = (left * right) % curve_n. */
 static void vli_modMult_n(uECC_word_t *result, const uECC_word_t *left, const uECC_word_t *right) {
     bitcount_t i;
-    uECC_word_t product[2 * uECC_N_WORDS];
-    uECC_word_t modMultiple[2 * uECC_N_WORDS];
-    uECC_word_t tmp[2 * uECC_N_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *product = scratch_alloc(2 * uECC_N_WORDS);
+    uECC_word_t *modMultiple = scratch_alloc(2 * uECC_N_WORDS);
+    uECC_word_t *tmp = scratch_alloc(2 * uECC_N_WORDS);
     uECC_word_t *v[2] = {tmp, product};
     uECC_word_t index = 1;
 
@@ -2256,10 +2448,12 @@ static void vli_modMult_n(uECC_word_t *result, const uECC_word_t *left, const uE
         vli2_rshift1_n(modMultiple);
     }
     vli_set_n(result, v[index]);
+    SCRATCH_RELEASE();
 }
 
 #else
 
+#define vli_set_n vli_set
 #define vli_cmp_n vli_cmp
 #define vli_modInv_n vli_modInv
 #define vli_modAdd_n vli_modAdd
@@ -2287,9 +2481,10 @@ static uECC_word_t vli2_sub(uECC_word_t *result,
 
 /* Computes result = (left * right) % curve_n. */
 static void vli_modMult_n(uECC_word_t *result, const uECC_word_t *left, const uECC_word_t *right) {
-    uECC_word_t product[2 * uECC_WORDS];
-    uECC_word_t modMultiple[2 * uECC_WORDS];
-    uECC_word_t tmp[2 * uECC_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *product = scratch_alloc(2 * uECC_WORDS);
+    uECC_word_t *modMultiple = scratch_alloc(2 * uECC_WORDS);
+    uECC_word_t *tmp = scratch_alloc(2 * uECC_WORDS);
     uECC_word_t *v[2] = {tmp, product};
     bitcount_t i;
     uECC_word_t index = 1;
@@ -2304,6 +2499,7 @@ static void vli_modMult_n(uECC_word_t *result, const uECC_word_t *left, const uE
         vli2_rshift1(modMultiple);
     }
     vli_set(result, v[index]);
+    SCRATCH_RELEASE();
 }
 #endif /* (uECC_CURVE != uECC_secp160r1) */
 
@@ -2311,15 +2507,17 @@ static int uECC_sign_with_k(const uint8_t private_key[uECC_BYTES],
                             const uint8_t message_hash[uECC_BYTES],
                             uECC_word_t k[uECC_N_WORDS],
                             uint8_t signature[uECC_BYTES*2]) {
-    uECC_word_t tmp[uECC_N_WORDS];
-    uECC_word_t s[uECC_N_WORDS];
+    SCRATCH_MARK();
+    uECC_word_t *tmp = scratch_alloc(uECC_N_WORDS);
+    uECC_word_t *s = scratch_alloc(uECC_N_WORDS);
     uECC_word_t *k2[2] = {tmp, s};
-    EccPoint p;
+    EccPoint *p = (EccPoint *)scratch_alloc(2 * uECC_WORDS);
     uECC_word_t carry;
     uECC_word_t tries;
 
     /* Make sure 0 < k < curve_n */
     if (vli_isZero(k) || vli_cmp_n(curve_n, k) != 1) {
+        SCRATCH_RELEASE();
         return 0;
     }
 
@@ -2331,7 +2529,7 @@ static int uECC_sign_with_k(const uint8_t private_key[uECC_BYTES],
     vli_add_n(s, tmp, curve_n);
 
     /* p = k * G */
-    EccPoint_mult(&p, &curve_G, k2[!carry], 0, (uECC_BYTES * 8) + 2);
+    EccPoint_mult(p, &curve_G, k2[!carry], 0, (uECC_BYTES * 8) + 2);
 #else
     /* Make sure that we don't leak timing information about k.
        See http://eprint.iacr.org/2011/232.pdf */
@@ -2339,14 +2537,15 @@ static int uECC_sign_with_k(const uint8_t private_key[uECC_BYTES],
     vli_add(s, tmp, curve_n);
 
     /* p = k * G */
-    EccPoint_mult(&p, &curve_G, k2[!carry], 0, (uECC_BYTES * 8) + 1);
+    EccPoint_mult(p, &curve_G, k2[!carry], 0, (uECC_BYTES * 8) + 1);
 
     /* r = x1 (mod n) */
-    if (vli_cmp(curve_n, p.x) != 1) {
-        vli_sub(p.x, p.x, curve_n);
+    if (vli_cmp(curve_n, p->x) != 1) {
+        vli_sub(p->x, p->x, curve_n);
     }
 #endif
-    if (vli_isZero(p.x)) {
+    if (vli_isZero(p->x)) {
+        SCRATCH_RELEASE();
         return 0;
     }
 
@@ -2356,7 +2555,7 @@ static int uECC_sign_with_k(const uint8_t private_key[uECC_BYTES],
     // an RNG defined.
     carry = 0; // use to signal that the RNG succeeded at least once.
     for (tries = 0; tries < MAX_TRIES; ++tries) {
-        if (!g_rng_function((uint8_t *)tmp, sizeof(tmp))) {
+        if (!g_rng_function((uint8_t *)tmp, uECC_N_WORDS * uECC_WORD_SIZE)) {
             continue;
         }
         carry = 1;
@@ -2375,12 +2574,12 @@ static int uECC_sign_with_k(const uint8_t private_key[uECC_BYTES],
     vli_modInv_n(k, k, curve_n); /* k = 1 / k' */
     vli_modMult_n(k, k, tmp); /* k = 1 / k */
 
-    vli_nativeToBytes(signature, p.x); /* store r */
+    vli_nativeToBytes(signature, p->x); /* store r */
 
     tmp[uECC_N_WORDS - 1] = 0;
     vli_bytesToNative(tmp, private_key); /* tmp = d */
     s[uECC_N_WORDS - 1] = 0;
-    vli_set(s, p.x);
+    vli_set(s, p->x);
     vli_modMult_n(s, tmp, s); /* s = r*d */
 
     vli_bytesToNative(tmp, message_hash);
@@ -2388,32 +2587,157 @@ static int uECC_sign_with_k(const uint8_t private_key[uECC_BYTES],
     vli_modMult_n(s, s, k); /* s = (e + r*d) / k */
 #if (uECC_CURVE == uECC_secp160r1)
     if (s[uECC_N_WORDS - 1]) {
+        SCRATCH_RELEASE();
         return 0;
     }
 #endif
     vli_nativeToBytes(signature + uECC_BYTES, s);
+    SCRATCH_RELEASE();
     return 1;
 }
 
 int uECC_sign(const uint8_t private_key[uECC_BYTES],
               const uint8_t message_hash[uECC_BYTES],
               uint8_t signature[uECC_BYTES*2]) {
-    uECC_word_t k[uECC_N_WORDS];
+    if (!scratch_begin()) {
+        return 0;
+    }
+    SCRATCH_MARK();
+    uECC_word_t *k = scratch_alloc(uECC_N_WORDS);
     uECC_word_t tries;
 
     for (tries = 0; tries < MAX_TRIES; ++tries) {
-        if(g_rng_function((uint8_t *)k, sizeof(k))) {
+        if(g_rng_function((uint8_t *)k, uECC_N_WORDS * uECC_WORD_SIZE)) {
         #if (uECC_CURVE == uECC_secp160r1)
             k[uECC_WORDS] &= 0x01;
         #endif
             if (uECC_sign_with_k(private_key, message_hash, k, signature)) {
-                return 1;
+                SCRATCH_RELEASE();
+                return SCRATCH_OK();
             }
         }
     }
+    SCRATCH_RELEASE();
     return 0;
 }
 
+/* Compute an HMAC using K as a key (as in RFC 6979). Note that K is always
+   the same size as the hash result size. */
+static void HMAC_init(uECC_HashContext *hash_context, const uint8_t *K) {
+    uint8_t *pad = hash_context->tmp + 2 * hash_context->result_size;
+    unsigned i;
+    for (i = 0; i < hash_context->result_size; ++i)
+        pad[i] = K[i] ^ 0x36;
+    for (; i < hash_context->block_size; ++i)
+        pad[i] = 0x36;
+
+    hash_context->init_hash(hash_context);
+    hash_context->update_hash(hash_context, pad, hash_context->block_size);
+}
+
+static void HMAC_update(uECC_HashContext *hash_context,
+                        const uint8_t *message,
+                        unsigned message_size) {
+    hash_context->update_hash(hash_context, message, message_size);
+}
+
+static void HMAC_finish(uECC_HashContext *hash_context, const uint8_t *K, uint8_t *result) {
+    uint8_t *pad = hash_context->tmp + 2 * hash_context->result_size;
+    unsigned i;
+    for (i = 0; i < hash_context->result_size; ++i)
+        pad[i] = K[i] ^ 0x5c;
+    for (; i < hash_context->block_size; ++i)
+        pad[i] = 0x5c;
+
+    hash_context->finish_hash(hash_context, result);
+
+    hash_context->init_hash(hash_context);
+    hash_context->update_hash(hash_context, pad, hash_context->block_size);
+    hash_context->update_hash(hash_context, result, hash_context->result_size);
+    hash_context->finish_hash(hash_context, result);
+}
+
+/* V = HMAC_K(V) */
+static void update_V(uECC_HashContext *hash_context, uint8_t *K, uint8_t *V) {
+    HMAC_init(hash_context, K);
+    HMAC_update(hash_context, V, hash_context->result_size);
+    HMAC_finish(hash_context, K, V);
+}
+
+/* Deterministic signing, similar to RFC 6979. Differences are:
+    * We just use (truncated) H(m) directly rather than bits2octets(H(m))
+      (it is not reduced modulo curve_n).
+    * We generate a value for k (aka T) directly rather than converting endianness.
+
+   Layout of hash_context->tmp: <K> | <V> | (1 byte overlapped 0x00 or 0x01) / <HMAC pad> */
+int uECC_sign_deterministic(const uint8_t private_key[uECC_BYTES],
+                            const uint8_t message_hash[uECC_BYTES],
+                            uECC_HashContext *hash_context,
+                            uint8_t signature[uECC_BYTES*2]) {
+    if (!scratch_begin()) {
+        return 0;
+    }
+    uint8_t *K = hash_context->tmp;
+    uint8_t *V = K + hash_context->result_size;
+    SCRATCH_MARK();
+    uECC_word_t *T = scratch_alloc(uECC_N_WORDS);
+    uECC_word_t tries;
+    unsigned i;
+    for (i = 0; i < hash_context->result_size; ++i) {
+        V[i] = 0x01;
+        K[i] = 0;
+    }
+
+    // K = HMAC_K(V || 0x00 || int2octets(x) || h(m))
+    HMAC_init(hash_context, K);
+    V[hash_context->result_size] = 0x00;
+    HMAC_update(hash_context, V, hash_context->result_size + 1);
+    HMAC_update(hash_context, private_key, uECC_BYTES);
+    HMAC_update(hash_context, message_hash, uECC_BYTES);
+    HMAC_finish(hash_context, K, K);
+
+    update_V(hash_context, K, V);
+
+    // K = HMAC_K(V || 0x01 || int2octets(x) || h(m))
+    HMAC_init(hash_context, K);
+    V[hash_context->result_size] = 0x01;
+    HMAC_update(hash_context, V, hash_context->result_size + 1);
+    HMAC_update(hash_context, private_key, uECC_BYTES);
+    HMAC_update(hash_context, message_hash, uECC_BYTES);
+    HMAC_finish(hash_context, K, K);
+
+    update_V(hash_context, K, V);
+
+    for (tries = 0; tries < MAX_TRIES; ++tries) {
+        uint8_t *T_ptr = (uint8_t *)T;
+        unsigned T_bytes = 0;
+        while (T_bytes < uECC_N_WORDS * uECC_WORD_SIZE) {
+            update_V(hash_context, K, V);
+            for (i = 0; i < hash_context->result_size && T_bytes < uECC_N_WORDS * uECC_WORD_SIZE;
+                 ++i, ++T_bytes) {
+                T_ptr[T_bytes] = V[i];
+            }
+        }
+    #if (uECC_CURVE == uECC_secp160r1)
+        T[uECC_WORDS] &= 0x01;
+    #endif
+
+        if (uECC_sign_with_k(private_key, message_hash, T, signature)) {
+            SCRATCH_RELEASE();
+            return SCRATCH_OK();
+        }
+
+        // K = HMAC_K(V || 0x00)
+        HMAC_init(hash_context, K);
+        V[hash_context->result_size] = 0x00;
+        HMAC_update(hash_context, V, hash_context->result_size + 1);
+        HMAC_finish(hash_context, K, K);
+
+        update_V(hash_context, K, V);
+    }
+    SCRATCH_RELEASE();
+    return 0;
+}
 
 static bitcount_t smax(bitcount_t a, bitcount_t b) {
     return (a > b ? a : b);
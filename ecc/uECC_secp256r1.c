@@ -0,0 +1,22 @@
+/* Copyright 2014, Kenneth MacKay. Licensed under the BSD 2-clause license. */
+
+/* Builds uECC.c a second time for secp256r1, with every public function renamed
+   uECC_secp256r1_xxx (see uECC_secp256r1.h). Everything else in uECC.c is static, so the curve
+   specific code (vli_mmod_fast() and friends) of both curves can be linked in the same image.
+   The looped assembly keeps the 32-byte multiplication small in flash. */
+
+#define uECC_CURVE uECC_secp256r1
+#define uECC_ASM uECC_asm_small
+
+#define uECC_set_rng uECC_secp256r1_set_rng
+#define uECC_set_scratch uECC_secp256r1_set_scratch
+#define uECC_scratch_peak uECC_secp256r1_scratch_peak
+#define uECC_make_key uECC_secp256r1_make_key
+#define uECC_compress uECC_secp256r1_compress
+#define uECC_decompress uECC_secp256r1_decompress
+#define uECC_bytes uECC_secp256r1_bytes
+#define uECC_curve uECC_secp256r1_curve
+#define uECC_sign uECC_secp256r1_sign
+#define uECC_sign_deterministic uECC_secp256r1_sign_deterministic
+
+#include "uECC.c"
@@ -0,0 +1,48 @@
+/* Copyright 2014, Kenneth MacKay. Licensed under the BSD 2-clause license. */
+
+#ifndef _MICRO_ECC_SECP256R1_H_
+#define _MICRO_ECC_SECP256R1_H_
+
+#include "uECC.h"
+
+/* Second copy of uECC, compiled for secp256r1 by uECC_secp256r1.c and linked next to the
+default curve (uECC_CURVE). Each function below behaves like the uECC_xxx() function of the same
+name in uECC.h, with the sizes of secp256r1. Both copies have their own RNG function and scratch
+arena settings, so uECC_secp256r1_set_rng() and uECC_secp256r1_set_scratch() must be called as
+well; both copies can share the same arena. */
+
+#define uECC_secp256r1_BYTES 32
+
+/* Size in bytes of the scratch arena needed by the secp256r1 copy (uECC_SCRATCH_SIZE of secp256r1). */
+#define uECC_secp256r1_SCRATCH_SIZE (13 * uECC_secp256r1_BYTES)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+void uECC_secp256r1_set_rng(uECC_RNG_Function rng_function);
+int uECC_secp256r1_set_scratch(void *scratch, unsigned size);
+unsigned uECC_secp256r1_scratch_peak(void);
+
+int uECC_secp256r1_make_key(uint8_t public_key[uECC_secp256r1_BYTES*2],
+                            uint8_t private_key[uECC_secp256r1_BYTES]);
+
+void uECC_secp256r1_compress(const uint8_t public_key[uECC_secp256r1_BYTES*2],
+                             uint8_t compressed[uECC_secp256r1_BYTES+1]);
+void uECC_secp256r1_decompress(const uint8_t compressed[uECC_secp256r1_BYTES+1],
+                               uint8_t public_key[uECC_secp256r1_BYTES*2]);
+
+int uECC_secp256r1_sign(const uint8_t private_key[uECC_secp256r1_BYTES],
+                        const uint8_t message_hash[uECC_secp256r1_BYTES],
+                        uint8_t signature[uECC_secp256r1_BYTES*2]);
+int uECC_secp256r1_sign_deterministic(const uint8_t private_key[uECC_secp256r1_BYTES],
+                                      const uint8_t message_hash[uECC_secp256r1_BYTES],
+                                      uECC_HashContext *hash_context,
+                                      uint8_t signature[uECC_secp256r1_BYTES*2]);
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+#endif
+
+#endif /* _MICRO_ECC_SECP256R1_H_ */
@@ -0,0 +1,261 @@
+#include "entropy.h"
+#include "sha256.h"
+
+#include <util/atomic.h>
+#include <string.h>
+
+// SP 800-90B health test cutoffs for an assessed min-entropy of 1 bit per sample (alpha = 2^-20)
+#define RCT_CUTOFF 21 // 1 + ceil(20 / H)
+#define APT_WINDOW 512 // Window size for non-binary sources
+#define APT_CUTOFF 410 // Critical value for H = 1, W = 512
+#define STARTUP_SAMPLES 1024 // ADC samples tested at power-up, before the DRBG is seeded
+// Consecutive jitter ticks that must pass the tests before the RNG is enabled: ~1 s, so that the
+// RNG is ready when the host sends its first request after the reset on port open. SP 800-90B
+// asks for 1024 startup samples, which would keep the RNG off for ~16 s after every reset.
+#define STARTUP_TICKS 64
+#define RESEED_BITS 64 // Credited bits needed before the pool is folded into the DRBG key
+
+#define HEALTH_ERR_RCT 0x01 // Repetition Count Test failed at least once (either source)
+#define HEALTH_ERR_APT 0x02 // Adaptive Proportion Test failed at least once (either source)
+#define HEALTH_ALARM 0x04 // A test of the jitter source failed: no output until STARTUP_TICKS pass again
+#define HEALTH_STARTING 0x08 // Startup test of the jitter source still running (~1 s)
+
+/**
+ * @brief State of the continuous health tests for one noise source.
+ *
+ * Fields:
+ * - last: Previous sample (Repetition Count Test).
+ * - rct_count: Number of consecutive identical samples.
+ * - apt_ref: First sample of the current window (Adaptive Proportion Test).
+ * - apt_count: Occurrences of apt_ref in the current window.
+ * - apt_index: Position in the current window.
+ */
+typedef struct {
+    uint8_t last;
+    uint8_t rct_count;
+    uint8_t apt_ref;
+    uint16_t apt_count;
+    uint16_t apt_index;
+} HealthTest;
+
+static volatile uint8_t pool[ENTROPY_POOL_SIZE]; // Input pool, written by the WDT interrupt
+static volatile uint8_t pool_index = 0; // Next pool byte to mix into
+static volatile uint16_t pool_credit = 0; // Entropy bits credited since the last reseed
+static volatile uint8_t health = HEALTH_STARTING; // HEALTH_* flags
+static volatile uint8_t health_passed = 0; // Jitter ticks that passed since the last failure
+
+static HealthTest jitter_test; // Watchdog vs crystal jitter source
+static HealthTest adc_test; // ADC LSB noise source
+
+static uint8_t drbg_key[SHA256_DIGEST_SIZE]; // Hash DRBG secret state
+static uint32_t drbg_counter = 0; // Hash DRBG block counter
+
+//--------------------------------- Health tests ---------------------------------
+
+/**
+ * @brief Runs the Repetition Count and Adaptive Proportion Tests on a raw sample.
+ *
+ * @param test Pointer to the test state of the noise source.
+ * @param sample The raw sample.
+ * @return uint8_t : 0 if the sample passed, HEALTH_ERR_RCT or HEALTH_ERR_APT otherwise.
+ */
+static uint8_t health_test(HealthTest *test, uint8_t sample) {
+    uint8_t result = 0;
+
+    // Repetition Count Test
+    if (sample == test->last && test->rct_count) {
+        if (++test->rct_count >= RCT_CUTOFF) {
+            result = HEALTH_ERR_RCT;
+            test->rct_count = 1;
+        }
+    } else {
+        test->last = sample;
+        test->rct_count = 1;
+    }
+
+    // Adaptive Proportion Test
+    if (test->apt_index == 0) {
+        test->apt_ref = sample; // Start of a new window
+        test->apt_count = 1;
+    } else if (sample == test->apt_ref) {
+        if (++test->apt_count >= APT_CUTOFF) {
+            result |= HEALTH_ERR_APT;
+            test->apt_index = APT_WINDOW - 1; // Restart with the next sample
+        }
+    }
+    if (++test->apt_index == APT_WINDOW) {
+        test->apt_index = 0;
+    }
+
+    return result;
+}
+
+//--------------------------------- Pool ---------------------------------
+
+/**
+ * @brief Folds a raw sample into the input pool with a cheap rotate-and-xor.
+ *        The pool is only ever read through SHA-256, which does the conditioning.
+ *
+ * @param sample The raw sample.
+ * @return None.
+ */
+static void pool_mix(uint8_t sample) {
+    uint8_t i = pool_index;
+    uint8_t byte = pool[i];
+
+    byte = (byte << 3) | (byte >> 5); // Rotate left by 3
+    pool[i] = byte ^ sample ^ pool[(i + 7) & (ENTROPY_POOL_SIZE - 1)];
+    pool_index = (i + 1) & (ENTROPY_POOL_SIZE - 1);
+}
+
+/**
+ * @brief Collects timing jitter between the watchdog RC oscillator and the crystal-driven
+ *        Timer1, plus the LSB noise of the conversion started on the previous tick.
+ *        Fires every ~16 ms while the device idles.
+ *        A failed test of the jitter source, the only credited one, raises HEALTH_ALARM and
+ *        drops the credited entropy: the RNG stays off until STARTUP_TICKS ticks pass in a
+ *        row, as at power-up. A failed ADC sample is only discarded.
+ */
+ISR(WDT_vect) {
+    uint8_t sample = TCNT1L; // Phase of the crystal clock when the watchdog fires
+    uint8_t result = health_test(&jitter_test, sample);
+
+    if (result) { // A failed sample is discarded
+        health |= result | HEALTH_ALARM;
+        health_passed = 0;
+        pool_credit = 0;
+    } else {
+        pool_mix(sample);
+        if (pool_credit < ENTROPY_POOL_SIZE * 8 && !(health & (HEALTH_ALARM | HEALTH_STARTING))) {
+            pool_credit++; // Credit 1 bit per jitter sample
+        }
+        if (health_passed < STARTUP_TICKS && ++health_passed == STARTUP_TICKS) {
+            health &= ~(HEALTH_ALARM | HEALTH_STARTING);
+        }
+    }
+
+    if (!(ADCSRA & (1 << ADSC))) {
+        sample = ADCL; // LSBs of the last conversion (ADCH is discarded)
+        (void)ADCH;
+        result = health_test(&adc_test, sample);
+        if (result) {
+            health |= result; // Not credited: the RNG goes on
+        } else {
+            pool_mix(sample); // Mixed in, but not credited
+        }
+        ADCSRA |= (1 << ADSC); // Start the next conversion
+    }
+
+    WDTCSR |= (1 << WDIE); // Stay in interrupt mode
+}
+
+//--------------------------------- Setup ---------------------------------
+
+/**
+ * @brief Starts the noise sources, mixes 1024 ADC samples that pass the health tests
+ *        (about 0.1 s) and seeds the DRBG. Enables global interrupts. The jitter source is
+ *        only sampled by the watchdog: its startup test runs in the background, and the RNG
+ *        produces nothing until STARTUP_TICKS of its samples have passed (~1 s after power-up).
+ *
+ * @param None.
+ * @return None.
+ */
+void entropy_init(void) {
+    SHA256_CTX ctx;
+
+    // Timer1 free-running at F_CPU, sampled by the watchdog interrupt
+    TCCR1A = 0;
+    TCCR1B = (1 << CS10);
+
+    // ADC on channel 0 with AVcc reference, prescaler 128 for a 125 kHz ADC clock
+    ADMUX = (1 << REFS0);
+    ADCSRA = (1 << ADEN) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+
+    // Startup samples of the ADC: uncredited, a failed sample is only left out of the seed
+    for (uint16_t i = 0; i < STARTUP_SAMPLES; i++) {
+        ADCSRA |= (1 << ADSC);
+        while (ADCSRA & (1 << ADSC));
+        uint8_t sample = ADCL;
+        (void)ADCH;
+        if (!health_test(&adc_test, sample)) {
+            pool_mix(sample ^ TCNT1L);
+        }
+    }
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const uint8_t*)pool, ENTROPY_POOL_SIZE);
+    sha256_final(&ctx, drbg_key);
+
+    // Watchdog in interrupt mode (no reset), ~16 ms period
+    cli();
+    WDTCSR = (1 << WDCE) | (1 << WDE);
+    WDTCSR = (1 << WDIE);
+    sei();
+}
+
+//--------------------------------- DRBG ---------------------------------
+
+/**
+ * @brief Hashes the DRBG key with the current counter value.
+ *
+ * @param out Pointer to the output buffer (32 bytes).
+ * @return None.
+ */
+static void drbg_block(uint8_t *out) {
+    SHA256_CTX ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, drbg_key, SHA256_DIGEST_SIZE);
+    sha256_update(&ctx, (const uint8_t*)&drbg_counter, sizeof(drbg_counter));
+    sha256_final(&ctx, out);
+    drbg_counter++;
+}
+
+/**
+ * @brief Generates random bytes from a SHA-256 hash DRBG. The input pool is folded into the
+ *        key once enough entropy has been credited, but the call never waits for new samples.
+ *
+ * @param dest Pointer to the buffer where random bytes will be stored.
+ * @param size Number of bytes to generate.
+ * @return int : 1 on success, 0 if the startup test of the jitter source has not finished,
+ *         or if one of its tests failed since it last passed STARTUP_TICKS ticks.
+ */
+int avr_rng(uint8_t *dest, unsigned size) {
+    SHA256_CTX ctx;
+    uint8_t snapshot[ENTROPY_POOL_SIZE];
+    uint8_t block[SHA256_DIGEST_SIZE];
+    uint16_t credit;
+
+    if (health & (HEALTH_ALARM | HEALTH_STARTING)) {
+        return 0; // Noise source is broken, or not proven healthy yet
+    }
+
+    // Reseed: key = SHA-256(key || pool)
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        credit = pool_credit;
+        if (credit >= RESEED_BITS) {
+            memcpy(snapshot, (const uint8_t*)pool, ENTROPY_POOL_SIZE);
+            pool_credit = 0;
+        }
+    }
+    if (credit >= RESEED_BITS) {
+        sha256_init(&ctx);
+        sha256_update(&ctx, drbg_key, SHA256_DIGEST_SIZE);
+        sha256_update(&ctx, snapshot, ENTROPY_POOL_SIZE);
+        sha256_final(&ctx, drbg_key);
+    }
+
+    while (size) {
+        uint8_t n = size < SHA256_DIGEST_SIZE ? size : SHA256_DIGEST_SIZE;
+        drbg_block(block);
+        memcpy(dest, block, n);
+        dest += n;
+        size -= n;
+    }
+
+    // Replace the key so that past outputs cannot be recomputed
+    drbg_block(drbg_key);
+    memset(block, 0, sizeof(block));
+    memset(snapshot, 0, sizeof(snapshot));
+    return 1;
+}
@@ -0,0 +1,13 @@
+#ifndef ENTROPY_H
+#define ENTROPY_H
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+#define ENTROPY_POOL_SIZE 32 // Raw samples are folded into a 32-byte pool
+
+void entropy_init(void);
+int avr_rng(uint8_t *dest, unsigned size);
+
+#endif
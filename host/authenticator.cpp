@@ -0,0 +1,552 @@
+#include "authenticator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace authenticator {
+
+namespace {
+
+constexpr size_t PUBLIC_KEY_SIZE = 40;
+constexpr size_t COMPRESSED_PUBLIC_KEY_SIZE = 21;
+constexpr size_t P256_PUBLIC_KEY_SIZE = 64;
+constexpr size_t COUNTER_SIZE = 4;
+
+[[noreturn]] void throw_errno(const char *what) {
+    throw std::system_error(errno, std::generic_category(), what);
+}
+
+/**
+ * @brief Response size of the commands that only answer with a status byte on error.
+ */
+size_t status_then(const std::vector<uint8_t> &response, size_t size_if_ok) {
+    if (response.empty() || response[0] != static_cast<uint8_t>(Status::Ok)) {
+        return 1;
+    }
+    return size_if_ok;
+}
+
+} // namespace
+
+std::chrono::milliseconds command_timeout(Command command) {
+    switch (command) {
+        case Command::MakeCredential:
+        case Command::GetAssertion:
+        case Command::GetAssertionRaw:
+        case Command::MakeCredentialCompressed:
+        case Command::MakeCredentialSecp256r1:
+        case Command::GetAssertionAllowList:
+        case Command::MakeCredentialUser:
+        case Command::GetAssertionUser:
+        case Command::DeleteCredential:
+        case Command::ImportCredentials:
+            return APPROVAL_WAIT + DEFAULT_TIMEOUT; // Key generation or signature: 0.5 s at most
+        case Command::Reset:
+        case Command::ImportBackup:
+            return APPROVAL_WAIT + STORE_WRITE_TIME + DEFAULT_TIMEOUT;
+        case Command::ExportBackup:
+            return APPROVAL_WAIT + 2 * STORE_WRITE_TIME + DEFAULT_TIMEOUT;
+        default:
+            return DEFAULT_TIMEOUT;
+    }
+}
+
+int open_serial(const std::string &path) {
+    struct termios tty;
+    int fd = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd < 0) {
+        throw_errno("open");
+    }
+    if (tcgetattr(fd, &tty) != 0) {
+        ::close(fd);
+        throw_errno("tcgetattr");
+    }
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, B115200);
+    cfsetospeed(&tty, B115200);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tty.c_cc[VMIN] = 1; // With O_NONBLOCK, an empty port gives EAGAIN, and 0 means hang-up
+    tty.c_cc[VTIME] = 0;
+    if (tcsetattr(fd, TCSANOW, &tty) != 0) {
+        ::close(fd);
+        throw_errno("tcsetattr");
+    }
+    tcflush(fd, TCIOFLUSH);
+    return fd;
+}
+
+int open_pseudo_terminal(std::string &path) {
+    struct termios tty;
+    int master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+    if (master < 0) {
+        throw_errno("posix_openpt");
+    }
+    if (grantpt(master) != 0 || unlockpt(master) != 0) {
+        ::close(master);
+        throw_errno("unlockpt");
+    }
+    path = ptsname(master);
+
+    int terminal = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC); // Never closed, see header
+    if (terminal < 0 || tcgetattr(terminal, &tty) != 0) {
+        ::close(master);
+        throw_errno("open");
+    }
+    cfmakeraw(&tty);
+    tcsetattr(terminal, TCSANOW, &tty);
+    return master;
+}
+
+Device::Device(const std::string &path, size_t pipeline_bytes)
+    : serial_fd_(open_serial(path)), pipeline_bytes_(std::min(pipeline_bytes, FIRMWARE_RX_BUFFER_SIZE)) {
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        ::close(serial_fd_);
+        throw_errno("epoll_create1");
+    }
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = serial_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, serial_fd_, &event) != 0) {
+        ::close(epoll_fd_);
+        ::close(serial_fd_);
+        throw_errno("epoll_ctl");
+    }
+}
+
+Device::~Device() {
+    ::close(epoll_fd_);
+    ::close(serial_fd_);
+}
+
+// --------------------------------- Requests ---------------------------------
+
+void Device::list_credentials(std::function<void(const ListResult &)> done) {
+    Request request;
+
+    request.frame = {static_cast<uint8_t>(Command::ListCredentials)};
+    request.timeout = DEFAULT_TIMEOUT;
+    request.response_size = [](const std::vector<uint8_t> &response) {
+        if (response.size() < 2) {
+            return status_then(response, 2);
+        }
+        return 2 + response[1] * (CREDENTIAL_ID_SIZE + APP_ID_SIZE);
+    };
+    request.complete = [done](Error error, const std::vector<uint8_t> &response) {
+        ListResult result;
+
+        result.error = error;
+        if (error == Error::None) {
+            result.status = static_cast<Status>(response[0]);
+            for (size_t offset = 2; offset < response.size(); offset += CREDENTIAL_ID_SIZE + APP_ID_SIZE) {
+                Credential credential;
+
+                std::copy_n(response.begin() + offset, CREDENTIAL_ID_SIZE, credential.credential_id.begin());
+                std::copy_n(response.begin() + offset + CREDENTIAL_ID_SIZE, APP_ID_SIZE, credential.app_id.begin());
+                result.credentials.push_back(credential);
+            }
+        }
+        done(result);
+    };
+    submit(std::move(request));
+}
+
+void Device::make_credential(const AppId &app_id, Curve curve, bool compressed,
+                             std::function<void(const MakeCredentialResult &)> done) {
+    Request request;
+    Command command = Command::MakeCredential;
+    size_t public_key_size = PUBLIC_KEY_SIZE;
+
+    if (curve == Curve::Secp256r1) {
+        command = Command::MakeCredentialSecp256r1;
+        public_key_size = P256_PUBLIC_KEY_SIZE;
+    } else if (compressed) {
+        command = Command::MakeCredentialCompressed;
+        public_key_size = COMPRESSED_PUBLIC_KEY_SIZE;
+    }
+
+    request.frame.push_back(static_cast<uint8_t>(command));
+    request.frame.insert(request.frame.end(), app_id.begin(), app_id.end());
+    request.timeout = command_timeout(command);
+    request.response_size = [public_key_size](const std::vector<uint8_t> &response) {
+        return status_then(response, 1 + CREDENTIAL_ID_SIZE + public_key_size);
+    };
+    request.complete = [done](Error error, const std::vector<uint8_t> &response) {
+        MakeCredentialResult result;
+
+        result.error = error;
+        if (error == Error::None) {
+            result.status = static_cast<Status>(response[0]);
+            if (result.status == Status::Ok) {
+                std::copy_n(response.begin() + 1, CREDENTIAL_ID_SIZE, result.credential_id.begin());
+                result.public_key.assign(response.begin() + 1 + CREDENTIAL_ID_SIZE, response.end());
+            }
+        }
+        done(result);
+    };
+    if (command == Command::MakeCredentialCompressed && !compressed_supported_) {
+        probe_compressed(std::move(request));
+        return;
+    }
+    submit(std::move(request));
+}
+
+/**
+ * @brief Sends `request` (MakeCredentialCompressed) once StoreVersion, which has no payload,
+ *        is known to the firmware. A firmware without command 5 answers CommandUnknown and then
+ *        reads the 20 bytes of the app ID as commands (Reset among them): it must never see
+ *        the frame. StoreVersion came after command 5, so a firmware that knows it knows
+ *        command 5; otherwise `request` fails with Status::CommandUnknown without being sent.
+ *        The probe is alone on the line, so that nothing is written behind it meanwhile.
+ */
+void Device::probe_compressed(Request request) {
+    Request probe;
+
+    probe.frame = {static_cast<uint8_t>(Command::StoreVersion)};
+    probe.timeout = DEFAULT_TIMEOUT;
+    probe.exclusive = true;
+    probe.response_size = [](const std::vector<uint8_t> &response) { return status_then(response, 3); };
+    probe.complete = [this, request = std::move(request)](Error error, const std::vector<uint8_t> &response) mutable {
+        if (error != Error::None) {
+            request.complete(error, {});
+            return;
+        }
+        if (response[0] != static_cast<uint8_t>(Status::Ok)) {
+            request.complete(Error::None, {static_cast<uint8_t>(Status::CommandUnknown)});
+            return;
+        }
+        compressed_supported_ = true;
+        requests_.push_front(std::move(request)); // Written by write_pending(), after this callback
+        deadline_ = Clock::now() + requests_.front().timeout;
+    };
+    submit(std::move(probe));
+}
+
+void Device::get_assertion(const AppId &app_id, const ClientData &client_data, Curve curve,
+                           std::function<void(const AssertionResult &)> done) {
+    Request request;
+    size_t signature_size = (curve == Curve::Secp256r1) ? P256_PUBLIC_KEY_SIZE : PUBLIC_KEY_SIZE;
+
+    request.frame.push_back(static_cast<uint8_t>(Command::GetAssertion));
+    request.frame.insert(request.frame.end(), app_id.begin(), app_id.end());
+    request.frame.insert(request.frame.end(), client_data.begin(), client_data.end());
+    request.timeout = command_timeout(Command::GetAssertion);
+    request.response_size = [signature_size](const std::vector<uint8_t> &response) {
+        return status_then(response, 1 + CREDENTIAL_ID_SIZE + signature_size + COUNTER_SIZE);
+    };
+    request.complete = [done, signature_size](Error error, const std::vector<uint8_t> &response) {
+        AssertionResult result;
+
+        result.error = error;
+        if (error == Error::None) {
+            result.status = static_cast<Status>(response[0]);
+            if (result.status == Status::Ok) {
+                auto signature = response.begin() + 1 + CREDENTIAL_ID_SIZE;
+
+                std::copy_n(response.begin() + 1, CREDENTIAL_ID_SIZE, result.credential_id.begin());
+                result.signature.assign(signature, signature + signature_size);
+                for (auto byte = signature + signature_size; byte != response.end(); ++byte) {
+                    result.counter = (result.counter << 8) | *byte; // Big endian
+                }
+            }
+        }
+        done(result);
+    };
+    submit(std::move(request));
+}
+
+void Device::reset(std::function<void(const ResetResult &)> done) {
+    Request request;
+
+    request.frame = {static_cast<uint8_t>(Command::Reset)};
+    request.timeout = command_timeout(Command::Reset);
+    request.response_size = [](const std::vector<uint8_t> &) { return size_t(1); };
+    request.complete = [done](Error error, const std::vector<uint8_t> &response) {
+        ResetResult result;
+
+        result.error = error;
+        if (error == Error::None) {
+            result.status = static_cast<Status>(response[0]);
+        }
+        done(result);
+    };
+    submit(std::move(request));
+}
+
+void Device::store_version(std::function<void(const StoreVersionResult &)> done) {
+    Request request;
+
+    request.frame = {static_cast<uint8_t>(Command::StoreVersion)};
+    request.timeout = DEFAULT_TIMEOUT;
+    request.response_size = [](const std::vector<uint8_t> &response) { return status_then(response, 3); };
+    request.complete = [done](Error error, const std::vector<uint8_t> &response) {
+        StoreVersionResult result;
+
+        result.error = error;
+        if (error == Error::None) {
+            result.status = static_cast<Status>(response[0]);
+            if (result.status == Status::Ok) {
+                result.version = response[1];
+                result.credentials = response[2];
+            }
+        }
+        done(result);
+    };
+    submit(std::move(request));
+}
+
+void Device::set_baud_rate(uint32_t baud, std::function<void(const BaudRateResult &)> done) {
+    auto rate = std::find(BAUD_RATES.begin(), BAUD_RATES.end(), baud);
+    Request request;
+
+    if (rate == BAUD_RATES.end()) {
+        BaudRateResult result;
+
+        result.status = Status::BadParameter;
+        result.baud = baud_;
+        done(result);
+        return;
+    }
+    request.frame = {static_cast<uint8_t>(Command::SetBaudRate), static_cast<uint8_t>(rate - BAUD_RATES.begin())};
+    request.timeout = DEFAULT_TIMEOUT;
+    request.exclusive = true;
+    request.response_size = [](const std::vector<uint8_t> &) { return size_t(1); };
+    request.complete = [this, baud, frame = request.frame, done](Error error, const std::vector<uint8_t> &response) {
+        BaudRateResult result;
+        Request confirm;
+
+        result.error = error;
+        result.baud = baud_;
+        if (error != Error::None || response[0] != static_cast<uint8_t>(Status::Ok)) {
+            result.status = (error == Error::None) ? static_cast<Status>(response[0]) : Status::Ok;
+            done(result);
+            return;
+        }
+
+        // The authenticator now listens at the new rate, until the confirmation times out
+        if (!set_serial_speed(serial_fd_, baud)) {
+            result.error = Error::Io;
+            done(result);
+            fail_all(Error::Io);
+            return;
+        }
+        confirm.frame = frame;
+        confirm.timeout = BAUD_CONFIRM_TIMEOUT;
+        confirm.exclusive = true;
+        confirm.recoverable = true;
+        confirm.response_size = [](const std::vector<uint8_t> &) { return size_t(1); };
+        confirm.complete = [this, baud, done](Error error, const std::vector<uint8_t> &response) {
+            BaudRateResult result;
+
+            result.error = error;
+            if (error == Error::None && response[0] == static_cast<uint8_t>(Status::Ok)) {
+                baud_ = baud;
+            } else {
+                // Silence or garbled answer: the authenticator falls back to 115200
+                baud_ = BAUD_RATES[0];
+                set_serial_speed(serial_fd_, baud_);
+                result.error = Error::Timeout;
+            }
+            result.baud = baud_;
+            done(result);
+        };
+        requests_.push_front(std::move(confirm)); // Written by write_pending(), after this callback
+        deadline_ = Clock::now() + BAUD_CONFIRM_TIMEOUT;
+    };
+    submit(std::move(request));
+}
+
+// --------------------------------- Event loop ---------------------------------
+
+void Device::submit(Request request) {
+    if (request.frame.size() > FIRMWARE_RX_BUFFER_SIZE) {
+        // The firmware does not read a frame while it is busy: bytes beyond its ring are lost
+        throw std::invalid_argument("Device: frame larger than the RX buffer of the firmware");
+    }
+    if (requests_.empty()) {
+        deadline_ = Clock::now() + request.timeout; // Processed as soon as it is received
+    }
+    requests_.push_back(std::move(request));
+    write_pending();
+}
+
+/**
+ * @brief Number of bytes written for the requests not answered yet, the one being processed
+ *        included: at worst, the firmware has not read any of them from its RX buffer.
+ */
+size_t Device::bytes_unanswered() const {
+    size_t bytes = 0;
+
+    for (size_t i = 0; i < requests_.size(); i++) {
+        bytes += requests_[i].sent;
+    }
+    return bytes;
+}
+
+void Device::write_pending() {
+    size_t unanswered = bytes_unanswered();
+
+    for (size_t i = 0; i < requests_.size(); i++) {
+        Request &request = requests_[i];
+
+        if (i > 0 && (request.exclusive || requests_[0].exclusive)) {
+            break; // Written once the requests ahead are answered, or waiting for it
+        }
+        while (request.sent < request.frame.size()) {
+            size_t size = request.frame.size() - request.sent;
+
+            if (i > 0 && unanswered + size > pipeline_bytes_) {
+                update_epoll();
+                return; // Does not fit in the window with the requests ahead, wait for a response
+            }
+            ssize_t written = ::write(serial_fd_, request.frame.data() + request.sent, size);
+            if (written < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    want_write_ = true;
+                    update_epoll();
+                    return;
+                }
+                fail_all(Error::Io);
+                return;
+            }
+            request.sent += written;
+            unanswered += written;
+        }
+        if (i == 0 && pipeline_bytes_ == 0) {
+            break; // No pipelining: the next request waits for this response
+        }
+    }
+    want_write_ = false;
+    update_epoll();
+}
+
+void Device::read_available() {
+    uint8_t buffer[256];
+
+    for (;;) {
+        ssize_t size = ::read(serial_fd_, buffer, sizeof(buffer));
+
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (size <= 0) {
+            fail_all(Error::Io);
+            return;
+        }
+        if (!requests_.empty()) {
+            response_.insert(response_.end(), buffer, buffer + size); // Unexpected bytes are dropped
+        }
+    }
+
+    while (!requests_.empty()) {
+        Request &request = requests_.front();
+        size_t size = request.response_size(response_);
+
+        if (response_.size() < size) {
+            break;
+        }
+        std::vector<uint8_t> response(response_.begin(), response_.begin() + size);
+        auto complete = std::move(request.complete);
+
+        response_.erase(response_.begin(), response_.begin() + size);
+        requests_.pop_front();
+        if (!requests_.empty()) {
+            deadline_ = Clock::now() + requests_.front().timeout;
+        }
+        complete(Error::None, response);
+    }
+    write_pending(); // A response frees room in the pipelining window
+}
+
+void Device::fail_all(Error error) {
+    std::deque<Request> failed;
+
+    failed.swap(requests_);
+    response_.clear();
+    tcflush(serial_fd_, TCIOFLUSH); // Late bytes would be taken for the next response
+    want_write_ = false;
+    update_epoll();
+    for (Request &request : failed) {
+        request.complete(error, {});
+    }
+}
+
+/**
+ * @brief Fails the request being processed alone (Request::recoverable) on timeout, and goes on
+ *        with the next ones: no other byte was in flight.
+ */
+void Device::expire_front() {
+    Request request = std::move(requests_.front());
+
+    requests_.pop_front();
+    response_.clear();
+    tcflush(serial_fd_, TCIFLUSH);
+    if (!requests_.empty()) {
+        deadline_ = Clock::now() + requests_.front().timeout;
+    }
+    request.complete(Error::Timeout, {});
+    write_pending();
+}
+
+void Device::update_epoll() {
+    struct epoll_event event = {};
+
+    event.events = EPOLLIN | (want_write_ ? static_cast<uint32_t>(EPOLLOUT) : 0u);
+    event.data.fd = serial_fd_;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, serial_fd_, &event);
+}
+
+size_t Device::run_once(std::chrono::milliseconds max_wait) {
+    struct epoll_event events[1];
+    auto wait = max_wait;
+
+    if (!requests_.empty()) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline_ - Clock::now());
+        wait = std::max(std::chrono::milliseconds(0), std::min(wait, left + std::chrono::milliseconds(1)));
+    }
+
+    int count = epoll_wait(epoll_fd_, events, 1, static_cast<int>(wait.count()));
+    if (count < 0 && errno != EINTR) {
+        fail_all(Error::Io);
+        return 0;
+    }
+    if (count > 0) {
+        if (events[0].events & (EPOLLERR | EPOLLHUP)) {
+            fail_all(Error::Io);
+            return 0;
+        }
+        if (events[0].events & EPOLLOUT) {
+            write_pending();
+        }
+        if (events[0].events & EPOLLIN) {
+            read_available();
+        }
+    }
+
+    if (!requests_.empty() && Clock::now() >= deadline_) {
+        if (requests_.front().recoverable) {
+            expire_front();
+        } else {
+            fail_all(Error::Timeout);
+        }
+    }
+    return requests_.size();
+}
+
+void Device::run() {
+    while (run_once(std::chrono::milliseconds(1000)) > 0) {
+    }
+}
+
+} // namespace authenticator
@@ -0,0 +1,304 @@
+#ifndef HOST_AUTHENTICATOR_H
+#define HOST_AUTHENTICATOR_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace authenticator {
+
+/**
+ * @brief Command identifiers, as in `UART_handle_command` (uart.c).
+ */
+enum class Command : uint8_t {
+    ListCredentials = 0,
+    MakeCredential = 1,
+    GetAssertion = 2,
+    Reset = 3,
+    GetAssertionRaw = 4,
+    MakeCredentialCompressed = 5,
+    MemoryUsage = 6,
+    MakeCredentialSecp256r1 = 7,
+    ListCredentialsFiltered = 8,
+    GetAssertionAllowList = 9,
+    MakeCredentialUser = 10,
+    GetAssertionUser = 11,
+    DeleteCredential = 12,
+    ImportCredentials = 13,
+    ExportBackup = 14,
+    ImportBackup = 15,
+    StoreVersion = 16,
+    SetBaudRate = 17,
+};
+
+/**
+ * @brief Status byte sent by the authenticator at the start of each response.
+ */
+enum class Status : uint8_t {
+    Ok = 0,
+    CommandUnknown = 1,
+    CryptoFailed = 2,
+    BadParameter = 3,
+    NotFound = 4,
+    StorageFull = 5,
+    Approval = 6,
+    Authentication = 7,
+};
+
+/**
+ * @brief Failure on the host side, before any status could be read.
+ */
+enum class Error {
+    None,    // The response was received, see Status
+    Timeout, // No complete response before the deadline
+    Io,      // The serial port failed or was closed
+};
+
+enum class Curve : uint8_t {
+    Secp160r1 = 0,
+    Secp256r1 = 1,
+};
+
+constexpr size_t APP_ID_SIZE = 20;
+constexpr size_t CLIENT_DATA_SIZE = 20;
+constexpr size_t CREDENTIAL_ID_SIZE = 16;
+
+// Requests waiting for the button are answered within 10 s (ask_for_approval, 20 × 33
+// debounce steps of 15 ms), plus the time of the command itself: see command_timeout().
+constexpr std::chrono::milliseconds APPROVAL_WAIT{10000};
+constexpr std::chrono::milliseconds DEFAULT_TIMEOUT{2000};
+// Writing the whole credential store (Reset, ImportBackup): 12 entries of 85 bytes, 3.3 ms
+// per EEPROM byte.
+constexpr std::chrono::milliseconds STORE_WRITE_TIME{12 * 85 * 33 / 10};
+
+// Rates of COMMAND_SET_BAUD_RATE, by index in the frame: the authenticator starts at 115200
+constexpr std::array<uint32_t, 5> BAUD_RATES = {115200, 250000, 500000, 1000000, 2000000};
+// The authenticator falls back to 115200 if the new rate is not confirmed within 250 ms
+// (BAUD_CONFIRM_MS): the host gives up a little later, once it has surely fallen back.
+constexpr std::chrono::milliseconds BAUD_CONFIRM_TIMEOUT{400};
+
+// Bytes held by the RX ring buffer of the firmware (UART_RX_BUFFER_SIZE - 1, one slot tells a
+// full ring from an empty one). The firmware may be busy (computation, EEPROM write) when a
+// batch arrives, so the request being processed and the pipelined ones must fit together:
+// bytes beyond it would be dropped. Device refuses frames larger than the ring.
+constexpr size_t FIRMWARE_RX_BUFFER_SIZE = 63;
+
+using AppId = std::array<uint8_t, APP_ID_SIZE>;
+using ClientData = std::array<uint8_t, CLIENT_DATA_SIZE>;
+using CredentialId = std::array<uint8_t, CREDENTIAL_ID_SIZE>;
+
+struct Credential {
+    CredentialId credential_id;
+    AppId app_id;
+};
+
+struct ListResult {
+    Error error = Error::None;
+    Status status = Status::Ok;
+    std::vector<Credential> credentials;
+};
+
+struct MakeCredentialResult {
+    Error error = Error::None;
+    Status status = Status::Ok;
+    CredentialId credential_id{};
+    std::vector<uint8_t> public_key; // 40 bytes (secp160r1), 21 (compressed) or 64 (secp256r1)
+};
+
+struct AssertionResult {
+    Error error = Error::None;
+    Status status = Status::Ok;
+    CredentialId credential_id{};
+    std::vector<uint8_t> signature; // 40 bytes (secp160r1) or 64 bytes (secp256r1)
+    uint32_t counter = 0;
+};
+
+struct StoreVersionResult {
+    Error error = Error::None;
+    Status status = Status::Ok;
+    uint8_t version = 0;     // Wraps around after 256 changes
+    uint8_t credentials = 0; // Number of listed credentials
+};
+
+struct BaudRateResult {
+    Error error = Error::None;
+    Status status = Status::Ok;
+    uint32_t baud = BAUD_RATES[0]; // Rate in use once the negotiation is over
+};
+
+struct ResetResult {
+    Error error = Error::None;
+    Status status = Status::Ok;
+};
+
+/**
+ * @brief Longest time the authenticator may take to answer a command, counted from the time
+ *        it starts processing it: DEFAULT_TIMEOUT, plus APPROVAL_WAIT for the commands that
+ *        wait for the button, plus STORE_WRITE_TIME for those that write the whole store
+ *        (twice for ExportBackup, which compacts the store first).
+ */
+std::chrono::milliseconds command_timeout(Command command);
+
+/**
+ * @brief Opens and configures a serial port (115200 baud, 8N1, raw, non-blocking).
+ *
+ * @return The file descriptor.
+ * @throws std::system_error if the port cannot be opened or configured.
+ */
+int open_serial(const std::string &path);
+
+/**
+ * @brief Creates a raw pseudo-terminal, for host tools that stand in for the serial port of an
+ *        authenticator. The terminal side stays open in this process, so that the master is
+ *        not hung up when a client closes it.
+ *
+ * @param path Set to the path of the terminal side, to be given to the clients.
+ * @return The file descriptor of the master side.
+ * @throws std::system_error if the pseudo-terminal cannot be created.
+ */
+int open_pseudo_terminal(std::string &path);
+
+/**
+ * @brief Sets the rate of a serial port opened by open_serial(), any value in baud.
+ *
+ * @return false if the driver refuses it.
+ */
+bool set_serial_speed(int fd, uint32_t baud);
+
+/**
+ * @brief Asynchronous client of one authenticator, over a raw termios file descriptor
+ *        multiplexed with epoll.
+ *
+ * Requests are queued and written to the port as soon as the pipelining window allows;
+ * responses come back in request order, and each callback is called from run_once().
+ * Each request has a deadline, counted from the time the authenticator starts processing
+ * it (the end of the previous response). When a deadline expires, the byte stream can no
+ * longer be trusted: every pending request fails with Error::Timeout and the port is flushed.
+ */
+class Device {
+public:
+    /**
+     * @brief Opens and configures the serial port (115200 baud, 8N1, raw).
+     *        Opening the port resets an Arduino board: the first request should only be sent
+     *        once the bootloader has handed over (about 2 s).
+     *
+     * @param path Serial port, e.g. /dev/ttyACM0.
+     * @param pipeline_bytes Maximum number of request bytes written and not answered yet, the
+     *        request being processed included, at most FIRMWARE_RX_BUFFER_SIZE. Requests are
+     *        only written ahead while they fit; 0 disables pipelining.
+     * @throws std::system_error if the port cannot be opened or configured.
+     */
+    explicit Device(const std::string &path, size_t pipeline_bytes = FIRMWARE_RX_BUFFER_SIZE);
+    ~Device();
+
+    Device(const Device &) = delete;
+    Device &operator=(const Device &) = delete;
+
+    void list_credentials(std::function<void(const ListResult &)> done);
+    /**
+     * @brief Registers a credential. The first compressed request checks that the firmware
+     *        knows MakeCredentialCompressed (see probe_compressed()); if it does not, the
+     *        result holds Status::CommandUnknown and the client may ask again uncompressed.
+     */
+    void make_credential(const AppId &app_id, Curve curve, bool compressed,
+                         std::function<void(const MakeCredentialResult &)> done);
+    /**
+     * @brief Requests an assertion. The client must know the curve of the credential
+     *        registered for this app ID, since it sets the size of the signature.
+     */
+    void get_assertion(const AppId &app_id, const ClientData &client_data, Curve curve,
+                       std::function<void(const AssertionResult &)> done);
+    void reset(std::function<void(const ResetResult &)> done);
+    /**
+     * @brief Reads the store version, incremented by the authenticator each time the listed
+     *        credentials or their order change, and the number of listed credentials (see
+     *        CredentialDirectory).
+     */
+    void store_version(std::function<void(const StoreVersionResult &)> done);
+    /**
+     * @brief Negotiates a rate of BAUD_RATES. The request is sent once every previous one is
+     *        answered, and the next ones wait for the end of the negotiation: the authenticator
+     *        acknowledges at the current rate, both sides switch, and the host confirms at the
+     *        new rate. If the confirmation is not answered within BAUD_CONFIRM_TIMEOUT (the
+     *        link cannot carry that rate), both sides are back at 115200 and the result holds
+     *        Error::Timeout; the requests queued behind go on at 115200.
+     *
+     *        There is no flow control: above 115200, the authenticator reads nothing while it
+     *        computes, writes its EEPROM or compacts its store (up to hundreds of milliseconds),
+     *        and only keeps up because every frame of this class fits in its RX buffer, with
+     *        no more than FIRMWARE_RX_BUFFER_SIZE bytes unanswered (pipeline_bytes). Clients
+     *        sending larger frames must stay at 115200; GetAssertionRaw, which hashes its data
+     *        as it arrives, is refused by the authenticator above 115200. The emulator and the
+     *        recorder stay at 115200 and answer any other rate with Status::BadParameter.
+     *
+     * @param baud One of BAUD_RATES, else the result holds Status::BadParameter.
+     */
+    void set_baud_rate(uint32_t baud, std::function<void(const BaudRateResult &)> done);
+    uint32_t baud_rate() const { return baud_; }
+
+    /**
+     * @brief Waits for the port for at most `max_wait`, sends and receives what it can, and
+     *        calls the callbacks of the completed or expired requests.
+     *
+     * @return The number of requests still pending.
+     */
+    size_t run_once(std::chrono::milliseconds max_wait);
+
+    /**
+     * @brief Calls run_once() until no request is pending.
+     */
+    void run();
+
+    size_t pending() const { return requests_.size(); }
+
+    /**
+     * @brief epoll descriptor, readable when run_once() has work to do, so that the device can
+     *        be nested in another event loop.
+     */
+    int fd() const { return epoll_fd_; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        std::vector<uint8_t> frame;
+        std::chrono::milliseconds timeout;
+        // Total size of the response, given the bytes received so far (at least one more
+        // byte is needed when the result is larger than response.size()).
+        std::function<size_t(const std::vector<uint8_t> &)> response_size;
+        std::function<void(Error, const std::vector<uint8_t> &)> complete;
+        size_t sent = 0;
+        bool exclusive = false;   // Alone on the line: no request written ahead of it or behind it
+        bool recoverable = false; // On timeout, only this request fails (nothing left in flight)
+    };
+
+    /**
+     * @throws std::invalid_argument if the frame is larger than FIRMWARE_RX_BUFFER_SIZE.
+     */
+    void submit(Request request);
+    void probe_compressed(Request request);
+    void write_pending();
+    void read_available();
+    void fail_all(Error error);
+    void expire_front();
+    void update_epoll();
+    size_t bytes_unanswered() const;
+
+    int serial_fd_ = -1;
+    int epoll_fd_ = -1;
+    bool want_write_ = false;
+    size_t pipeline_bytes_;
+    uint32_t baud_ = BAUD_RATES[0];
+    bool compressed_supported_ = false; // MakeCredentialCompressed checked by probe_compressed()
+    std::deque<Request> requests_;
+    std::vector<uint8_t> response_;
+    Clock::time_point deadline_;
+};
+
+} // namespace authenticator
+
+#endif
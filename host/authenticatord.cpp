@@ -0,0 +1,489 @@
+// Daemon owning the serial link of one authenticator and serving many local clients over
+// a Unix socket. Usage: authenticatord <serial port> <socket path>
+//
+// Clients speak the wire format of the firmware (see uart.c), with one difference:
+// a GetAssertion frame is followed by one curve byte (0 = secp160r1, 1 = secp256r1), since
+// the size of the signature cannot be known from the response itself. Supported commands are
+// ListCredentials, MakeCredential (plain, compressed and secp256r1), GetAssertion and Reset.
+// Responses are byte for byte those of the firmware, in request order for each client.
+
+#include "authenticator.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <system_error>
+#include <tuple>
+#include <unordered_map>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace authenticator;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Sent instead of a response when the daemon could not get one from the device (timeout or
+// I/O error). Never sent by the firmware itself.
+constexpr uint8_t STATUS_ERR_DEVICE = 0x80;
+
+// Opening the port resets the Arduino board: bytes sent before the bootloader hands over to
+// the firmware are lost.
+constexpr std::chrono::milliseconds BOOT_DELAY{2000};
+constexpr std::chrono::milliseconds REOPEN_DELAY{1000};
+
+struct Reply {
+    bool ready = false;
+    std::vector<uint8_t> data;
+};
+
+struct Client {
+    int fd;
+    bool closing = false; // Framing lost: close once the replies are sent
+    std::vector<uint8_t> input;
+    std::deque<std::shared_ptr<Reply>> replies; // In request order
+    std::vector<uint8_t> output;
+};
+
+/**
+ * @brief Size of the request frame starting with `command`, 0 if the command is not supported.
+ */
+size_t frame_size(uint8_t command) {
+    switch (static_cast<Command>(command)) {
+        case Command::ListCredentials:
+        case Command::Reset:
+            return 1;
+        case Command::MakeCredential:
+        case Command::MakeCredentialCompressed:
+        case Command::MakeCredentialSecp256r1:
+            return 1 + APP_ID_SIZE;
+        case Command::GetAssertion:
+            return 1 + APP_ID_SIZE + CLIENT_DATA_SIZE + 1;
+        default:
+            return 0;
+    }
+}
+
+class Daemon {
+public:
+    Daemon(std::string serial_path, int listen_fd)
+        : serial_path_(std::move(serial_path)), listen_fd_(listen_fd) {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        watch(listen_fd_, EPOLLIN);
+        open_device();
+    }
+
+    void run() {
+        for (;;) {
+            struct epoll_event events[16];
+            int count = epoll_wait(epoll_fd_, events, 16, wait_ms());
+
+            for (int i = 0; i < count; i++) {
+                int fd = events[i].data.fd;
+
+                if (fd == listen_fd_) {
+                    accept_clients();
+                } else if (device_ && fd == device_->fd()) {
+                    device_->run_once(std::chrono::milliseconds(0));
+                } else if (clients_.count(fd)) {
+                    ClientPtr client = clients_[fd]; // drop() erases it from the map
+                    handle_client(client, events[i].events);
+                }
+            }
+            if (device_ && device_->pending()) {
+                device_->run_once(std::chrono::milliseconds(0)); // Deadlines
+            }
+            if (device_failed_) {
+                close_device();
+            }
+            if (!device_ && Clock::now() >= ready_at_) {
+                open_device();
+            }
+            if (device_ && !device_ready_ && Clock::now() >= ready_at_) {
+                device_ready_ = true;
+                list(nullptr, nullptr); // Warm the cache
+                while (!waiting_.empty()) {
+                    auto [client, frame, reply] = std::move(waiting_.front());
+                    waiting_.pop_front();
+                    dispatch(client, frame, reply);
+                }
+            }
+        }
+    }
+
+private:
+    using ClientPtr = std::shared_ptr<Client>;
+    using ReplyPtr = std::shared_ptr<Reply>;
+
+    // ------------------------------ Device ------------------------------
+
+    void open_device() {
+        try {
+            device_ = std::make_unique<Device>(serial_path_);
+        } catch (const std::system_error &e) {
+            std::fprintf(stderr, "authenticatord: %s: %s\n", serial_path_.c_str(), e.what());
+            ready_at_ = Clock::now() + REOPEN_DELAY;
+            return;
+        }
+        watch(device_->fd(), EPOLLIN);
+        device_ready_ = false;
+        device_failed_ = false;
+        ready_at_ = Clock::now() + BOOT_DELAY;
+    }
+
+    void close_device() {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, device_->fd(), nullptr);
+        device_.reset();
+        device_ready_ = false;
+        device_failed_ = false;
+        ready_at_ = Clock::now() + REOPEN_DELAY;
+        for (auto &[client, frame, reply] : waiting_) {
+            complete(client, reply, {STATUS_ERR_DEVICE});
+        }
+        waiting_.clear();
+    }
+
+    int wait_ms() const {
+        if (device_ && device_->pending()) {
+            return 100; // Lets run_once() check the deadline
+        }
+        if (!device_ || !device_ready_) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(ready_at_ - Clock::now());
+            return static_cast<int>(std::max<int64_t>(0, left.count()) + 1);
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Bookkeeping shared by every completed device request. After a timeout or an
+     *        I/O error, the state of the device is unknown: the cache is dropped.
+     */
+    void device_done(Error error) {
+        if (error != Error::None) {
+            cache_valid_ = false;
+        }
+        if (error == Error::Io) {
+            device_failed_ = true; // Reopened from the main loop, not from within run_once()
+        }
+    }
+
+    // ------------------------------ Commands ------------------------------
+
+    void dispatch(const ClientPtr &client, const std::vector<uint8_t> &frame, const ReplyPtr &reply) {
+        if (!device_) {
+            complete(client, reply, {STATUS_ERR_DEVICE});
+            return;
+        }
+        if (!device_ready_) {
+            waiting_.emplace_back(client, frame, reply);
+            return;
+        }
+
+        AppId app_id;
+        if (frame.size() > APP_ID_SIZE) {
+            std::copy_n(frame.begin() + 1, APP_ID_SIZE, app_id.begin());
+        }
+
+        switch (static_cast<Command>(frame[0])) {
+            case Command::ListCredentials:
+                list(client, reply);
+                break;
+            case Command::MakeCredential:
+            case Command::MakeCredentialCompressed:
+            case Command::MakeCredentialSecp256r1:
+                make_credential(client, reply, app_id, static_cast<Command>(frame[0]));
+                break;
+            case Command::GetAssertion:
+                get_assertion(client, reply, app_id, frame);
+                break;
+            case Command::Reset:
+                reset(client, reply);
+                break;
+            default:
+                break;
+        }
+    }
+
+    /**
+     * @brief Answers from the cache when no request that changes the credential list is
+     *        queued on the device; otherwise the device is asked, and the cache refreshed.
+     *        Requests complete in order, so the requests queued after this one update the
+     *        refreshed cache in turn. A null client only refreshes the cache.
+     */
+    void list(const ClientPtr &client, const ReplyPtr &reply) {
+        if (client && cache_valid_ && mutations_pending_ == 0) {
+            complete(client, reply, encode_list(cache_));
+            return;
+        }
+        device_->list_credentials([this, client, reply](const ListResult &result) {
+            device_done(result.error);
+            if (result.error == Error::None && result.status == Status::Ok) {
+                cache_ = result.credentials;
+                cache_valid_ = true;
+            }
+            if (!client) {
+                return;
+            }
+            if (result.error != Error::None) {
+                complete(client, reply, {STATUS_ERR_DEVICE});
+            } else if (result.status != Status::Ok) {
+                complete(client, reply, {static_cast<uint8_t>(result.status)});
+            } else {
+                complete(client, reply, encode_list(result.credentials));
+            }
+        });
+    }
+
+    void make_credential(const ClientPtr &client, const ReplyPtr &reply, const AppId &app_id, Command command) {
+        Curve curve = (command == Command::MakeCredentialSecp256r1) ? Curve::Secp256r1 : Curve::Secp160r1;
+
+        mutations_pending_++;
+        device_->make_credential(app_id, curve, command == Command::MakeCredentialCompressed,
+                                 [this, client, reply](const MakeCredentialResult &result) {
+            mutations_pending_--;
+            device_done(result.error);
+            if (result.error != Error::None) {
+                complete(client, reply, {STATUS_ERR_DEVICE});
+                return;
+            }
+
+            std::vector<uint8_t> data = {static_cast<uint8_t>(result.status)};
+            if (result.status == Status::Ok) {
+                cache_valid_ = false; // Replaces the credential of the same account or reuses a deleted slot: list again
+                data.insert(data.end(), result.credential_id.begin(), result.credential_id.end());
+                data.insert(data.end(), result.public_key.begin(), result.public_key.end());
+            }
+            complete(client, reply, std::move(data));
+        });
+    }
+
+    void get_assertion(const ClientPtr &client, const ReplyPtr &reply, const AppId &app_id,
+                       const std::vector<uint8_t> &frame) {
+        ClientData client_data;
+        uint8_t curve = frame.back();
+
+        if (curve != static_cast<uint8_t>(Curve::Secp160r1) && curve != static_cast<uint8_t>(Curve::Secp256r1)) {
+            complete(client, reply, {static_cast<uint8_t>(Status::BadParameter)});
+            return;
+        }
+        std::copy_n(frame.begin() + 1 + APP_ID_SIZE, CLIENT_DATA_SIZE, client_data.begin());
+        device_->get_assertion(app_id, client_data, static_cast<Curve>(curve),
+                               [this, client, reply](const AssertionResult &result) {
+            device_done(result.error);
+            if (result.error != Error::None) {
+                complete(client, reply, {STATUS_ERR_DEVICE});
+                return;
+            }
+
+            std::vector<uint8_t> data = {static_cast<uint8_t>(result.status)};
+            if (result.status == Status::Ok) {
+                data.insert(data.end(), result.credential_id.begin(), result.credential_id.end());
+                data.insert(data.end(), result.signature.begin(), result.signature.end());
+                for (int shift = 24; shift >= 0; shift -= 8) {
+                    data.push_back(static_cast<uint8_t>(result.counter >> shift)); // Big endian
+                }
+            }
+            complete(client, reply, std::move(data));
+        });
+    }
+
+    void reset(const ClientPtr &client, const ReplyPtr &reply) {
+        mutations_pending_++;
+        device_->reset([this, client, reply](const ResetResult &result) {
+            mutations_pending_--;
+            device_done(result.error);
+            if (result.error != Error::None) {
+                complete(client, reply, {STATUS_ERR_DEVICE});
+                return;
+            }
+            if (result.status == Status::Ok) {
+                cache_.clear();
+            }
+            complete(client, reply, {static_cast<uint8_t>(result.status)});
+        });
+    }
+
+    static std::vector<uint8_t> encode_list(const std::vector<Credential> &credentials) {
+        std::vector<uint8_t> data = {static_cast<uint8_t>(Status::Ok), static_cast<uint8_t>(credentials.size())};
+
+        for (const Credential &credential : credentials) {
+            data.insert(data.end(), credential.credential_id.begin(), credential.credential_id.end());
+            data.insert(data.end(), credential.app_id.begin(), credential.app_id.end());
+        }
+        return data;
+    }
+
+    // ------------------------------ Clients ------------------------------
+
+    void watch(int fd, uint32_t events) {
+        struct epoll_event event = {};
+
+        event.events = events;
+        event.data.fd = fd;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &event) != 0) {
+            epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+        }
+    }
+
+    void accept_clients() {
+        int fd;
+
+        while ((fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+            auto client = std::make_shared<Client>();
+
+            client->fd = fd;
+            clients_[fd] = client;
+            watch(fd, EPOLLIN);
+        }
+    }
+
+    void handle_client(const ClientPtr &client, uint32_t events) {
+        if (events & EPOLLIN) {
+            uint8_t buffer[256];
+            ssize_t size;
+
+            while ((size = ::read(client->fd, buffer, sizeof(buffer))) > 0) {
+                client->input.insert(client->input.end(), buffer, buffer + size);
+            }
+            if (size == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                drop(client);
+                return;
+            }
+            parse(client);
+        }
+        flush(client);
+    }
+
+    void parse(const ClientPtr &client) {
+        size_t offset = 0;
+
+        while (!client->closing && offset < client->input.size()) {
+            size_t size = frame_size(client->input[offset]);
+            auto reply = std::make_shared<Reply>();
+
+            if (size == 0) {
+                client->replies.push_back(reply);
+                complete(client, reply, {static_cast<uint8_t>(Status::CommandUnknown)});
+                client->closing = true;
+                break;
+            }
+            if (client->input.size() - offset < size) {
+                break;
+            }
+            std::vector<uint8_t> frame(client->input.begin() + offset, client->input.begin() + offset + size);
+            offset += size;
+            client->replies.push_back(reply);
+            dispatch(client, frame, reply);
+        }
+        client->input.erase(client->input.begin(), client->input.begin() + offset);
+    }
+
+    /**
+     * @brief Stores the response of one request, and queues the responses that are now in
+     *        order for the client.
+     */
+    void complete(const ClientPtr &client, const ReplyPtr &reply, std::vector<uint8_t> data) {
+        reply->data = std::move(data);
+        reply->ready = true;
+        while (!client->replies.empty() && client->replies.front()->ready) {
+            auto &front = client->replies.front()->data;
+            client->output.insert(client->output.end(), front.begin(), front.end());
+            client->replies.pop_front();
+        }
+        flush(client);
+    }
+
+    bool connected(const ClientPtr &client) const {
+        auto it = clients_.find(client->fd);
+        return it != clients_.end() && it->second == client;
+    }
+
+    void flush(const ClientPtr &client) {
+        if (!connected(client)) {
+            return;
+        }
+        while (!client->output.empty()) {
+            ssize_t written = ::send(client->fd, client->output.data(), client->output.size(), MSG_NOSIGNAL);
+
+            if (written < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break;
+                }
+                drop(client);
+                return;
+            }
+            client->output.erase(client->output.begin(), client->output.begin() + written);
+        }
+        if (client->closing && client->replies.empty() && client->output.empty()) {
+            drop(client);
+            return;
+        }
+        watch(client->fd, EPOLLIN | (client->output.empty() ? 0u : static_cast<uint32_t>(EPOLLOUT)));
+    }
+
+    /**
+     * @brief Closes a client. Its requests already queued on the device still complete,
+     *        and keep the cache up to date; only their responses are discarded.
+     */
+    void drop(const ClientPtr &client) {
+        if (!connected(client)) {
+            return;
+        }
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, client->fd, nullptr);
+        clients_.erase(client->fd);
+        ::close(client->fd);
+    }
+
+    std::string serial_path_;
+    int listen_fd_;
+    int epoll_fd_;
+    std::unique_ptr<Device> device_;
+    bool device_ready_ = false;
+    bool device_failed_ = false;
+    Clock::time_point ready_at_;
+    std::deque<std::tuple<ClientPtr, std::vector<uint8_t>, ReplyPtr>> waiting_; // Until the boot is over
+    std::unordered_map<int, ClientPtr> clients_;
+    std::vector<Credential> cache_;
+    bool cache_valid_ = false;
+    unsigned mutations_pending_ = 0; // MakeCredential and Reset queued on the device
+};
+
+int listen_unix(const char *path) {
+    struct sockaddr_un address = {};
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if (fd < 0 || std::strlen(path) >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path);
+    ::unlink(path); // Left over by a previous run
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&address), sizeof(address)) != 0 || listen(fd, 64) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        std::fprintf(stderr, "usage: %s <serial port> <socket path>\n", argv[0]);
+        return 1;
+    }
+    int listen_fd = listen_unix(argv[2]);
+    if (listen_fd < 0) {
+        std::perror(argv[2]);
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+    Daemon(argv[1], listen_fd).run();
+    return 0;
+}
@@ -0,0 +1,363 @@
+// Throughput benchmark of one authenticator: a reproducible mix of MakeCredential,
+// GetAssertion, ListCredentials and Reset sent at a controlled rate, with the throughput and
+// latency percentiles of each command.
+// Usage: authenticator-bench [-m make,get,list,reset] [-r ops/s] [-s seconds] [-x seed] [-c 160|256]
+//                            [-b baud] <serial port | -e>
+//
+// The board must run the benchmark build of the firmware (make BENCHMARK=1), which approves
+// every request by itself; its credentials are erased before the run. With -e, the commands run on the host build of the firmware
+// (farm/firmware.h) and the times are those of its virtual clock, with the button pressed as
+// soon as the LED blinks: a firmware change can be compared without the board. Those times rest
+// on the cycle counts of FIRMWARE_TIMING_DEFAULT, flagged in the report while uncalibrated.
+//
+// -m gives the weights of the four commands (default 10,80,8,2). The commands are drawn from
+// the seed, so that two runs send the same requests. A GetAssertion drawn while no credential
+// is stored is sent as a MakeCredential, and a MakeCredential drawn while the store is full
+// (12 credentials) is sent as a Reset.
+// With -r, requests are sent at that rate whatever the answers (open loop), and each latency
+// counts from the time the request was due, so that a queue building up is measured. Without
+// it, the next request is sent once the previous one is answered.
+// With -b, the serial rate is negotiated (SetBaudRate) before the run; with -e, it is the rate of
+// the virtual clock.
+
+#include "farm/firmware.h"
+#include "pool.h"
+#include "session.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace authenticator;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t STORE_CAPACITY = 12; // EEPROM_MAX_ENTRIES
+
+enum Operation { MAKE, GET, LIST, RESET, OPERATION_COUNT };
+
+const char *const OPERATION_NAMES[OPERATION_COUNT] = {"MakeCredential", "GetAssertion", "ListCredentials", "Reset"};
+
+struct Options {
+    std::vector<double> weights = {10, 80, 8, 2};
+    double rate = 0; // Closed loop
+    double seconds = 30;
+    uint32_t seed = 1;
+    Curve curve = Curve::Secp160r1;
+    uint32_t baud = BAUD_RATES[0];
+    bool emulator = false;
+};
+
+/**
+ * @brief Latencies (in microseconds) and failures of one command.
+ */
+struct Samples {
+    std::vector<uint64_t> latencies;
+    uint64_t failures = 0;
+
+    void add(uint64_t latency_us, bool ok) {
+        latencies.push_back(latency_us);
+        failures += !ok;
+    }
+};
+
+/**
+ * @brief Draws the commands and their parameters, and follows the credentials they store.
+ *        Requests are answered in order, so the store is followed as they are sent.
+ */
+class Workload {
+public:
+    explicit Workload(const Options &options)
+        : random_(options.seed), pick_(options.weights.begin(), options.weights.end()) {}
+
+    Operation next() {
+        auto operation = static_cast<Operation>(pick_(random_));
+
+        if (operation == GET && registered_.empty()) {
+            operation = MAKE;
+        }
+        if (operation == MAKE && registered_.size() >= STORE_CAPACITY) {
+            operation = RESET;
+        }
+        if (operation == RESET) {
+            registered_.clear();
+        }
+        return operation;
+    }
+
+    AppId new_app_id() {
+        AppId app_id = random_bytes<AppId>();
+        registered_.push_back(app_id);
+        return app_id;
+    }
+
+    AppId registered_app_id() { return registered_[random_() % registered_.size()]; }
+
+    template <typename Bytes>
+    Bytes random_bytes() {
+        Bytes bytes;
+        for (uint8_t &byte : bytes) {
+            byte = static_cast<uint8_t>(random_());
+        }
+        return bytes;
+    }
+
+private:
+    std::mt19937 random_;
+    std::discrete_distribution<int> pick_;
+    std::vector<AppId> registered_;
+};
+
+/**
+ * @brief Runs the benchmark on a serial port for `options.seconds`.
+ *
+ * @return The time from the first request to the last response, in seconds.
+ */
+double run_device(const std::string &path, const Options &options, Samples (&samples)[OPERATION_COUNT]) {
+    Device device(path);
+    Workload workload(options);
+
+    std::this_thread::sleep_for(DevicePool::BOOT_DELAY); // Opening the port resets an Arduino board
+    device.reset([](const ResetResult &) {}); // Same empty store as the emulator, not measured
+    if (options.baud != BAUD_RATES[0]) {
+        device.set_baud_rate(options.baud, [&options](const BaudRateResult &result) {
+            if (result.baud != options.baud) {
+                std::fprintf(stderr, "%u baud refused, measured at %u baud\n", options.baud, result.baud);
+            }
+        });
+    }
+    device.run();
+
+    auto start = Clock::now();
+    auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.rate ? 1 / options.rate : 0));
+    auto next_due = start;
+    auto last_done = start;
+
+    auto issue = [&](Clock::time_point due) {
+        Operation operation = workload.next();
+        auto record = [&samples, &last_done, operation, due](Error error, Status status) {
+            last_done = Clock::now();
+            samples[operation].add(std::chrono::duration_cast<std::chrono::microseconds>(last_done - due).count(),
+                                   error == Error::None && status == Status::Ok);
+        };
+
+        switch (operation) {
+            case MAKE:
+                device.make_credential(workload.new_app_id(), options.curve, false,
+                                       [record](const MakeCredentialResult &result) { record(result.error, result.status); });
+                break;
+            case GET:
+                device.get_assertion(workload.registered_app_id(), workload.random_bytes<ClientData>(), options.curve,
+                                     [record](const AssertionResult &result) { record(result.error, result.status); });
+                break;
+            case LIST:
+                device.list_credentials([record](const ListResult &result) { record(result.error, result.status); });
+                break;
+            default:
+                device.reset([record](const ResetResult &result) { record(result.error, result.status); });
+                break;
+        }
+    };
+
+    for (auto now = Clock::now(); now < end; now = Clock::now()) {
+        if (options.rate == 0) {
+            if (device.pending() == 0) {
+                issue(now);
+            }
+            device.run_once(std::chrono::milliseconds(100));
+            continue;
+        }
+        while (next_due <= now) {
+            issue(next_due);
+            next_due += period;
+        }
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next_due - now);
+        device.run_once(std::max(wait, std::chrono::milliseconds(1)));
+    }
+    device.run();
+    return std::chrono::duration<double>(last_done - start).count();
+}
+
+/**
+ * @brief Runs the benchmark on an emulated device, in the time of its virtual clock: the board
+ *        serves one request at a time, so each request starts when it is due or when the
+ *        previous one is answered, whichever is later.
+ *
+ * @return The virtual time from the first request to the last response, in seconds.
+ */
+double run_emulator(const Options &options, Samples (&samples)[OPERATION_COUNT]) {
+    Workload workload(options);
+    std::vector<uint8_t> response(FIRMWARE_MAX_RESPONSE_SIZE);
+    uint64_t end_us = static_cast<uint64_t>(options.seconds * 1e6);
+    uint64_t period_us = options.rate ? static_cast<uint64_t>(1e6 / options.rate) : 0;
+    uint64_t due = 0, free = 0;
+    FirmwareTiming timing = FIRMWARE_TIMING_DEFAULT;
+    uint8_t make = static_cast<uint8_t>((options.curve == Curve::Secp256r1) ? Command::MakeCredentialSecp256r1
+                                                                           : Command::MakeCredential);
+
+    timing.baud = options.baud;
+    firmware_set_timing(&timing);
+    firmware_thread_init();
+    FirmwareDevice *device = firmware_device_new(FIRMWARE_APPROVE);
+    if (device == nullptr) {
+        return 0;
+    }
+
+    while (due < end_us) {
+        Operation operation = workload.next();
+        std::vector<uint8_t> request;
+        FirmwareLatency latency{};
+
+        switch (operation) {
+            case MAKE: {
+                AppId app_id = workload.new_app_id();
+                request.push_back(make);
+                request.insert(request.end(), app_id.begin(), app_id.end());
+                break;
+            }
+            case GET: {
+                AppId app_id = workload.registered_app_id();
+                ClientData client_data = workload.random_bytes<ClientData>();
+                request.push_back(static_cast<uint8_t>(Command::GetAssertion));
+                request.insert(request.end(), app_id.begin(), app_id.end());
+                request.insert(request.end(), client_data.begin(), client_data.end());
+                break;
+            }
+            case LIST:
+                request.push_back(static_cast<uint8_t>(Command::ListCredentials));
+                break;
+            default:
+                request.push_back(static_cast<uint8_t>(Command::Reset));
+                break;
+        }
+
+        size_t size = firmware_transact_timed(device, request.data(), request.size(), response.data(),
+                                              response.size(), &latency);
+        uint64_t start = std::max(due, free);
+        free = start + latency.request_us + latency.processing_us + latency.approval_us + latency.response_us;
+        samples[operation].add(free - due, size > 0 && response[0] == static_cast<uint8_t>(Status::Ok));
+        due = period_us ? due + period_us : free;
+    }
+    firmware_device_free(device);
+    return free / 1e6;
+}
+
+void report(const char *name, Samples &samples, double seconds) {
+    auto &latencies = samples.latencies;
+
+    if (latencies.empty()) {
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))] / 1000.0;
+    };
+
+    std::printf("%-16s %8zu %8.2f %9.1f %9.1f %9.1f %9.1f %8llu\n", name, latencies.size(), latencies.size() / seconds,
+                percentile(0.5), percentile(0.99), percentile(0.999), latencies.back() / 1000.0,
+                static_cast<unsigned long long>(samples.failures));
+}
+
+bool parse_weights(const char *text, std::vector<double> &weights) {
+    std::istringstream in(text);
+    std::string field;
+
+    weights.clear();
+    while (std::getline(in, field, ',')) {
+        weights.push_back(std::strtod(field.c_str(), nullptr));
+    }
+    return weights.size() == OPERATION_COUNT && std::all_of(weights.begin(), weights.end(), [](double w) { return w >= 0; }) &&
+           std::any_of(weights.begin(), weights.end(), [](double w) { return w > 0; });
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    int option;
+
+    while ((option = getopt(argc, argv, "m:r:s:x:c:b:e")) != -1) {
+        switch (option) {
+            case 'm':
+                if (!parse_weights(optarg, options.weights)) {
+                    std::fprintf(stderr, "-m: four weights expected, e.g. 10,80,8,2\n");
+                    return 1;
+                }
+                break;
+            case 'r':
+                options.rate = std::strtod(optarg, nullptr);
+                break;
+            case 's':
+                options.seconds = std::strtod(optarg, nullptr);
+                break;
+            case 'x':
+                options.seed = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'c':
+                options.curve = (std::string(optarg) == "256") ? Curve::Secp256r1 : Curve::Secp160r1;
+                break;
+            case 'b':
+                options.baud = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'e':
+                options.emulator = true;
+                break;
+            default:
+                std::fprintf(stderr, "usage: %s [-m make,get,list,reset] [-r ops/s] [-s seconds] [-x seed] [-c 160|256] "
+                             "[-b baud] <serial port | -e>\n", argv[0]);
+                return 1;
+        }
+    }
+    if (options.emulator == (optind < argc) || options.rate < 0 ||
+        std::find(BAUD_RATES.begin(), BAUD_RATES.end(), options.baud) == BAUD_RATES.end()) {
+        std::fprintf(stderr, "usage: %s [-m make,get,list,reset] [-r ops/s] [-s seconds] [-x seed] [-c 160|256] "
+                     "[-b baud] <serial port | -e>\n", argv[0]);
+        return 1;
+    }
+
+    Samples samples[OPERATION_COUNT];
+    double seconds;
+    try {
+        seconds = options.emulator ? run_emulator(options, samples) : run_device(argv[optind], options, samples);
+    } catch (const std::system_error &error) {
+        std::fprintf(stderr, "%s: %s\n", argv[optind], error.what());
+        return 1;
+    }
+    if (seconds <= 0) {
+        return 1;
+    }
+
+    Samples all;
+    for (Samples &command : samples) {
+        all.latencies.insert(all.latencies.end(), command.latencies.begin(), command.latencies.end());
+        all.failures += command.failures;
+    }
+
+    char load[32] = "closed loop";
+    if (options.rate > 0) {
+        std::snprintf(load, sizeof(load), "%g ops/s offered", options.rate);
+    }
+    std::printf("%s, %s, %u baud, seed %u, %s\n", options.emulator ? "emulator" : argv[optind],
+                options.curve == Curve::Secp256r1 ? "secp256r1" : "secp160r1", options.baud, options.seed, load);
+    if (options.emulator && !FIRMWARE_TIMING_DEFAULT.calibrated) {
+        std::printf("%s\n", FIRMWARE_UNCALIBRATED_NOTE);
+    }
+    std::printf("%-16s %8s %8s %9s %9s %9s %9s %8s\n", "command", "ops", "ops/s", "p50 ms", "p99 ms", "p999 ms", "max ms",
+                "errors");
+    for (int i = 0; i < OPERATION_COUNT; i++) {
+        report(OPERATION_NAMES[i], samples[i], seconds);
+    }
+    report("all", all, seconds);
+    return all.failures ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+#include "directory.h"
+
+#include <algorithm>
+
+namespace authenticator {
+
+void CredentialDirectory::credentials(std::function<void(const ListResult &)> done) {
+    device_.store_version([this, done](const StoreVersionResult &version) {
+        if (version.error != Error::None) {
+            ListResult result;
+
+            result.error = version.error;
+            done(result);
+            return;
+        }
+        if (version.status != Status::Ok) {
+            list(version, false, done); // Firmware without store version
+            return;
+        }
+        if (valid_ && version.version == version_.version && version.credentials == version_.credentials) {
+            ListResult result;
+
+            result.credentials = credentials_;
+            done(result);
+            return;
+        }
+        list(version, true, done);
+    });
+}
+
+void CredentialDirectory::list(const StoreVersionResult &version, bool versioned,
+                               std::function<void(const ListResult &)> done) {
+    device_.list_credentials([this, version, versioned, done](const ListResult &result) {
+        if (result.error == Error::None && result.status == Status::Ok && versioned) {
+            credentials_ = result.credentials;
+            version_ = version;
+            valid_ = true;
+        } else {
+            valid_ = false;
+        }
+        done(result);
+    });
+}
+
+void CredentialDirectory::contains(const AppId &app_id, const CredentialId &credential_id,
+                                   std::function<void(Error, Status, bool)> done) {
+    credentials([app_id, credential_id, done](const ListResult &result) {
+        bool found = std::any_of(result.credentials.begin(), result.credentials.end(), [&](const Credential &credential) {
+            return credential.app_id == app_id && credential.credential_id == credential_id;
+        });
+
+        done(result.error, result.status, found);
+    });
+}
+
+} // namespace authenticator
@@ -0,0 +1,55 @@
+#ifndef HOST_DIRECTORY_H
+#define HOST_DIRECTORY_H
+
+#include "authenticator.h"
+
+namespace authenticator {
+
+/**
+ * @brief Copy of the credential list of one authenticator, revalidated with the store version
+ *        (3 bytes answered) instead of a full ListCredentials (up to 2 + 12 × 36 bytes).
+ *
+ * The version is read before the list: a change made in between is caught by the next
+ * revalidation, never hidden by it. The version is one byte and wraps around, so the copy is
+ * only kept when the number of credentials answered with it has not changed either. With a firmware that does not know COMMAND_STORE_VERSION,
+ * every call lists the credentials.
+ */
+class CredentialDirectory {
+public:
+    explicit CredentialDirectory(Device &device) : device_(device) {}
+
+    CredentialDirectory(const CredentialDirectory &) = delete;
+    CredentialDirectory &operator=(const CredentialDirectory &) = delete;
+
+    /**
+     * @brief Gives the up-to-date credential list, from the copy when the store version has
+     *        not changed since it was listed.
+     */
+    void credentials(std::function<void(const ListResult &)> done);
+
+    /**
+     * @brief Looks up a credential in the up-to-date list.
+     *
+     * @param done Called with the error and status of the lookup, and whether the
+     *        authenticator holds `credential_id` for `app_id`.
+     */
+    void contains(const AppId &app_id, const CredentialId &credential_id,
+                  std::function<void(Error, Status, bool)> done);
+
+    /**
+     * @brief Drops the copy: the next call lists the credentials again.
+     */
+    void invalidate() { valid_ = false; }
+
+private:
+    void list(const StoreVersionResult &version, bool versioned, std::function<void(const ListResult &)> done);
+
+    Device &device_;
+    bool valid_ = false;
+    StoreVersionResult version_; // Answered just before credentials_ was listed
+    std::vector<Credential> credentials_;
+};
+
+} // namespace authenticator
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef FARM_AVR_EEPROM_H
+#define FARM_AVR_EEPROM_H
+
+// The EEMEM variables are only used for their address: they are gathered in the eemem
+// section, and each address is mapped to the same offset in the EEPROM image of the thread's
+// current device. The functions (firmware.c) advance the virtual clock like the EEPROM
+// controller: each byte written keeps it busy for FirmwareTiming.eeprom_write_us.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EEMEM __attribute__((section("eemem")))
+
+extern uint8_t __start_eemem[];
+extern uint8_t __stop_eemem[];
+
+int eeprom_is_ready(void);
+uint8_t eeprom_read_byte(const uint8_t *address);
+void eeprom_write_byte(uint8_t *address, uint8_t value);
+void eeprom_update_byte(uint8_t *address, uint8_t value);
+uint32_t eeprom_read_dword(const uint32_t *address);
+void eeprom_update_dword(uint32_t *address, uint32_t value);
+void eeprom_read_block(void *destination, const void *source, size_t size);
+void eeprom_write_block(const void *source, void *destination, size_t size);
+void eeprom_update_block(const void *source, void *destination, size_t size);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef FARM_AVR_INTERRUPT_H
+#define FARM_AVR_INTERRUPT_H
+
+// Interrupts never fire: firmware.c fills the RX ring buffer itself
+#define ISR(vector) static void farm_##vector(void)
+#define sei()
+#define cli()
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef FARM_AVR_IO_H
+#define FARM_AVR_IO_H
+
+// Registers of the ATmega328p used by the firmware, emulated for the thread's current device
+// (see firmware.c). Reading the button pin and sending a byte advance the virtual clock.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define PD2 2
+#define PD6 6
+#define U2X0 1
+#define UCSZ00 1
+#define UCSZ01 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRE0 5
+#define TXC0 6
+#define RXCIE0 7
+
+#define RAMEND 0x8FF
+
+// Size of the buffer capturing the bytes sent by the firmware (power of 2)
+#define FARM_TX_SIZE 1024
+
+typedef struct {
+    uint8_t ddrd;
+    uint8_t portd;
+    uint8_t ubrr0h;
+    uint8_t ubrr0l;
+    uint8_t ucsr0a;
+    uint8_t ucsr0b;
+    uint8_t ucsr0c;
+} FarmRegisters;
+
+extern _Thread_local FarmRegisters farm_registers;
+extern _Thread_local uint8_t farm_tx[FARM_TX_SIZE];
+extern _Thread_local size_t farm_tx_size;
+
+uint8_t farm_pind(void);
+uint8_t *farm_uart_tx(void);
+void farm_rx_empty(void);
+
+#define DDRD (farm_registers.ddrd)
+#define PORTD (farm_registers.portd)
+#define PIND (farm_pind()) // Scripted button
+#define UBRR0H (farm_registers.ubrr0h)
+#define UBRR0L (farm_registers.ubrr0l)
+#define UCSR0A (farm_registers.ucsr0a)
+#define UCSR0B (farm_registers.ucsr0b)
+#define UCSR0C (farm_registers.ucsr0c)
+#define UDR0 (*farm_uart_tx()) // Each write appends a byte to farm_tx
+#define UART_RX_WAIT() farm_rx_empty() // The request frame is incomplete
+#define UART_FIXED_RATE 1 // The emulated line stays at 115200, whatever the pty or the client
+
+// No stack to measure: stack_paint() and stack_peak() stop at once
+#define SP ((size_t)&__heap_start)
+
+#endif
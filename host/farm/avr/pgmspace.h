@@ -0,0 +1,10 @@
+#ifndef FARM_AVR_PGMSPACE_H
+#define FARM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_dword(address) (*(const uint32_t *)(address))
+
+#endif
@@ -0,0 +1,228 @@
+// Timing-faithful emulator of one authenticator: the firmware handlers (firmware.h) run on the
+// host while a virtual clock adds up what the board would spend on the UART, the EEPROM, the
+// button and the cryptography, so that what-if studies (baud rate, EEPROM layout, cycle costs)
+// can be run without the board.
+// Usage: authenticator-emulator [-b baud] [-e eeprom_us] [-a approval_ms] [-f timing_file] [-r] [-A script] [-p]
+//
+// By default, a scenario of commands is run and the predicted time of each phase is printed.
+// With -p, the emulated device is served on a pseudo-terminal, whose path is printed: each
+// response is written once the predicted time has elapsed, so that host tools can be run
+// against it as against /dev/ttyACM0.
+//
+// -r refuses every approval, -A scripts them (see firmware_device_set_script), e.g. -A 300,n,2500.
+//
+// The timing file holds one "key value" line per cost of FirmwareTiming (see
+// firmware_load_timing). Until it holds cycle counts measured on this build and "calibrated 1",
+// the predictions are flagged as estimates (FIRMWARE_UNCALIBRATED_NOTE).
+
+#include "firmware.h"
+
+#include "../session.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace authenticator;
+
+namespace {
+
+struct Options {
+    FirmwareTiming timing = FIRMWARE_TIMING_DEFAULT;
+    FirmwareApproval approval = FIRMWARE_APPROVE;
+    const char *script = nullptr;
+    bool pty = false;
+};
+
+uint64_t total_us(const FirmwareLatency &latency) {
+    return latency.request_us + latency.processing_us + latency.approval_us + latency.response_us;
+}
+
+void print_latency(const char *name, uint8_t status, const FirmwareLatency &latency) {
+    std::printf("%-18s %6u %10.2f %10.2f %10.2f %10.2f %10.2f\n", name, status, latency.request_us / 1000.0,
+                latency.processing_us / 1000.0, latency.approval_us / 1000.0, latency.response_us / 1000.0,
+                total_us(latency) / 1000.0);
+}
+
+/**
+ * @brief Runs a fixed scenario on a fresh device and prints the predicted time of each command.
+ */
+int run_scenario(FirmwareDevice *device) {
+    AppId app_160{}, app_compressed{}, app_256{};
+    ClientData client_data{};
+    std::vector<uint8_t> response(FIRMWARE_MAX_RESPONSE_SIZE);
+    int failures = 0;
+
+    app_160.fill(0x16);
+    app_compressed.fill(0xC0);
+    app_256.fill(0x25);
+    client_data.fill(0xCD);
+
+    auto with = [](Command command, std::initializer_list<const uint8_t *> parts) {
+        std::vector<uint8_t> request = {static_cast<uint8_t>(command)};
+        for (const uint8_t *part : parts) {
+            request.insert(request.end(), part, part + APP_ID_SIZE); // App IDs and client data are 20 bytes
+        }
+        return request;
+    };
+    const struct {
+        const char *name;
+        std::vector<uint8_t> request;
+    } steps[] = {
+        {"MakeCredential", with(Command::MakeCredential, {app_160.data()})},
+        {"MakeCompressed", with(Command::MakeCredentialCompressed, {app_compressed.data()})},
+        {"MakeSecp256r1", with(Command::MakeCredentialSecp256r1, {app_256.data()})},
+        {"GetAssertion", with(Command::GetAssertion, {app_160.data(), client_data.data()})},
+        {"GetAssertion", with(Command::GetAssertion, {app_160.data(), client_data.data()})},
+        {"GetAssertion 256", with(Command::GetAssertion, {app_256.data(), client_data.data()})},
+        {"ListCredentials", with(Command::ListCredentials, {})},
+        {"StoreVersion", with(Command::StoreVersion, {})},
+        {"Reset", with(Command::Reset, {})},
+    };
+
+    std::printf("%-18s %6s %10s %10s %10s %10s %10s\n", "command", "status", "request", "processing", "approval",
+                "response", "total ms");
+    for (const auto &step : steps) {
+        FirmwareLatency latency{};
+        size_t size = firmware_transact_timed(device, step.request.data(), step.request.size(), response.data(),
+                                              response.size(), &latency);
+        uint8_t status = size ? response[0] : 0xFF;
+
+        print_latency(step.name, status, latency);
+        if (status != static_cast<uint8_t>(Status::Ok)) {
+            failures++;
+        }
+    }
+    return failures ? 1 : 0;
+}
+
+/**
+ * @brief Serves the device on a pseudo-terminal until the process is killed.
+ */
+int serve_pty(FirmwareDevice *device) {
+    std::vector<uint8_t> pending, response(FIRMWARE_MAX_RESPONSE_SIZE);
+    uint8_t buffer[256];
+    std::string path;
+    int master;
+
+    try {
+        master = open_pseudo_terminal(path);
+    } catch (const std::system_error &error) {
+        std::fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+    std::printf("%s\n", path.c_str());
+    std::fflush(stdout);
+
+    for (;;) {
+        ssize_t received = read(master, buffer, sizeof(buffer));
+        if (received < 0 && errno != EINTR) {
+            std::perror("read");
+            return 1;
+        }
+        pending.insert(pending.end(), buffer, buffer + std::max<ssize_t>(received, 0));
+
+        while (!pending.empty()) {
+            size_t size = request_size(pending.data(), pending.size());
+            FirmwareLatency latency{};
+
+            if (size == 0 || size > FIRMWARE_MAX_REQUEST_SIZE) {
+                std::fprintf(stderr, "%s: not emulated, %zu bytes dropped\n", command_name(pending[0]),
+                             pending.size());
+                pending.clear();
+                break;
+            }
+            if (size > pending.size()) {
+                break; // The handler waits for the rest of the frame
+            }
+
+            size_t answered = firmware_transact_timed(device, pending.data(), size, response.data(),
+                                                      response.size(), &latency);
+            std::fprintf(stderr, "%-18s request %.2f ms, processing %.2f ms, approval %.2f ms, response %.2f ms\n",
+                         command_name(pending[0]), latency.request_us / 1000.0, latency.processing_us / 1000.0,
+                         latency.approval_us / 1000.0, latency.response_us / 1000.0);
+            pending.erase(pending.begin(), pending.begin() + size);
+
+            // The pseudo-terminal carries the request at once: the whole predicted time is spent here
+            std::this_thread::sleep_for(std::chrono::microseconds(total_us(latency)));
+            for (size_t written = 0; written < answered;) {
+                ssize_t count = write(master, response.data() + written, answered - written);
+                if (count < 0 && errno != EINTR) {
+                    std::perror("write");
+                    return 1;
+                }
+                written += std::max<ssize_t>(count, 0);
+            }
+        }
+    }
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    int option;
+
+    while ((option = getopt(argc, argv, "b:e:a:f:rA:p")) != -1) {
+        switch (option) {
+            case 'b':
+                options.timing.baud = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'e':
+                options.timing.eeprom_write_us = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'a':
+                options.timing.approval_ms = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'f':
+                if (!firmware_load_timing(optarg, &options.timing)) {
+                    return 1;
+                }
+                break;
+            case 'r':
+                options.approval = FIRMWARE_REFUSE;
+                break;
+            case 'A':
+                options.script = optarg;
+                break;
+            case 'p':
+                options.pty = true;
+                break;
+            default:
+                std::fprintf(stderr, "usage: %s [-b baud] [-e eeprom_us] [-a approval_ms] [-f timing_file] [-r] "
+                             "[-A script] [-p]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (options.timing.baud == 0 || options.timing.cpu_hz == 0) {
+        std::fprintf(stderr, "baud and cpu_hz must not be 0\n");
+        return 1;
+    }
+
+    if (!options.timing.calibrated) {
+        std::fprintf(options.pty ? stderr : stdout, "%s\n", FIRMWARE_UNCALIBRATED_NOTE);
+    }
+    firmware_set_timing(&options.timing);
+    firmware_thread_init();
+    FirmwareDevice *device = firmware_device_new(options.approval);
+    if (device == nullptr) {
+        return 1;
+    }
+    if (options.script != nullptr && !firmware_device_set_script(device, options.script)) {
+        std::fprintf(stderr, "-A: malformed approval script %s\n", options.script);
+        firmware_device_free(device);
+        return 1;
+    }
+
+    int result = options.pty ? serve_pty(device) : run_scenario(device);
+    firmware_device_free(device);
+    return result;
+}
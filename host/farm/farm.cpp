@@ -0,0 +1,339 @@
+// Virtual authenticator farm: thousands of emulated authenticators (firmware.h) driven by a pool
+// of threads, with the exact protocol behaviour of the firmware.
+// Usage: authenticator-farm [-n devices] [-t threads] [-s seconds] [-c 160|256] [-A script] [-p]
+//
+// By default, the farm is its own load generator: each device registers one credential
+// (MakeCredential), then the threads request assertions from their devices in turn until the
+// time is up. The throughput and latency percentiles of each command are reported; the
+// latencies are those of the firmware code on this host, not of the board.
+//
+// With -p, each device is served on its own pseudo-terminal instead, until the process is
+// killed: the paths are printed one per line, so that a relying party backend (or
+// authenticatord, DevicePool) can be load-tested against the devices as against boards.
+// Responses are written as soon as they are computed.
+//
+// -A scripts the user of every device (see firmware_device_set_script), e.g. -A 300,n,2500;
+// by default every approval is granted at once.
+
+#include "firmware.h"
+
+#include "../authenticator.h"
+#include "../session.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+using namespace authenticator;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    size_t devices = 1000;
+    size_t threads = std::max(1u, std::thread::hardware_concurrency());
+    double seconds = 5;
+    Curve curve = Curve::Secp160r1;
+    const char *script = nullptr; // Approval script of every device, nullptr to approve at once
+    bool pty = false;
+};
+
+struct VirtualDevice {
+    FirmwareDevice *firmware = nullptr;
+    AppId app_id{};
+    int master = -1;              // Pseudo-terminal (-p)
+    std::string path;
+    std::vector<uint8_t> pending; // Bytes received, not yet a complete frame
+};
+
+/**
+ * @brief Latencies (in microseconds) and failures of one command.
+ */
+struct Samples {
+    std::vector<uint32_t> latencies;
+    uint64_t failures = 0;
+
+    void merge(const Samples &other) {
+        latencies.insert(latencies.end(), other.latencies.begin(), other.latencies.end());
+        failures += other.failures;
+    }
+};
+
+struct Worker {
+    std::vector<VirtualDevice *> devices;
+    Samples make_credential;
+    Samples get_assertion;
+};
+
+/**
+ * @brief Runs one command on a device and records its latency.
+ *
+ * @return The status byte, or 0xFF if the device answered nothing.
+ */
+uint8_t timed(Samples &samples, VirtualDevice &device, const std::vector<uint8_t> &request,
+              std::vector<uint8_t> &response) {
+    auto start = Clock::now();
+    size_t size = firmware_transact(device.firmware, request.data(), request.size(), response.data(), response.size());
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start);
+    uint8_t status = size ? response[0] : 0xFF;
+
+    samples.latencies.push_back(static_cast<uint32_t>(elapsed.count()));
+    if (status != static_cast<uint8_t>(Status::Ok)) {
+        samples.failures++;
+    }
+    return status;
+}
+
+/**
+ * @brief Runs the complete frames received on the pseudo-terminal of a device, and writes
+ *        the responses back.
+ *
+ * @return false if the pseudo-terminal failed.
+ */
+bool serve_frames(VirtualDevice &device, std::vector<uint8_t> &response) {
+    while (!device.pending.empty()) {
+        size_t size = request_size(device.pending.data(), device.pending.size());
+
+        if (size == 0 || size > FIRMWARE_MAX_REQUEST_SIZE) {
+            device.pending.clear(); // Multi-step commands are not emulated: the client times out
+            return true;
+        }
+        if (size > device.pending.size()) {
+            return true; // The handler waits for the rest of the frame
+        }
+
+        size_t answered = firmware_transact(device.firmware, device.pending.data(), size, response.data(),
+                                            response.size());
+        device.pending.erase(device.pending.begin(), device.pending.begin() + size);
+        for (size_t written = 0; written < answered;) {
+            ssize_t count = write(device.master, response.data() + written, answered - written);
+            if (count < 0 && errno != EINTR) {
+                return false;
+            }
+            written += std::max<ssize_t>(count, 0);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Serves the devices of a worker on their pseudo-terminals, until the process is killed.
+ */
+void serve_worker(Worker &worker) {
+    std::vector<uint8_t> response(FIRMWARE_MAX_RESPONSE_SIZE);
+    struct epoll_event events[64];
+    uint8_t buffer[256];
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+    for (VirtualDevice *device : worker.devices) {
+        struct epoll_event event = {};
+
+        event.events = EPOLLIN;
+        event.data.ptr = device;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, device->master, &event);
+    }
+    for (;;) {
+        int count = epoll_wait(epoll_fd, events, 64, -1);
+
+        for (int i = 0; i < count; i++) {
+            VirtualDevice &device = *static_cast<VirtualDevice *>(events[i].data.ptr);
+            ssize_t received = read(device.master, buffer, sizeof(buffer));
+
+            if (received > 0) {
+                device.pending.insert(device.pending.end(), buffer, buffer + received);
+            }
+            if ((received < 0 && errno != EINTR && errno != EAGAIN) || !serve_frames(device, response)) {
+                std::fprintf(stderr, "%s: %s\n", device.path.c_str(), std::strerror(errno));
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, device.master, nullptr);
+            }
+        }
+    }
+}
+
+void run_worker(Worker &worker, const Options &options, std::atomic<bool> &stop, std::atomic<size_t> &registered) {
+    std::mt19937 random(std::random_device{}());
+    std::vector<uint8_t> response(FIRMWARE_MAX_RESPONSE_SIZE);
+    Command make = (options.curve == Curve::Secp256r1) ? Command::MakeCredentialSecp256r1 : Command::MakeCredential;
+
+    firmware_thread_init();
+
+    for (VirtualDevice *device : worker.devices) {
+        std::vector<uint8_t> request = {static_cast<uint8_t>(make)};
+
+        device->firmware = firmware_device_new(FIRMWARE_APPROVE);
+        if (options.script != nullptr) {
+            firmware_device_set_script(device->firmware, options.script); // Checked by main()
+        }
+        if (options.pty) {
+            try {
+                device->master = open_pseudo_terminal(device->path);
+            } catch (const std::system_error &error) {
+                std::fprintf(stderr, "%s\n", error.what());
+                std::exit(1);
+            }
+            registered++;
+            continue; // Registered by the relying party
+        }
+        for (uint8_t &byte : device->app_id) {
+            byte = static_cast<uint8_t>(random());
+        }
+        request.insert(request.end(), device->app_id.begin(), device->app_id.end());
+        timed(worker.make_credential, *device, request, response);
+        registered++;
+    }
+    if (options.pty) {
+        serve_worker(worker);
+    }
+    while (registered < options.devices) {
+        std::this_thread::yield(); // Assertions start once every device is registered
+    }
+
+    for (size_t i = 0; !stop; i = (i + 1) % worker.devices.size()) {
+        VirtualDevice &device = *worker.devices[i];
+        std::vector<uint8_t> request = {static_cast<uint8_t>(Command::GetAssertion)};
+
+        request.insert(request.end(), device.app_id.begin(), device.app_id.end());
+        for (size_t j = 0; j < CLIENT_DATA_SIZE; j++) {
+            request.push_back(static_cast<uint8_t>(random()));
+        }
+        timed(worker.get_assertion, device, request, response);
+    }
+
+    for (VirtualDevice *device : worker.devices) {
+        firmware_device_free(device->firmware);
+    }
+}
+
+void report(const char *name, Samples &samples, double seconds) {
+    auto &latencies = samples.latencies;
+
+    if (latencies.empty()) {
+        return;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))]; };
+
+    std::printf("%-16s %9zu %9.0f %8u %8u %8u %8u %8u %8llu\n", name, latencies.size(), latencies.size() / seconds,
+                percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), latencies.back(),
+                static_cast<unsigned long long>(samples.failures));
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    int option;
+
+    while ((option = getopt(argc, argv, "n:t:s:c:A:p")) != -1) {
+        switch (option) {
+            case 'n':
+                options.devices = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 't':
+                options.threads = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 's':
+                options.seconds = std::strtod(optarg, nullptr);
+                break;
+            case 'c':
+                options.curve = (std::string(optarg) == "256") ? Curve::Secp256r1 : Curve::Secp160r1;
+                break;
+            case 'A':
+                options.script = optarg;
+                break;
+            case 'p':
+                options.pty = true;
+                break;
+            default:
+                std::fprintf(stderr, "usage: %s [-n devices] [-t threads] [-s seconds] [-c 160|256] [-A script] [-p]\n",
+                             argv[0]);
+                return 1;
+        }
+    }
+    options.threads = std::max<size_t>(1, std::min(options.threads, options.devices));
+    if (options.devices == 0) {
+        return 1;
+    }
+    if (options.script != nullptr) {
+        FirmwareDevice *check = firmware_device_new(FIRMWARE_APPROVE);
+        bool valid = check && firmware_device_set_script(check, options.script);
+
+        firmware_device_free(check);
+        if (!valid) {
+            std::fprintf(stderr, "-A: malformed approval script %s\n", options.script);
+            return 1;
+        }
+    }
+    if (options.pty) {
+        struct rlimit files;
+
+        // Two descriptors per pseudo-terminal (see open_pseudo_terminal)
+        if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+            files.rlim_cur = files.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &files);
+        }
+    }
+
+    std::vector<VirtualDevice> devices(options.devices);
+    std::vector<Worker> workers(options.threads);
+    std::vector<std::thread> threads;
+    std::atomic<bool> stop{false};
+    std::atomic<size_t> registered{0};
+
+    for (size_t i = 0; i < devices.size(); i++) {
+        workers[i % workers.size()].devices.push_back(&devices[i]);
+    }
+
+    auto start = Clock::now();
+    for (Worker &worker : workers) {
+        threads.emplace_back(run_worker, std::ref(worker), std::cref(options), std::ref(stop), std::ref(registered));
+    }
+    while (registered < options.devices) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (options.pty) {
+        for (const VirtualDevice &device : devices) {
+            std::printf("%s\n", device.path.c_str());
+        }
+        std::fflush(stdout);
+        for (std::thread &thread : threads) {
+            thread.join(); // Never returns: served until the process is killed
+        }
+        return 0;
+    }
+    double make_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+    stop = true;
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    double get_seconds = std::chrono::duration<double>(Clock::now() - start).count() - make_seconds;
+
+    Samples make_credential, get_assertion;
+    for (const Worker &worker : workers) {
+        make_credential.merge(worker.make_credential);
+        get_assertion.merge(worker.get_assertion);
+    }
+
+    std::printf("%zu devices, %zu threads, %s\n", options.devices, options.threads,
+                options.curve == Curve::Secp256r1 ? "secp256r1" : "secp160r1");
+    std::printf("%-16s %9s %9s %8s %8s %8s %8s %8s %8s\n", "command", "ops", "ops/s", "p50 us", "p90 us", "p99 us",
+                "p999 us", "max us", "errors");
+    report("MakeCredential", make_credential, make_seconds);
+    report("GetAssertion", get_assertion, get_seconds);
+    return (make_credential.failures || get_assertion.failures) ? 1 : 0;
+}
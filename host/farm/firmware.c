@@ -0,0 +1,523 @@
+// Host build of uart.c (see firmware.h). The firmware sources are compiled unchanged against
+// the register and EEPROM stubs of this directory, with FIRMWARE_STATE and uECC_THREAD_LOCAL
+// defined as _Thread_local and main() renamed (see host/Makefile).
+
+#include "../../uart.c"
+
+#include "firmware.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/random.h>
+
+_Static_assert(FIRMWARE_MAX_REQUEST_SIZE == UART_RX_BUFFER_SIZE - 1, "The request must fit in the RX ring buffer");
+_Static_assert(FIRMWARE_MAX_RESPONSE_SIZE >= 2 + EEPROM_MAX_ENTRIES * (CREDENTIAL_ID_SIZE + SHA1_SIZE), "ListCredentials must fit");
+_Static_assert(FIRMWARE_MAX_RESPONSE_SIZE <= FARM_TX_SIZE, "farm_tx must hold any response");
+_Static_assert(sizeof(Credential) == SHA1_SIZE + CREDENTIAL_ID_SIZE + USER_HANDLE_SIZE + 1 + PRIVATE_KEY_MAX_SIZE +
+               4 * COUNTER_CELLS, "The EEPROM image must have the layout of the board");
+
+#define BUTTON_RELEASE_MS 60 // The button is released at least 4 debounce polls before a press
+#define NS_PER_US 1000ULL
+#define NS_PER_MS 1000000ULL
+#define NS_PER_S 1000000000ULL
+#define NEVER UINT64_MAX
+#define NOT_PRESSED (-1) // Step of an approval script: the button is never pressed
+
+const FirmwareTiming FIRMWARE_TIMING_DEFAULT = {
+    .baud = 117647, // 115200 requested, UBRR0 = 16
+    .eeprom_write_us = 3300, // tWD of the ATmega328p datasheet
+    .approval_ms = 0,
+    .cpu_hz = F_CPU,
+    // Estimates for uECC_asm_fast (secp160r1) and uECC_asm_small (secp256r1), not measured on
+    // this build: the tools print FIRMWARE_UNCALIBRATED_NOTE until a timing file replaces them
+    .make_key_cycles = {2600000, 8000000},
+    .sign_cycles = {2900000, 8600000},
+    .compress_cycles = 2000,
+    .sha256_block_cycles = 60000,
+    .calibrated = 0,
+};
+
+/**
+ * @brief Emulated device: EEPROM image and RAM state of uart.c, swapped in the thread's
+ *        globals while it runs a command.
+ */
+struct FirmwareDevice {
+    uint8_t *eeprom;
+    FirmwareApproval approval;
+    int32_t script[FIRMWARE_SCRIPT_MAX]; // Press delays in ms, or NOT_PRESSED
+    uint8_t script_size;
+    uint8_t script_next;
+    uint8_t state_button;
+    uint8_t count_button;
+    uint8_t pressed_button;
+    uint8_t credential_index[EEPROM_MAX_ENTRIES];
+    uint8_t app_index[EEPROM_MAX_ENTRIES];
+    uint16_t deleted_slots;
+    uint32_t sign_counter[EEPROM_MAX_ENTRIES];
+    uint8_t counter_headroom[EEPROM_MAX_ENTRIES];
+};
+
+/**
+ * @brief Virtual clock of the command being run, in nanoseconds from the first request byte.
+ */
+typedef struct {
+    uint64_t now;
+    uint64_t approval;       // Time spent in _delay_ms(), i.e. waiting for the button
+    uint64_t approval_start; // First button poll of the command
+    int64_t press_ms;        // Time the user takes to press the button, or NOT_PRESSED
+    uint64_t eeprom_free;    // End of the EEPROM write in progress
+    uint64_t udr_free;       // Time the last byte sent moved to the shift register
+    uint64_t line_free;      // End of the last byte on the line
+    uint64_t first_tx;       // Time the first response byte started
+} Clock;
+
+uint8_t __heap_start; // End of .bss on the board, only compared with SP here
+
+static FirmwareTiming timing = FIRMWARE_TIMING_DEFAULT;
+
+_Thread_local FarmRegisters farm_registers = {.ucsr0a = (1 << UDRE0) | (1 << TXC0)}; // TX register and line always free
+_Thread_local uint8_t farm_tx[FARM_TX_SIZE];
+_Thread_local size_t farm_tx_size = 0;
+static _Thread_local uint8_t *farm_eeprom = NULL;
+static _Thread_local FirmwareDevice *current = NULL;
+static _Thread_local Clock clock_;
+static _Thread_local jmp_buf rx_empty; // Where firmware_transact_timed() resumes on an incomplete frame
+
+#define FARM_EEPROM(address) (farm_eeprom + ((const uint8_t *)(address) - __start_eemem))
+
+// --------------------------------- Virtual clock ---------------------------------
+
+static uint64_t byte_ns(void) {
+    return 10 * NS_PER_S / timing.baud; // Start bit, 8 data bits, stop bit
+}
+
+static void cpu_cycles(uint64_t cycles) {
+    clock_.now += cycles * NS_PER_S / timing.cpu_hz;
+}
+
+static void sha256_blocks(uint32_t blocks) {
+    cpu_cycles((uint64_t)blocks * timing.sha256_block_cycles);
+}
+
+void farm_delay_ms(double ms) {
+    uint64_t delay = (uint64_t)(ms * NS_PER_MS);
+
+    clock_.now += delay;
+    // Only ask_for_approval() waits before answering; SetBaudRate waits after its STATUS_OK
+    // for a confirmation, which comes here as the next request
+    if (clock_.first_tx == NEVER) {
+        clock_.approval += delay;
+    }
+}
+
+/**
+ * @brief Sends one byte: the CPU waits until the data register is free, i.e. until the
+ *        previous byte has moved to the shift register, as UART_putc() polls UDRE0.
+ */
+uint8_t *farm_uart_tx(void) {
+    uint64_t start;
+
+    if (clock_.now < clock_.udr_free) {
+        clock_.now = clock_.udr_free;
+    }
+    start = (clock_.now > clock_.line_free) ? clock_.now : clock_.line_free;
+    if (clock_.first_tx == NEVER) {
+        clock_.first_tx = start;
+    }
+    clock_.udr_free = start;
+    clock_.line_free = start + byte_ns();
+    return &farm_tx[farm_tx_size++ & (FARM_TX_SIZE - 1)];
+}
+
+// --------------------------------- Board stubs ---------------------------------
+
+void entropy_init(void) {
+}
+
+int avr_rng(uint8_t *dest, unsigned size) {
+    return getrandom(dest, size, 0) == (ssize_t)size;
+}
+
+/**
+ * @brief Time the user of the current device takes to press the button, taking the next step
+ *        of its script. The button is released for at least BUTTON_RELEASE_MS, so that
+ *        debounce() sees the release of the previous press.
+ */
+static int64_t press_delay(void) {
+    int64_t delay = timing.approval_ms;
+
+    if (current->approval == FIRMWARE_REFUSE) {
+        return NOT_PRESSED;
+    }
+    if (current->approval == FIRMWARE_SCRIPTED) {
+        delay = current->script[current->script_next];
+        current->script_next = (current->script_next + 1) % current->script_size;
+        if (delay == NOT_PRESSED) {
+            return NOT_PRESSED;
+        }
+    }
+    return delay > BUTTON_RELEASE_MS ? delay : BUTTON_RELEASE_MS;
+}
+
+/**
+ * @brief Button pin of the current device: released when the command starts waiting for it,
+ *        then pressed after the delay of press_delay(), if any.
+ */
+uint8_t farm_pind(void) {
+    if (clock_.approval_start == NEVER) {
+        clock_.approval_start = clock_.now;
+        clock_.press_ms = press_delay();
+    }
+    if (clock_.press_ms != NOT_PRESSED && clock_.now - clock_.approval_start >= (uint64_t)clock_.press_ms * NS_PER_MS) {
+        return 0; // Pressed: active low
+    }
+    return 1 << BUTTON_PIN; // Released: pull-up
+}
+
+/**
+ * @brief Called by UART_getc() when the RX buffer is empty: on the board, the handler would
+ *        wait for the rest of the frame, which never comes here. The command is abandoned.
+ */
+void farm_rx_empty(void) {
+    longjmp(rx_empty, 1);
+}
+
+// --------------------------------- EEPROM ---------------------------------
+
+static void eeprom_wait(void) {
+    if (clock_.now < clock_.eeprom_free) {
+        clock_.now = clock_.eeprom_free; // EEPE still set
+    }
+}
+
+int eeprom_is_ready(void) {
+    return clock_.now >= clock_.eeprom_free;
+}
+
+uint8_t eeprom_read_byte(const uint8_t *address) {
+    eeprom_wait();
+    return *FARM_EEPROM(address);
+}
+
+void eeprom_write_byte(uint8_t *address, uint8_t value) {
+    eeprom_wait();
+    *FARM_EEPROM(address) = value;
+    clock_.eeprom_free = clock_.now + timing.eeprom_write_us * NS_PER_US; // The CPU goes on meanwhile
+}
+
+void eeprom_update_byte(uint8_t *address, uint8_t value) {
+    if (eeprom_read_byte(address) != value) {
+        eeprom_write_byte(address, value);
+    }
+}
+
+uint32_t eeprom_read_dword(const uint32_t *address) {
+    uint32_t value;
+
+    eeprom_read_block(&value, address, sizeof(value));
+    return value;
+}
+
+void eeprom_update_dword(uint32_t *address, uint32_t value) {
+    eeprom_update_block(&value, address, sizeof(value));
+}
+
+void eeprom_read_block(void *destination, const void *source, size_t size) {
+    eeprom_wait();
+    memcpy(destination, FARM_EEPROM(source), size);
+}
+
+void eeprom_write_block(const void *source, void *destination, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        eeprom_write_byte((uint8_t *)destination + i, ((const uint8_t *)source)[i]);
+    }
+}
+
+void eeprom_update_block(const void *source, void *destination, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        eeprom_update_byte((uint8_t *)destination + i, ((const uint8_t *)source)[i]);
+    }
+}
+
+// --------------------------------- Computation costs ---------------------------------
+// The firmware calls to uECC and SHA-256 are redirected here at link time (-Wl,--wrap, see
+// host/Makefile), calls within sha256.c are not.
+
+int __real_uECC_make_key(uint8_t *public_key, uint8_t *private_key);
+int __real_uECC_secp256r1_make_key(uint8_t *public_key, uint8_t *private_key);
+void __real_uECC_compress(const uint8_t *public_key, uint8_t *compressed);
+int __real_uECC_sign_deterministic(const uint8_t *private_key, const uint8_t *message_hash,
+                                   uECC_HashContext *hash_context, uint8_t *signature);
+int __real_uECC_secp256r1_sign_deterministic(const uint8_t *private_key, const uint8_t *message_hash,
+                                             uECC_HashContext *hash_context, uint8_t *signature);
+void __real_sha256_update(SHA256_CTX *ctx, const uint8_t *data, uint16_t size);
+void __real_sha256_final(SHA256_CTX *ctx, uint8_t *digest);
+void __real_hmac_sha256_init(HMAC_SHA256_CTX *hmac, const uint8_t *key, uint16_t key_size);
+void __real_hmac_sha256_update(HMAC_SHA256_CTX *hmac, const uint8_t *data, uint16_t size);
+void __real_hmac_sha256_final(HMAC_SHA256_CTX *hmac, uint8_t *mac);
+
+int __wrap_uECC_make_key(uint8_t *public_key, uint8_t *private_key) {
+    cpu_cycles(timing.make_key_cycles[CURVE_SECP160R1]);
+    return __real_uECC_make_key(public_key, private_key);
+}
+
+int __wrap_uECC_secp256r1_make_key(uint8_t *public_key, uint8_t *private_key) {
+    cpu_cycles(timing.make_key_cycles[CURVE_SECP256R1]);
+    return __real_uECC_secp256r1_make_key(public_key, private_key);
+}
+
+void __wrap_uECC_compress(const uint8_t *public_key, uint8_t *compressed) {
+    cpu_cycles(timing.compress_cycles);
+    __real_uECC_compress(public_key, compressed);
+}
+
+int __wrap_uECC_sign_deterministic(const uint8_t *private_key, const uint8_t *message_hash,
+                                   uECC_HashContext *hash_context, uint8_t *signature) {
+    cpu_cycles(timing.sign_cycles[CURVE_SECP160R1]);
+    return __real_uECC_sign_deterministic(private_key, message_hash, hash_context, signature);
+}
+
+int __wrap_uECC_secp256r1_sign_deterministic(const uint8_t *private_key, const uint8_t *message_hash,
+                                             uECC_HashContext *hash_context, uint8_t *signature) {
+    cpu_cycles(timing.sign_cycles[CURVE_SECP256R1]);
+    return __real_uECC_secp256r1_sign_deterministic(private_key, message_hash, hash_context, signature);
+}
+
+void __wrap_sha256_update(SHA256_CTX *ctx, const uint8_t *data, uint16_t size) {
+    sha256_blocks((ctx->length % SHA256_BLOCK_SIZE + size) / SHA256_BLOCK_SIZE);
+    __real_sha256_update(ctx, data, size);
+}
+
+void __wrap_sha256_final(SHA256_CTX *ctx, uint8_t *digest) {
+    sha256_blocks(ctx->length % SHA256_BLOCK_SIZE < SHA256_BLOCK_SIZE - 8 ? 1 : 2); // Padding and length
+    __real_sha256_final(ctx, digest);
+}
+
+void __wrap_hmac_sha256_init(HMAC_SHA256_CTX *hmac, const uint8_t *key, uint16_t key_size) {
+    sha256_blocks(2); // Outer and inner padded keys
+    __real_hmac_sha256_init(hmac, key, key_size);
+}
+
+void __wrap_hmac_sha256_update(HMAC_SHA256_CTX *hmac, const uint8_t *data, uint16_t size) {
+    sha256_blocks((hmac->ctx.length % SHA256_BLOCK_SIZE + size) / SHA256_BLOCK_SIZE);
+    __real_hmac_sha256_update(hmac, data, size);
+}
+
+void __wrap_hmac_sha256_final(HMAC_SHA256_CTX *hmac, uint8_t *mac) {
+    sha256_blocks((hmac->ctx.length % SHA256_BLOCK_SIZE < SHA256_BLOCK_SIZE - 8 ? 1 : 2) + 1); // Inner end, outer hash
+    __real_hmac_sha256_final(hmac, mac);
+}
+
+// --------------------------------- Devices ---------------------------------
+
+static size_t eeprom_size(void) {
+    return __stop_eemem - __start_eemem;
+}
+
+static void device_enter(FirmwareDevice *device) {
+    current = device;
+    farm_eeprom = device->eeprom;
+    state_button = device->state_button;
+    count_button = device->count_button;
+    pressed_button = device->pressed_button;
+    memcpy(credential_index, device->credential_index, sizeof(credential_index));
+    memcpy(app_index, device->app_index, sizeof(app_index));
+    deleted_slots = device->deleted_slots;
+    memcpy(sign_counter, device->sign_counter, sizeof(sign_counter));
+    memcpy(counter_headroom, device->counter_headroom, sizeof(counter_headroom));
+}
+
+static void device_leave(FirmwareDevice *device) {
+    device->state_button = state_button;
+    device->count_button = count_button;
+    device->pressed_button = pressed_button;
+    memcpy(device->credential_index, credential_index, sizeof(credential_index));
+    memcpy(device->app_index, app_index, sizeof(app_index));
+    device->deleted_slots = deleted_slots;
+    memcpy(device->sign_counter, sign_counter, sizeof(sign_counter));
+    memcpy(device->counter_headroom, counter_headroom, sizeof(counter_headroom));
+    farm_eeprom = NULL;
+    current = NULL;
+}
+
+void firmware_thread_init(void) {
+    uECC_set_rng(avr_rng);
+    uECC_set_scratch(ecc_scratch, sizeof(ecc_scratch));
+    uECC_secp256r1_set_rng(avr_rng);
+    uECC_secp256r1_set_scratch(ecc_scratch, sizeof(ecc_scratch));
+    UART_init();
+}
+
+FirmwareDevice *firmware_device_new(FirmwareApproval approval) {
+    FirmwareDevice *device = calloc(1, sizeof(FirmwareDevice));
+
+    if (device == NULL) {
+        return NULL;
+    }
+    device->eeprom = malloc(eeprom_size());
+    if (device->eeprom == NULL) {
+        free(device);
+        return NULL;
+    }
+    memcpy(device->eeprom, __start_eemem, eeprom_size()); // Initial values of the EEMEM variables
+    device->approval = approval;
+    device->state_button = 1; // Released
+
+    device_enter(device);
+    index_build();
+    device_leave(device);
+    return device;
+}
+
+void firmware_device_free(FirmwareDevice *device) {
+    if (device != NULL) {
+        free(device->eeprom);
+        free(device);
+    }
+}
+
+int firmware_device_set_script(FirmwareDevice *device, const char *script) {
+    int32_t steps[FIRMWARE_SCRIPT_MAX];
+    uint8_t size = 0;
+
+    while (*script != '\0') {
+        char *end;
+
+        if (size == FIRMWARE_SCRIPT_MAX) {
+            return 0;
+        }
+        if (*script == 'n') {
+            steps[size++] = NOT_PRESSED;
+            end = (char *)script + 1;
+        } else {
+            long delay = strtol(script, &end, 10);
+
+            if (end == script || delay < 0 || delay > INT32_MAX) {
+                return 0;
+            }
+            steps[size++] = (int32_t)delay;
+        }
+        if (*end != ',' && *end != '\0') {
+            return 0;
+        }
+        script = (*end == ',') ? end + 1 : end;
+    }
+    if (size == 0) {
+        return 0;
+    }
+    memcpy(device->script, steps, sizeof(steps));
+    device->script_size = size;
+    device->script_next = 0;
+    device->approval = FIRMWARE_SCRIPTED;
+    return 1;
+}
+
+int firmware_load_timing(const char *path, FirmwareTiming *timing) {
+    const struct {
+        const char *key;
+        uint32_t *value;
+    } fields[] = {
+        {"baud", &timing->baud},
+        {"eeprom_write_us", &timing->eeprom_write_us},
+        {"approval_ms", &timing->approval_ms},
+        {"cpu_hz", &timing->cpu_hz},
+        {"make_key_cycles_160", &timing->make_key_cycles[0]},
+        {"make_key_cycles_256", &timing->make_key_cycles[1]},
+        {"sign_cycles_160", &timing->sign_cycles[0]},
+        {"sign_cycles_256", &timing->sign_cycles[1]},
+        {"compress_cycles", &timing->compress_cycles},
+        {"sha256_block_cycles", &timing->sha256_block_cycles},
+        {"calibrated", &timing->calibrated},
+    };
+    FILE *file = fopen(path, "r");
+    char line[256];
+    int valid = 1;
+
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+    while (valid && fgets(line, sizeof(line), file) != NULL) {
+        char key[64];
+        unsigned long value;
+        int words = sscanf(line, "%63s %lu", key, &value);
+        int known = 0;
+
+        if (words < 1 || key[0] == '#') {
+            continue;
+        }
+        if (words < 2) {
+            fprintf(stderr, "%s: no value for %s\n", path, key);
+            valid = 0;
+            break;
+        }
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            if (strcmp(key, fields[i].key) == 0) {
+                *fields[i].value = (uint32_t)value;
+                known = 1;
+            }
+        }
+        if (!known) {
+            fprintf(stderr, "%s: unknown key %s\n", path, key);
+            valid = 0;
+        }
+    }
+    fclose(file);
+    return valid;
+}
+
+void firmware_set_timing(const FirmwareTiming *costs) {
+    timing = *costs;
+}
+
+size_t firmware_transact(FirmwareDevice *device, const uint8_t *request, size_t size,
+                         uint8_t *response, size_t capacity) {
+    return firmware_transact_timed(device, request, size, response, capacity, NULL);
+}
+
+size_t firmware_transact_timed(FirmwareDevice *device, const uint8_t *request, size_t size,
+                               uint8_t *response, size_t capacity, FirmwareLatency *latency) {
+    if (size == 0 || size > FIRMWARE_MAX_REQUEST_SIZE) {
+        return 0;
+    }
+
+    // The handler starts once the last request byte has arrived: the bytes are read at once
+    memset(&clock_, 0, sizeof(clock_));
+    clock_.now = size * byte_ns();
+    clock_.udr_free = clock_.line_free = clock_.now;
+    clock_.approval_start = clock_.first_tx = NEVER;
+
+    device_enter(device);
+    memcpy((uint8_t *)rx_buffer, request, size); // As received by the RX interrupt
+    rx_tail = 0;
+    rx_head = size;
+    farm_tx_size = 0;
+
+    if (setjmp(rx_empty) == 0) {
+        commit_slot = COMMIT_NONE;
+        UART_handle_command(UART_getc());
+    } else {
+        farm_tx_size = 0; // Incomplete frame: no response
+    }
+    rx_tail = rx_head; // Bytes left over by the handler are dropped
+
+    if (latency != NULL) {
+        uint64_t request_end = size * byte_ns();
+        uint64_t first_tx = (clock_.first_tx == NEVER) ? clock_.now : clock_.first_tx;
+
+        latency->request_us = request_end / NS_PER_US;
+        latency->approval_us = clock_.approval / NS_PER_US;
+        latency->processing_us = (first_tx - request_end - clock_.approval) / NS_PER_US;
+        latency->response_us = (clock_.first_tx == NEVER) ? 0 : (clock_.line_free - first_tx) / NS_PER_US;
+    }
+
+    // Idle until the next command (not timed: the host is reading the response meanwhile)
+    while (store_compact_step() || counter_commit_step()) {
+        // One EEPROM byte per step, as in the main loop of the board
+    }
+    device_leave(device);
+
+    memcpy(response, farm_tx, farm_tx_size < capacity ? farm_tx_size : capacity);
+    return farm_tx_size;
+}
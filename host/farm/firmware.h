@@ -0,0 +1,133 @@
+#ifndef FARM_FIRMWARE_H
+#define FARM_FIRMWARE_H
+
+// Host build of the command handlers of the firmware (uart.c): each FirmwareDevice is an
+// emulated authenticator with its own EEPROM image and RAM state, answering byte for byte like
+// the board. Several threads can emulate devices at once, one device at a time per thread.
+// A virtual clock follows what the board would spend on each command (see FirmwareTiming).
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Largest request frame, command byte included: the whole frame is put in the RX ring buffer
+// (UART_RX_BUFFER_SIZE - 1 bytes) before the handler runs
+#define FIRMWARE_MAX_REQUEST_SIZE 63
+// Largest response of a single-frame command (ListCredentials with 12 entries: 2 + 12 * 36)
+#define FIRMWARE_MAX_RESPONSE_SIZE 512
+
+// Longest approval script (see firmware_device_set_script)
+#define FIRMWARE_SCRIPT_MAX 32
+
+typedef enum {
+    FIRMWARE_APPROVE,  // The button is pressed as soon as the LED blinks
+    FIRMWARE_REFUSE,   // The button is never pressed: approval commands answer STATUS_ERR_APPROVAL
+    FIRMWARE_SCRIPTED, // Each approval follows the next step of the script of the device
+} FirmwareApproval;
+
+typedef struct FirmwareDevice FirmwareDevice;
+
+/**
+ * @brief Costs of the board used by the virtual clock. The cycle counts are those of the uECC
+ *        and SHA-256 code of this repository on the ATmega328p, and should be measured again
+ *        (e.g. with simavr) when it changes; the other handler code is not counted.
+ *        `calibrated` tells whether they were: the tools flag their predictions otherwise.
+ */
+typedef struct {
+    uint32_t baud;                // Actual UART rate: 16 MHz / (8 * (UBRR0 + 1)) with U2X0
+    uint32_t eeprom_write_us;     // Erase and write of one EEPROM byte
+    uint32_t approval_ms;         // Time the user takes to press the button once the LED blinks
+    uint32_t cpu_hz;
+    uint32_t make_key_cycles[2];  // uECC_make_key, by curve (CURVE_SECP160R1, CURVE_SECP256R1)
+    uint32_t sign_cycles[2];      // uECC_sign_deterministic, hashes excluded
+    uint32_t compress_cycles;     // uECC_compress
+    uint32_t sha256_block_cycles; // One SHA-256 block compression
+    uint32_t calibrated;          // 1 if the cycle counts were measured on this build, 0 for placeholders
+} FirmwareTiming;
+
+/**
+ * @brief Time the board would take for one command, by phase.
+ */
+typedef struct {
+    uint64_t request_us;    // Transfer of the request frame
+    uint64_t processing_us; // End of the request to first response byte, approval excluded
+    uint64_t approval_us;   // Waiting for the button (debounce polls included)
+    uint64_t response_us;   // First to last response byte on the line
+} FirmwareLatency;
+
+// Placeholder costs: the cycle counts are estimates, not measurements (calibrated is 0)
+extern const FirmwareTiming FIRMWARE_TIMING_DEFAULT;
+
+// Printed by the tools whose predictions rest on uncalibrated cycle counts
+#define FIRMWARE_UNCALIBRATED_NOTE \
+    "note: uncalibrated cycle counts (placeholders of FIRMWARE_TIMING_DEFAULT), the processing times are " \
+    "estimates; measure them (simavr) and pass a timing file with \"calibrated 1\""
+
+/**
+ * @brief Reads a timing file into `timing`: one "key value" line per cost, named after the
+ *        fields of FirmwareTiming (e.g. "sign_cycles_160 2900000", "calibrated 1"); lines
+ *        starting with '#' are ignored. Errors are printed on stderr.
+ *
+ * @return 1, or 0 if the file cannot be read or has an unknown key.
+ */
+int firmware_load_timing(const char *path, FirmwareTiming *timing);
+
+/**
+ * @brief Replaces the costs of the virtual clock, before any thread emulates a device.
+ */
+void firmware_set_timing(const FirmwareTiming *timing);
+
+/**
+ * @brief Sets the RNG and scratch arena of uECC for the calling thread. Must be called by each
+ *        thread before it emulates a device.
+ */
+void firmware_thread_init(void);
+
+/**
+ * @brief Creates a device with an empty credential store (EEPROM as flashed).
+ *
+ * @return The device, or NULL if out of memory.
+ */
+FirmwareDevice *firmware_device_new(FirmwareApproval approval);
+void firmware_device_free(FirmwareDevice *device);
+
+/**
+ * @brief Scripts the user of a device, which switches to FIRMWARE_SCRIPTED. The script is a
+ *        comma separated list of steps, used in turn by the approvals (from the first one again
+ *        after the last): the time in ms the user takes to press the button, or "n" for a
+ *        button never pressed. E.g. "300,n,2500".
+ *
+ * @return 1, or 0 if the script is empty, malformed or longer than FIRMWARE_SCRIPT_MAX steps.
+ */
+int firmware_device_set_script(FirmwareDevice *device, const char *script);
+
+/**
+ * @brief Runs one command on a device, as the main loop of the firmware would, then lets the
+ *        device run its idle tasks (compaction, counter reservation).
+ *        The frame must be complete: where the board would wait for the missing bytes, the
+ *        command is abandoned, so multi-step commands (import, backup) cannot be emulated.
+ *
+ * @param request Command byte followed by its parameters.
+ * @param size Size of the request, at most FIRMWARE_MAX_REQUEST_SIZE.
+ * @param response Output buffer.
+ * @param capacity Size of the output buffer.
+ * @return The size of the response (copied up to `capacity`), 0 if the request is too large
+ *         or incomplete.
+ */
+size_t firmware_transact(FirmwareDevice *device, const uint8_t *request, size_t size,
+                         uint8_t *response, size_t capacity);
+
+/**
+ * @brief Same as firmware_transact(), and gives the time the board would have taken.
+ */
+size_t firmware_transact_timed(FirmwareDevice *device, const uint8_t *request, size_t size,
+                               uint8_t *response, size_t capacity, FirmwareLatency *latency);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef FARM_UTIL_ATOMIC_H
+#define FARM_UTIL_ATOMIC_H
+
+// No interrupt can preempt the emulated firmware: the block runs once
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_BLOCK(type) for (uint8_t farm_atomic = 1; farm_atomic; farm_atomic = 0)
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef FARM_UTIL_DELAY_H
+#define FARM_UTIL_DELAY_H
+
+// Delays only advance the virtual clock
+void farm_delay_ms(double ms);
+
+#define _delay_ms(ms) farm_delay_ms(ms)
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef FARM_UTIL_SETBAUD_H
+#define FARM_UTIL_SETBAUD_H
+
+// 115200 baud with U2X0 at 16 MHz
+#define UBRRH_VALUE 0
+#define UBRRL_VALUE 16
+
+#endif
@@ -0,0 +1,285 @@
+#include "pool.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include <glob.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace authenticator {
+
+DevicePool::DevicePool(const std::vector<std::string> &paths) : members_(paths.size()) {
+    if (paths.empty()) {
+        throw std::invalid_argument("DevicePool: no serial port");
+    }
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        throw std::system_error(errno, std::generic_category(), "epoll_create1");
+    }
+    for (size_t i = 0; i < paths.size(); i++) {
+        members_[i].path = paths[i];
+        open(i);
+    }
+}
+
+DevicePool::~DevicePool() {
+    ::close(epoll_fd_);
+}
+
+/**
+ * @brief Paths matching the glob patterns, in the order of the patterns.
+ */
+static std::vector<std::string> glob_paths(std::initializer_list<const char *> patterns) {
+    std::vector<std::string> paths;
+
+    for (const char *pattern : patterns) {
+        glob_t matches;
+
+        if (glob(pattern, 0, nullptr, &matches) == 0) {
+            paths.insert(paths.end(), matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+        }
+        globfree(&matches);
+    }
+    return paths;
+}
+
+std::vector<std::string> DevicePool::discover() {
+    std::vector<std::string> candidates = glob_paths({"/dev/serial/by-id/*"});
+    std::vector<std::unique_ptr<Device>> devices;
+    std::vector<std::string> paths;
+
+    if (candidates.empty()) {
+        candidates = glob_paths({"/dev/ttyACM*", "/dev/ttyUSB*"}); // No udev links
+    }
+    for (const std::string &path : candidates) {
+        try {
+            devices.push_back(std::make_unique<Device>(path, 0));
+        } catch (const std::system_error &) {
+            devices.push_back(nullptr); // Busy or not a serial port
+        }
+    }
+
+    // All the boards boot at once, then each one is asked for its store version
+    std::this_thread::sleep_for(BOOT_DELAY);
+    for (size_t i = 0; i < devices.size(); i++) {
+        if (!devices[i]) {
+            continue;
+        }
+        devices[i]->store_version([&paths, &candidates, i](const StoreVersionResult &result) {
+            if (result.error == Error::None && result.status == Status::Ok) {
+                paths.push_back(candidates[i]);
+            }
+        });
+    }
+    for (auto &device : devices) {
+        if (device) {
+            device->run();
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+/**
+ * @brief Rendezvous score of a device for an app ID: FNV-1a of the path, mixed with the
+ *        first bytes of the app ID (already a SHA-1 hash) by the splitmix64 finalizer.
+ */
+static uint64_t rendezvous_score(const std::string &path, const AppId &app_id) {
+    uint64_t hash = 0xcbf29ce484222325;
+
+    for (char c : path) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+    }
+    for (size_t i = 0; i < 8; i++) {
+        hash ^= uint64_t(app_id[i]) << (8 * i);
+    }
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111eb;
+    return hash ^ (hash >> 31);
+}
+
+size_t DevicePool::shard(const AppId &app_id) const {
+    size_t best = 0;
+    uint64_t best_score = 0;
+
+    for (size_t i = 0; i < members_.size(); i++) {
+        uint64_t score = rendezvous_score(members_[i].path, app_id);
+
+        if (i == 0 || score > best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+// --------------------------------- Devices ---------------------------------
+
+void DevicePool::open(size_t index) {
+    Member &member = members_[index];
+
+    member.failed = false;
+    member.ready = false;
+    try {
+        member.device = std::make_unique<Device>(member.path);
+    } catch (const std::system_error &) {
+        member.ready_at = Clock::now() + REOPEN_DELAY;
+        return;
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = index;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, member.device->fd(), &event);
+    member.ready_at = Clock::now() + BOOT_DELAY;
+}
+
+void DevicePool::close(size_t index) {
+    Member &member = members_[index];
+    std::deque<std::function<void()>> held;
+
+    if (member.device) {
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, member.device->fd(), nullptr);
+        member.device.reset();
+    }
+    member.ready = false;
+    member.failed = false;
+    member.ready_at = Clock::now() + REOPEN_DELAY;
+    held.swap(member.held);
+    for (auto &submit : held) {
+        submit(); // Fails, the device is closed
+    }
+}
+
+void DevicePool::note(size_t index, Error error) {
+    Member &member = members_[index];
+
+    if (error == Error::None) {
+        member.completed++;
+        return;
+    }
+    member.failed_requests++;
+    if (error == Error::Io && member.device) {
+        member.failed = true; // Closed from run_once(), not from within Device::run_once()
+    }
+}
+
+std::vector<DevicePool::DeviceStats> DevicePool::stats() const {
+    std::vector<DeviceStats> stats;
+
+    for (const Member &member : members_) {
+        DeviceStats entry;
+
+        entry.path = member.path;
+        entry.healthy = member.device && !member.failed;
+        entry.queue_depth = member.held.size() + (member.device ? member.device->pending() : 0);
+        entry.completed = member.completed;
+        entry.failed = member.failed_requests;
+        stats.push_back(entry);
+    }
+    return stats;
+}
+
+// --------------------------------- Requests ---------------------------------
+
+template <typename Result>
+void DevicePool::route(size_t index, std::function<void(const Result &)> done,
+                       std::function<void(Device &, std::function<void(const Result &)>)> submit) {
+    Member &member = members_[index];
+    auto counted = [this, index, done](const Result &result) {
+        note(index, result.error);
+        done(result);
+    };
+
+    if (!member.device) {
+        Result result;
+
+        result.error = Error::Io;
+        counted(result);
+        return;
+    }
+    if (!member.ready) {
+        member.held.push_back([this, index, done, submit]() { route(index, done, submit); });
+        return;
+    }
+    submit(*member.device, counted);
+}
+
+void DevicePool::make_credential(const AppId &app_id, Curve curve, bool compressed,
+                                 std::function<void(const MakeCredentialResult &)> done) {
+    route<MakeCredentialResult>(shard(app_id), std::move(done),
+        [app_id, curve, compressed](Device &device, std::function<void(const MakeCredentialResult &)> counted) {
+            device.make_credential(app_id, curve, compressed, std::move(counted));
+        });
+}
+
+void DevicePool::get_assertion(const AppId &app_id, const ClientData &client_data, Curve curve,
+                               std::function<void(const AssertionResult &)> done) {
+    route<AssertionResult>(shard(app_id), std::move(done),
+        [app_id, client_data, curve](Device &device, std::function<void(const AssertionResult &)> counted) {
+            device.get_assertion(app_id, client_data, curve, std::move(counted));
+        });
+}
+
+// --------------------------------- Event loop ---------------------------------
+
+size_t DevicePool::run_once(std::chrono::milliseconds max_wait) {
+    struct epoll_event events[16];
+    auto wait = max_wait;
+    auto now = Clock::now();
+
+    for (const Member &member : members_) {
+        if (member.device && member.device->pending()) {
+            wait = std::min(wait, std::chrono::milliseconds(100)); // Lets the devices check their deadlines
+        } else if (!member.device || !member.ready) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(member.ready_at - now);
+            wait = std::min(wait, std::max(std::chrono::milliseconds(0), left + std::chrono::milliseconds(1)));
+        }
+    }
+
+    int count = epoll_wait(epoll_fd_, events, 16, static_cast<int>(wait.count()));
+    for (int i = 0; i < count; i++) {
+        Member &member = members_[events[i].data.u64];
+
+        if (member.device) {
+            member.device->run_once(std::chrono::milliseconds(0));
+        }
+    }
+
+    size_t pending = 0;
+    now = Clock::now();
+    for (size_t i = 0; i < members_.size(); i++) {
+        Member &member = members_[i];
+
+        if (member.device && member.device->pending()) {
+            member.device->run_once(std::chrono::milliseconds(0)); // Deadlines
+        }
+        if (member.failed) {
+            close(i);
+        }
+        if (!member.device && now >= member.ready_at) {
+            open(i);
+        }
+        if (member.device && !member.ready && now >= member.ready_at) {
+            std::deque<std::function<void()>> held;
+
+            member.ready = true;
+            held.swap(member.held);
+            for (auto &submit : held) {
+                submit();
+            }
+        }
+        pending += member.held.size() + (member.device ? member.device->pending() : 0);
+    }
+    return pending;
+}
+
+void DevicePool::run() {
+    while (run_once(std::chrono::milliseconds(1000)) > 0) {
+    }
+}
+
+} // namespace authenticator
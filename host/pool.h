@@ -0,0 +1,115 @@
+#ifndef HOST_POOL_H
+#define HOST_POOL_H
+
+#include "authenticator.h"
+
+#include <memory>
+
+namespace authenticator {
+
+/**
+ * @brief Several authenticators driven from one epoll loop, with the credentials sharded by
+ *        app ID: each app ID is registered on, and signed by, one device chosen by hash.
+ *
+ * Requests to different devices run in parallel, so the signing throughput grows with the
+ * number of boards. The shard of an app ID is chosen by rendezvous hashing over the port
+ * paths: it does not depend on the order of the ports, and adding or removing a board only
+ * moves the app IDs of that board. The paths must name the same board across reboots
+ * (DevicePool::discover returns the /dev/serial/by-id/ paths).
+ *
+ * A device whose port fails is closed, and reopened every REOPEN_DELAY. In the meantime, the
+ * requests for its app IDs fail with Error::Io, and the other devices keep serving theirs.
+ */
+class DevicePool {
+public:
+    // Opening a port resets an Arduino board: requests are held back until it has booted
+    static constexpr std::chrono::milliseconds BOOT_DELAY{2000};
+    static constexpr std::chrono::milliseconds REOPEN_DELAY{1000};
+
+    struct DeviceStats {
+        std::string path;
+        bool healthy = false;    // Port open
+        size_t queue_depth = 0;  // Requests waiting for a response, or for the end of the boot
+        uint64_t completed = 0;  // Responses received (any status)
+        uint64_t failed = 0;     // Requests failed with a timeout or an I/O error
+    };
+
+    /**
+     * @brief Opens every port. A port that cannot be opened is retried like a failed one.
+     * @throws std::invalid_argument if `paths` is empty.
+     */
+    explicit DevicePool(const std::vector<std::string> &paths);
+    ~DevicePool();
+
+    DevicePool(const DevicePool &) = delete;
+    DevicePool &operator=(const DevicePool &) = delete;
+
+    /**
+     * @brief Serial ports of the authenticators, sorted: the ports of /dev/serial/by-id/
+     *        (else /dev/ttyACM*, /dev/ttyUSB*) that answer StoreVersion. Opening a port resets
+     *        the board, so this takes BOOT_DELAY plus one request timeout; other USB serial
+     *        adapters receive one StoreVersion byte.
+     */
+    static std::vector<std::string> discover();
+
+    /**
+     * @brief Index of the device holding the credentials of `app_id`: the device whose path
+     *        gives the highest score with `app_id`.
+     */
+    size_t shard(const AppId &app_id) const;
+
+    void make_credential(const AppId &app_id, Curve curve, bool compressed,
+                         std::function<void(const MakeCredentialResult &)> done);
+    void get_assertion(const AppId &app_id, const ClientData &client_data, Curve curve,
+                       std::function<void(const AssertionResult &)> done);
+
+    std::vector<DeviceStats> stats() const;
+    size_t size() const { return members_.size(); }
+
+    /**
+     * @brief Waits for any port for at most `max_wait`, and calls the callbacks of the
+     *        completed or expired requests of every device.
+     *
+     * @return The number of requests still pending on all devices.
+     */
+    size_t run_once(std::chrono::milliseconds max_wait);
+    void run();
+
+    /**
+     * @brief epoll descriptor, readable when run_once() has work to do.
+     */
+    int fd() const { return epoll_fd_; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Member {
+        std::string path;
+        std::unique_ptr<Device> device;
+        bool ready = false;  // Boot delay over
+        bool failed = false; // I/O error seen, closed from run_once()
+        Clock::time_point ready_at;
+        std::deque<std::function<void()>> held; // Submitted once the board has booted
+        uint64_t completed = 0;
+        uint64_t failed_requests = 0;
+    };
+
+    void open(size_t index);
+    void close(size_t index);
+    void note(size_t index, Error error);
+
+    /**
+     * @brief Submits a request to the device of `index` now, once it has booted, or fails it
+     *        right away if the device is closed.
+     */
+    template <typename Result>
+    void route(size_t index, std::function<void(const Result &)> done,
+               std::function<void(Device &, std::function<void(const Result &)>)> submit);
+
+    std::vector<Member> members_;
+    int epoll_fd_ = -1;
+};
+
+} // namespace authenticator
+
+#endif
@@ -0,0 +1,487 @@
+// Recorder of the serial sessions between a client and an authenticator, to see on the wire
+// what made a command slow. Usage:
+//   authenticator-recorder record [-o session.log] <serial port>
+//   authenticator-recorder show [-b baud] [-f timing] <session.log>
+//   authenticator-recorder replay [-b baud] [-f timing] [-o replayed.log] <session.log> <serial port>
+//   authenticator-recorder replay [-f timing] -e <session.log>
+//
+// record stands between the client and the authenticator on a pseudo-terminal, whose path is
+// printed: the client opens it instead of the serial port, and every byte is forwarded and
+// written to the session log (see SessionChunk) with its time in microseconds. The serial port
+// stays at 115200: the rate of a SetBaudRate is made invalid on its way, so that the
+// authenticator answers STATUS_ERR_BAD_PARAMETER instead of leaving the recorder behind.
+// show cuts the session into commands (parse_session) and splits the time of each one into
+// request transfer, processing, approval and response transfer.
+// replay sends the requests of a session again, with the same pauses between commands, to an
+// authenticator (or authenticator-emulator -p) and shows the new session; with -e, the
+// requests are run on the emulated firmware, whose virtual clock gives each phase exactly.
+//
+// The wire only shows when the request was sent and when the response came back. The time the
+// board spent in between is split with the emulated firmware (farm/firmware.h): a shadow device
+// runs the same commands from an empty store, and its processing time is taken as that of the
+// board, the rest being the wait for the button. When the shadow answers another status (e.g.
+// the credential was made before the recording), the approval time is unknown ("-"). The split
+// is only as good as the cycle counts of the emulated firmware: unless a calibrated timing file
+// is given (-f, see firmware_load_timing), the approval is not split off either ("?") and the
+// processing column holds the whole time of the board, approval included.
+
+#include "farm/firmware.h"
+#include "pool.h"
+#include "session.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <poll.h>
+#include <unistd.h>
+
+using namespace authenticator;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t DEFAULT_BAUD = 117647; // 115200 requested, UBRR0 = 16 with U2X0
+// A response with another status than the recorded one has an unknown size: it is taken as
+// complete after this silence
+constexpr std::chrono::milliseconds RESPONSE_SILENCE{200};
+
+// Approval left in the processing time, for lack of calibrated cycle counts
+constexpr double APPROVAL_UNSPLIT = -2;
+
+/**
+ * @brief Time of one command by phase, in microseconds. A negative approval is unknown
+ *        (APPROVAL_UNSPLIT when it is counted in the processing time).
+ */
+struct Phases {
+    double request_us = 0;
+    double processing_us = 0;
+    double approval_us = 0;
+    double response_us = 0;
+};
+
+uint64_t elapsed_us(Clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+}
+
+/**
+ * @brief Follows the request frames sent by the client, and replaces the rate of a SetBaudRate
+ *        other than 115200 with an invalid one. Frames can only be followed up to a multi-step
+ *        command (import, backup), whose size depends on the answers: the rates are let through
+ *        after it, with a warning.
+ */
+class RateFilter {
+public:
+    void filter(uint8_t *bytes, size_t size) {
+        for (size_t i = 0; i < size && !lost_; i++) {
+            frame_.push_back(bytes[i]);
+            if (frame_.size() == 2 && frame_[0] == static_cast<uint8_t>(Command::SetBaudRate) && bytes[i] != 0) {
+                bytes[i] = static_cast<uint8_t>(BAUD_RATES.size()); // First invalid rate
+                std::fprintf(stderr, "SetBaudRate refused: the recorder stays at %u baud\n", BAUD_RATES[0]);
+            }
+            size_t expected = request_size(frame_.data(), frame_.size());
+            if (expected == 0) {
+                std::fprintf(stderr, "%s: SetBaudRate no longer filtered\n", command_name(frame_[0]));
+                lost_ = true;
+            } else if (frame_.size() >= expected) {
+                frame_.clear();
+            }
+        }
+    }
+
+private:
+    std::vector<uint8_t> frame_;
+    bool lost_ = false;
+};
+
+bool write_all(int fd, const uint8_t *data, size_t size) {
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            struct pollfd out = {fd, POLLOUT, 0};
+            if (errno != EAGAIN && errno != EINTR) {
+                return false;
+            }
+            poll(&out, 1, -1);
+            continue;
+        }
+        data += written;
+        size -= written;
+    }
+    return true;
+}
+
+void print_header() {
+    std::printf("%4s %10s %-16s %6s %5s %5s %10s %10s %10s %10s %10s\n", "#", "time s", "command", "status", "req B",
+                "resp B", "request", "processing", "approval", "response", "total ms");
+}
+
+void print_exchange(size_t index, const Exchange &exchange, const Phases &phases) {
+    char approval[16] = "-";
+
+    if (phases.approval_us == APPROVAL_UNSPLIT) {
+        std::snprintf(approval, sizeof(approval), "?");
+    } else if (phases.approval_us >= 0) {
+        std::snprintf(approval, sizeof(approval), "%.2f", phases.approval_us / 1000.0);
+    }
+    std::printf("%4zu %10.3f %-16s %6u %5zu %5zu %10.2f %10.2f %10s %10.2f %10.2f\n", index,
+                exchange.request_start_us / 1e6, command_name(exchange.command()), exchange.status(),
+                exchange.request.size(), exchange.response.size(), phases.request_us / 1000.0,
+                phases.processing_us / 1000.0, approval, phases.response_us / 1000.0,
+                (phases.request_us + phases.processing_us + std::max(phases.approval_us, 0.0) + phases.response_us) /
+                    1000.0);
+}
+
+/**
+ * @brief Splits the time of each command seen on the wire into phases.
+ *
+ * The host sees a request leave, and a response arrive, faster than the line carries them
+ * (kernel and USB buffers): each transfer lasts at least 10 bits per byte at `baud`. The
+ * board starts a command once its request is received and the previous response is sent.
+ * The processing time of the board is predicted with the costs of `timing`, and the approval
+ * left unsplit unless they are calibrated.
+ */
+void show_exchanges(const std::vector<Exchange> &exchanges, uint32_t baud, const FirmwareTiming &timing) {
+    double byte_us = 10e6 / baud;
+    double previous_end = 0;
+    std::vector<uint8_t> response(FIRMWARE_MAX_RESPONSE_SIZE);
+
+    if (!timing.calibrated) {
+        std::printf("%s\n", FIRMWARE_UNCALIBRATED_NOTE);
+        std::printf("approval \"?\": not split off, the processing column includes it\n");
+    }
+    firmware_set_timing(&timing);
+    firmware_thread_init();
+    FirmwareDevice *shadow = firmware_device_new(FIRMWARE_APPROVE);
+
+    print_header();
+    for (size_t i = 0; i < exchanges.size(); i++) {
+        const Exchange &exchange = exchanges[i];
+        Phases phases;
+        double request_end = std::max<double>(exchange.request_end_us,
+                                              exchange.request_start_us + exchange.request.size() * byte_us);
+        double response_line = std::max<double>(exchange.response_end_us - exchange.response_start_us,
+                                                 exchange.response.size() * byte_us);
+        double start = std::max(request_end, previous_end);
+        double first_byte = exchange.response_end_us - response_line;
+        double service = std::max(first_byte - start, 0.0);
+
+        phases.request_us = request_end - exchange.request_start_us;
+        phases.response_us = exchange.response.empty() ? 0 : response_line;
+        previous_end = exchange.response.empty() ? start : exchange.response_end_us;
+
+        // Prediction of the shadow device
+        FirmwareLatency latency{};
+        size_t size = 0;
+        if (shadow != nullptr && exchange.request.size() <= FIRMWARE_MAX_REQUEST_SIZE) {
+            size = firmware_transact_timed(shadow, exchange.request.data(), exchange.request.size(), response.data(),
+                                           response.size(), &latency);
+        }
+
+        if (!needs_approval(exchange.command())) {
+            phases.processing_us = service;
+        } else if (exchange.status() == static_cast<uint8_t>(Status::Approval)) {
+            phases.approval_us = service; // Refused, or no press within 10 s
+        } else if (!timing.calibrated) {
+            phases.processing_us = service;
+            phases.approval_us = APPROVAL_UNSPLIT;
+        } else if (size > 0 && response[0] == exchange.status()) {
+            phases.processing_us = std::min<double>(service, latency.processing_us);
+            phases.approval_us = service - phases.processing_us;
+        } else {
+            phases.processing_us = service;
+            phases.approval_us = -1;
+        }
+        print_exchange(i, exchange, phases);
+    }
+    firmware_device_free(shadow);
+}
+
+bool load(const char *path, std::vector<Exchange> &exchanges) {
+    std::ifstream file(path);
+    std::string stopped;
+
+    if (!file) {
+        std::fprintf(stderr, "%s: %s\n", path, std::strerror(errno));
+        return false;
+    }
+    try {
+        exchanges = parse_session(read_session(file), &stopped);
+    } catch (const std::invalid_argument &error) {
+        std::fprintf(stderr, "%s: %s\n", path, error.what());
+        return false;
+    }
+    if (!stopped.empty()) {
+        std::fprintf(stderr, "%s: parsing stopped after %zu commands (%s)\n", path, exchanges.size(), stopped.c_str());
+    }
+    return true;
+}
+
+int record(const char *serial_path, const char *log_path) {
+    std::ofstream log(log_path);
+    std::string terminal_path;
+    int serial, master;
+    uint8_t buffer[256];
+
+    if (!log) {
+        std::fprintf(stderr, "%s: %s\n", log_path, std::strerror(errno));
+        return 1;
+    }
+    try {
+        serial = open_serial(serial_path);
+        master = open_pseudo_terminal(terminal_path);
+    } catch (const std::system_error &error) {
+        std::fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+    std::printf("%s\n", terminal_path.c_str());
+    std::fflush(stdout);
+
+    RateFilter rate_filter;
+    auto start = Clock::now();
+    struct pollfd fds[2] = {{master, POLLIN, 0}, {serial, POLLIN, 0}};
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::perror("poll");
+            return 1;
+        }
+        for (int i = 0; i < 2; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLERR | POLLHUP))) {
+                continue;
+            }
+            ssize_t size = read(fds[i].fd, buffer, sizeof(buffer));
+            if (size < 0 && (errno == EAGAIN || errno == EINTR)) {
+                continue;
+            }
+            if (size <= 0) {
+                std::fprintf(stderr, "%s: %s\n", i ? serial_path : terminal_path.c_str(),
+                             size ? std::strerror(errno) : "closed");
+                return (i == 1) ? 0 : 1; // The session ends with the authenticator
+            }
+
+            if (i == 0) {
+                rate_filter.filter(buffer, size);
+            }
+            SessionChunk chunk;
+            chunk.time_us = elapsed_us(start);
+            chunk.direction = i ? SessionChunk::Direction::FromDevice : SessionChunk::Direction::ToDevice;
+            chunk.bytes.assign(buffer, buffer + size);
+            write_chunk(log, chunk);
+            log.flush(); // The session stays readable if the recorder is killed
+
+            if (!write_all(i ? master : serial, buffer, size)) {
+                std::perror("write");
+                return 1;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Sends the requests of `exchanges` to an authenticator, with the same pauses between
+ *        a response and the next request, and records the new session.
+ */
+bool replay_device(const std::vector<Exchange> &exchanges, const char *serial_path, std::vector<SessionChunk> &chunks) {
+    int serial;
+    uint8_t buffer[256];
+
+    try {
+        serial = open_serial(serial_path);
+    } catch (const std::system_error &error) {
+        std::fprintf(stderr, "%s\n", error.what());
+        return false;
+    }
+    std::this_thread::sleep_for(DevicePool::BOOT_DELAY); // Opening the port resets an Arduino board
+
+    auto start = Clock::now();
+    uint64_t previous_end = 0;
+    for (size_t i = 0; i < exchanges.size(); i++) {
+        const Exchange &exchange = exchanges[i];
+        uint64_t send_at = previous_end;
+        uint64_t now = elapsed_us(start);
+
+        if (i > 0 && exchange.request_start_us > exchanges[i - 1].response_end_us) {
+            send_at += exchange.request_start_us - exchanges[i - 1].response_end_us; // Same pause
+        }
+        if (send_at > now) {
+            std::this_thread::sleep_for(std::chrono::microseconds(send_at - now));
+        }
+        chunks.push_back({elapsed_us(start), SessionChunk::Direction::ToDevice, exchange.request});
+        if (!write_all(serial, exchange.request.data(), exchange.request.size())) {
+            std::perror(serial_path);
+            return false;
+        }
+
+        // Same size as the recorded response if the status is the same, else wait for silence
+        size_t received = 0, expected = exchange.response.size();
+        auto deadline = Clock::now() + command_timeout(static_cast<Command>(exchange.command()));
+        while (received < expected || expected == 0) {
+            struct pollfd in = {serial, POLLIN, 0};
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+            if (left.count() <= 0 || poll(&in, 1, static_cast<int>(left.count())) == 0) {
+                break;
+            }
+            ssize_t size = read(serial, buffer, sizeof(buffer));
+            if (size < 0 && (errno == EAGAIN || errno == EINTR)) {
+                continue;
+            }
+            if (size <= 0) {
+                std::perror(serial_path);
+                return false;
+            }
+            if (received == 0 && (exchange.response.empty() || buffer[0] != exchange.status())) {
+                expected = 0; // Unknown size
+                deadline = Clock::now() + RESPONSE_SILENCE;
+            } else if (expected == 0) {
+                deadline = Clock::now() + RESPONSE_SILENCE;
+            }
+            chunks.push_back({elapsed_us(start), SessionChunk::Direction::FromDevice,
+                              std::vector<uint8_t>(buffer, buffer + size)});
+            received += size;
+        }
+        previous_end = elapsed_us(start);
+    }
+    close(serial);
+    return true;
+}
+
+/**
+ * @brief Runs the requests of `exchanges` on an emulated device and shows the phases given by
+ *        its virtual clock, with the costs of `timing`.
+ */
+void replay_emulator(const std::vector<Exchange> &exchanges, const FirmwareTiming &timing) {
+    std::vector<uint8_t> response(FIRMWARE_MAX_RESPONSE_SIZE);
+
+    if (!timing.calibrated) {
+        std::printf("%s\n", FIRMWARE_UNCALIBRATED_NOTE);
+    }
+    firmware_set_timing(&timing);
+    firmware_thread_init();
+    FirmwareDevice *device = firmware_device_new(FIRMWARE_APPROVE);
+    if (device == nullptr) {
+        return;
+    }
+
+    print_header();
+    for (size_t i = 0; i < exchanges.size(); i++) {
+        Exchange replayed = exchanges[i];
+        FirmwareLatency latency{};
+        size_t size = firmware_transact_timed(device, replayed.request.data(), replayed.request.size(),
+                                              response.data(), response.size(), &latency);
+
+        replayed.response.assign(response.begin(), response.begin() + std::min(size, response.size()));
+        print_exchange(i, replayed,
+                       {double(latency.request_us), double(latency.processing_us),
+                        needs_approval(replayed.command()) ? double(latency.approval_us) : 0.0,
+                        double(latency.response_us)});
+    }
+    firmware_device_free(device);
+}
+
+void usage(const char *name) {
+    std::fprintf(stderr,
+                 "usage: %s record [-o session.log] <serial port>\n"
+                 "       %s show [-b baud] [-f timing] <session.log>\n"
+                 "       %s replay [-b baud] [-f timing] [-o replayed.log] <session.log> <serial port>\n"
+                 "       %s replay [-f timing] -e <session.log>\n",
+                 name, name, name, name);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    const char *name = argv[0];
+    const char *output = nullptr;
+    uint32_t baud = DEFAULT_BAUD;
+    bool emulator = false;
+    FirmwareTiming timing = FIRMWARE_TIMING_DEFAULT;
+    int option;
+
+    if (argc < 2) {
+        usage(name);
+        return 1;
+    }
+    std::string mode = argv[1];
+    argc--;
+    argv++;
+    while ((option = getopt(argc, argv, "o:b:f:e")) != -1) {
+        switch (option) {
+            case 'e':
+                emulator = true;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'b':
+                baud = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'f':
+                if (!firmware_load_timing(optarg, &timing)) {
+                    return 1;
+                }
+                break;
+            default:
+                usage(name);
+                return 1;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    std::vector<Exchange> exchanges;
+    if (mode == "record" && argc == 1) {
+        return record(argv[0], output ? output : "session.log");
+    }
+    if (baud == 0) {
+        usage(name);
+        return 1;
+    }
+    if (mode == "show" && argc == 1) {
+        if (!load(argv[0], exchanges)) {
+            return 1;
+        }
+        show_exchanges(exchanges, baud, timing);
+        return 0;
+    }
+    if (mode == "replay" && argc == (emulator ? 1 : 2)) {
+        std::vector<SessionChunk> chunks;
+        std::string stopped;
+
+        if (!load(argv[0], exchanges)) {
+            return 1;
+        }
+        if (emulator) {
+            replay_emulator(exchanges, timing);
+            return 0;
+        }
+        if (!replay_device(exchanges, argv[1], chunks)) {
+            return 1;
+        }
+        if (output != nullptr) {
+            std::ofstream log(output);
+            for (const SessionChunk &chunk : chunks) {
+                write_chunk(log, chunk);
+            }
+        }
+        std::vector<Exchange> replayed = parse_session(chunks, &stopped);
+        if (!stopped.empty()) {
+            std::fprintf(stderr, "replay: parsing stopped after %zu commands (%s)\n", replayed.size(), stopped.c_str());
+        }
+        show_exchanges(replayed, baud, timing);
+        return 0;
+    }
+    usage(name);
+    return 1;
+}
@@ -0,0 +1,25 @@
+// Rates of the serial port beyond the termios.h constants (there is no B250000): termios2 takes
+// the rate in baud. Kept apart from authenticator.cpp, since <asm/termbits.h> clashes with
+// <termios.h>.
+
+#include "authenticator.h"
+
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+namespace authenticator {
+
+bool set_serial_speed(int fd, uint32_t baud) {
+    struct termios2 tty;
+
+    if (ioctl(fd, TCGETS2, &tty) != 0) {
+        return false;
+    }
+    tty.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+    tty.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+    tty.c_ispeed = baud;
+    tty.c_ospeed = baud;
+    return ioctl(fd, TCSETS2, &tty) == 0;
+}
+
+} // namespace authenticator
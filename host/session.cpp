@@ -0,0 +1,303 @@
+#include "session.h"
+
+#include <algorithm>
+#include <istream>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+namespace authenticator {
+
+namespace {
+
+constexpr size_t USER_HANDLE_SIZE = 8;
+constexpr size_t LISTED_CREDENTIAL_SIZE = CREDENTIAL_ID_SIZE + APP_ID_SIZE;
+constexpr size_t PUBLIC_KEY_SIZE = 40; // Also the size of a signature
+constexpr size_t COMPRESSED_PUBLIC_KEY_SIZE = 21;
+constexpr size_t P256_PUBLIC_KEY_SIZE = 64;
+constexpr size_t COUNTER_SIZE = 4;
+
+constexpr uint8_t FILTER_APP_ID_PREFIX = 1;
+constexpr uint8_t FILTER_CREDENTIAL_ID = 2;
+
+/**
+ * @brief A byte of one direction of the session, with the time of its chunk.
+ */
+struct TimedByte {
+    uint8_t value;
+    uint64_t time_us;
+};
+
+bool is_assertion(uint8_t command) {
+    switch (static_cast<Command>(command)) {
+        case Command::GetAssertion:
+        case Command::GetAssertionRaw:
+        case Command::GetAssertionAllowList:
+        case Command::GetAssertionUser:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool is_make(uint8_t command) {
+    switch (static_cast<Command>(command)) {
+        case Command::MakeCredential:
+        case Command::MakeCredentialCompressed:
+        case Command::MakeCredentialSecp256r1:
+        case Command::MakeCredentialUser:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/**
+ * @brief Size of the response to `request`, as far as the bytes received so far tell (see
+ *        Device::Request::response_size).
+ */
+size_t response_size(const std::vector<uint8_t> &request, const std::vector<uint8_t> &response,
+                     size_t signature_size) {
+    if (response.empty()) {
+        return 1;
+    }
+    if (response[0] != static_cast<uint8_t>(Status::Ok)) {
+        return 1;
+    }
+    if (is_assertion(request[0])) {
+        return 1 + CREDENTIAL_ID_SIZE + signature_size + COUNTER_SIZE;
+    }
+    switch (static_cast<Command>(request[0])) {
+        case Command::ListCredentials:
+            return (response.size() < 2) ? 2 : 2 + response[1] * LISTED_CREDENTIAL_SIZE;
+        case Command::ListCredentialsFiltered:
+            return (response.size() < 3) ? 3 : 3 + response[2] * LISTED_CREDENTIAL_SIZE;
+        case Command::MakeCredential:
+            return 1 + CREDENTIAL_ID_SIZE + PUBLIC_KEY_SIZE;
+        case Command::MakeCredentialCompressed:
+            return 1 + CREDENTIAL_ID_SIZE + COMPRESSED_PUBLIC_KEY_SIZE;
+        case Command::MakeCredentialSecp256r1:
+            return 1 + CREDENTIAL_ID_SIZE + P256_PUBLIC_KEY_SIZE;
+        case Command::MakeCredentialUser:
+            return 1 + CREDENTIAL_ID_SIZE +
+                   (request[1 + APP_ID_SIZE] == static_cast<uint8_t>(Curve::Secp256r1) ? P256_PUBLIC_KEY_SIZE
+                                                                                       : PUBLIC_KEY_SIZE);
+        case Command::MemoryUsage:
+            return 5;
+        case Command::StoreVersion:
+            return 3;
+        default:
+            return 1; // Reset, DeleteCredential, unknown commands
+    }
+}
+
+/**
+ * @brief Curve of the credential made by a successful MakeCredential request.
+ */
+Curve made_curve(const std::vector<uint8_t> &request) {
+    switch (static_cast<Command>(request[0])) {
+        case Command::MakeCredentialSecp256r1:
+            return Curve::Secp256r1;
+        case Command::MakeCredentialUser:
+            return static_cast<Curve>(request[1 + APP_ID_SIZE]);
+        default:
+            return Curve::Secp160r1;
+    }
+}
+
+} // namespace
+
+void write_chunk(std::ostream &out, const SessionChunk &chunk) {
+    static const char HEX[] = "0123456789abcdef";
+    std::string line = std::to_string(chunk.time_us);
+
+    line += (chunk.direction == SessionChunk::Direction::ToDevice) ? " > " : " < ";
+    for (uint8_t byte : chunk.bytes) {
+        line += HEX[byte >> 4];
+        line += HEX[byte & 0x0F];
+    }
+    out << line << '\n';
+}
+
+std::vector<SessionChunk> read_session(std::istream &in) {
+    std::vector<SessionChunk> chunks;
+    std::string line;
+
+    for (size_t number = 1; std::getline(in, line); number++) {
+        std::istringstream words(line);
+        SessionChunk chunk;
+        std::string direction, hex;
+
+        if (line.empty()) {
+            continue;
+        }
+        if (!(words >> chunk.time_us >> direction >> hex) || (direction != ">" && direction != "<") ||
+            hex.size() % 2 != 0) {
+            throw std::invalid_argument("malformed session line " + std::to_string(number));
+        }
+        chunk.direction = (direction == ">") ? SessionChunk::Direction::ToDevice : SessionChunk::Direction::FromDevice;
+        for (size_t i = 0; i < hex.size(); i += 2) {
+            chunk.bytes.push_back(static_cast<uint8_t>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+        }
+        chunks.push_back(std::move(chunk));
+    }
+    return chunks;
+}
+
+const char *command_name(uint8_t command) {
+    static const char *const NAMES[] = {
+        "ListCredentials", "MakeCredential", "GetAssertion", "Reset", "GetAssertionRaw",
+        "MakeCompressed", "MemoryUsage", "MakeSecp256r1", "ListFiltered", "GetAllowList",
+        "MakeUser", "GetUser", "DeleteCredential", "ImportCredentials", "ExportBackup",
+        "ImportBackup", "StoreVersion", "SetBaudRate",
+    };
+    return command < sizeof(NAMES) / sizeof(NAMES[0]) ? NAMES[command] : "Unknown";
+}
+
+bool needs_approval(uint8_t command) {
+    switch (static_cast<Command>(command)) {
+        case Command::ListCredentials:
+        case Command::MemoryUsage:
+        case Command::ListCredentialsFiltered:
+        case Command::StoreVersion:
+            return false;
+        default:
+            return command <= static_cast<uint8_t>(Command::StoreVersion);
+    }
+}
+
+size_t request_size(const uint8_t *request, size_t size) {
+    if (size == 0) {
+        return 1;
+    }
+    switch (static_cast<Command>(request[0])) {
+        case Command::MakeCredential:
+        case Command::MakeCredentialCompressed:
+        case Command::MakeCredentialSecp256r1:
+            return 1 + APP_ID_SIZE;
+        case Command::GetAssertion:
+            return 1 + APP_ID_SIZE + CLIENT_DATA_SIZE;
+        case Command::GetAssertionRaw:
+            if (size < 1 + APP_ID_SIZE + 2) {
+                return 1 + APP_ID_SIZE + 2;
+            }
+            return 1 + APP_ID_SIZE + 2 + ((size_t(request[1 + APP_ID_SIZE]) << 8) | request[2 + APP_ID_SIZE]);
+        case Command::ListCredentialsFiltered:
+            if (size < 4) {
+                return 4;
+            }
+            if (request[3] == FILTER_APP_ID_PREFIX) {
+                return (size < 5) ? 5 : 5 + size_t(request[4]);
+            }
+            return (request[3] == FILTER_CREDENTIAL_ID) ? 4 + CREDENTIAL_ID_SIZE : 4;
+        case Command::GetAssertionAllowList:
+            if (size < 2 + APP_ID_SIZE + CLIENT_DATA_SIZE) {
+                return 2 + APP_ID_SIZE + CLIENT_DATA_SIZE;
+            }
+            return 2 + APP_ID_SIZE + CLIENT_DATA_SIZE + size_t(request[1 + APP_ID_SIZE + CLIENT_DATA_SIZE]) * CREDENTIAL_ID_SIZE;
+        case Command::MakeCredentialUser:
+            return 1 + APP_ID_SIZE + 1 + USER_HANDLE_SIZE;
+        case Command::GetAssertionUser:
+            return 1 + APP_ID_SIZE + CLIENT_DATA_SIZE + USER_HANDLE_SIZE;
+        case Command::DeleteCredential:
+            return 1 + CREDENTIAL_ID_SIZE;
+        case Command::SetBaudRate:
+            return 2;
+        case Command::ImportCredentials:
+        case Command::ExportBackup:
+        case Command::ImportBackup:
+            return 0;
+        default:
+            return 1; // ListCredentials, Reset, MemoryUsage, StoreVersion, unknown commands
+    }
+}
+
+std::vector<Exchange> parse_session(const std::vector<SessionChunk> &chunks, std::string *stopped) {
+    std::vector<TimedByte> sent, received;
+    std::map<AppId, Curve> curves; // Credentials made during the session
+    std::vector<Exchange> exchanges;
+    std::string reason;
+    size_t h = 0, d = 0;
+
+    for (const SessionChunk &chunk : chunks) {
+        auto &bytes = (chunk.direction == SessionChunk::Direction::ToDevice) ? sent : received;
+        for (uint8_t byte : chunk.bytes) {
+            bytes.push_back({byte, chunk.time_us});
+        }
+    }
+
+    while (h < sent.size() && reason.empty()) {
+        Exchange exchange;
+        size_t size;
+
+        while ((size = request_size(exchange.request.data(), exchange.request.size())) > exchange.request.size() &&
+               h + exchange.request.size() < sent.size()) {
+            exchange.request.push_back(sent[h + exchange.request.size()].value);
+        }
+        if (size == 0) {
+            reason = std::string(command_name(exchange.request[0])) + ": multi-step command, not parsed";
+            break;
+        }
+        if (size > exchange.request.size()) {
+            reason = std::string(command_name(exchange.request[0])) + ": incomplete request";
+            break;
+        }
+        exchange.request_start_us = sent[h].time_us;
+        exchange.request_end_us = sent[h + size - 1].time_us;
+        h += size;
+
+        // Signature size: curve of the credential if it was made in the session, else whether the
+        // bytes of a 64-byte signature arrived before the next request could be answered
+        size_t signature_size = PUBLIC_KEY_SIZE;
+        if (is_assertion(exchange.command())) {
+            AppId app_id;
+            std::copy(exchange.request.begin() + 1, exchange.request.begin() + 1 + APP_ID_SIZE, app_id.begin());
+            auto curve = curves.find(app_id);
+            size_t long_end = d + 1 + CREDENTIAL_ID_SIZE + P256_PUBLIC_KEY_SIZE + COUNTER_SIZE;
+
+            if (curve != curves.end()) {
+                signature_size = (curve->second == Curve::Secp256r1) ? P256_PUBLIC_KEY_SIZE : PUBLIC_KEY_SIZE;
+            } else if (long_end <= received.size() &&
+                       (h == sent.size() || received[long_end - 1].time_us <= sent[h].time_us)) {
+                signature_size = P256_PUBLIC_KEY_SIZE;
+            }
+        }
+
+        while ((size = response_size(exchange.request, exchange.response, signature_size)) > exchange.response.size() &&
+               d + exchange.response.size() < received.size()) {
+            exchange.response.push_back(received[d + exchange.response.size()].value);
+        }
+        if (exchange.response.empty()) {
+            reason = std::string(command_name(exchange.command())) + ": no response";
+        } else {
+            exchange.response_start_us = received[d].time_us;
+            exchange.response_end_us = received[d + exchange.response.size() - 1].time_us;
+            d += exchange.response.size();
+            if (size > exchange.response.size()) {
+                reason = std::string(command_name(exchange.command())) + ": incomplete response";
+            }
+        }
+
+        if (exchange.status() == static_cast<uint8_t>(Status::Ok)) {
+            if (static_cast<Command>(exchange.command()) == Command::Reset) {
+                curves.clear();
+            } else if (is_make(exchange.command())) {
+                AppId app_id;
+                std::copy(exchange.request.begin() + 1, exchange.request.begin() + 1 + APP_ID_SIZE, app_id.begin());
+                curves[app_id] = made_curve(exchange.request);
+            }
+        }
+        exchanges.push_back(std::move(exchange));
+    }
+
+    if (reason.empty() && d < received.size()) {
+        reason = std::to_string(received.size() - d) + " response bytes left over";
+    }
+    if (stopped != nullptr) {
+        *stopped = reason;
+    }
+    return exchanges;
+}
+
+} // namespace authenticator
@@ -0,0 +1,85 @@
+#ifndef HOST_SESSION_H
+#define HOST_SESSION_H
+
+#include "authenticator.h"
+
+#include <iosfwd>
+
+namespace authenticator {
+
+/**
+ * @brief Bytes seen on the serial line at one time, in one direction.
+ *
+ * A session is saved as one text line per chunk: the time in microseconds since the start of
+ * the recording, '>' (client to authenticator) or '<' (authenticator to client), and the bytes
+ * in hexadecimal, e.g. "1520433 < 00a1b2...".
+ */
+struct SessionChunk {
+    enum class Direction : uint8_t {
+        ToDevice,
+        FromDevice,
+    };
+
+    uint64_t time_us = 0;
+    Direction direction = Direction::ToDevice;
+    std::vector<uint8_t> bytes;
+};
+
+/**
+ * @brief One command of a session: its frames, and the time of the chunks holding their first
+ *        and last bytes.
+ */
+struct Exchange {
+    std::vector<uint8_t> request;
+    std::vector<uint8_t> response;
+    uint64_t request_start_us = 0;
+    uint64_t request_end_us = 0;
+    uint64_t response_start_us = 0;
+    uint64_t response_end_us = 0;
+
+    uint8_t command() const { return request[0]; }
+    // Status byte, 0xFF if the authenticator did not answer
+    uint8_t status() const { return response.empty() ? 0xFF : response[0]; }
+};
+
+void write_chunk(std::ostream &out, const SessionChunk &chunk);
+
+/**
+ * @brief Reads the chunks written by write_chunk().
+ * @throws std::invalid_argument on a malformed line.
+ */
+std::vector<SessionChunk> read_session(std::istream &in);
+
+/**
+ * @brief Name of a command byte, "Unknown" for a byte that uart.c does not handle.
+ */
+const char *command_name(uint8_t command);
+
+/**
+ * @brief Whether the authenticator waits for the button before answering the command.
+ */
+bool needs_approval(uint8_t command);
+
+/**
+ * @brief Size of the request frame starting with `request`, as far as the `size` bytes
+ *        received so far tell: when it is larger than `size`, more bytes are needed (and the
+ *        result may grow once they are received).
+ *
+ * @return The frame size, or 0 for the multi-step commands (import, backup), whose frames
+ *         depend on the answers of the authenticator.
+ */
+size_t request_size(const uint8_t *request, size_t size);
+
+/**
+ * @brief Cuts a session into commands and responses, following the frames of uart.c.
+ *
+ * GetAssertion responses hold a 40- or 64-byte signature depending on the curve of the
+ * credential: the curve is taken from the MakeCredential of the app ID earlier in the session,
+ * or else a signature is taken as 64 bytes if the extra bytes arrived before the next request.
+ * Parsing stops at the first multi-step command or incomplete frame; `stopped` then tells why.
+ */
+std::vector<Exchange> parse_session(const std::vector<SessionChunk> &chunks, std::string *stopped = nullptr);
+
+} // namespace authenticator
+
+#endif
@@ -0,0 +1,148 @@
+// Unit tests of CredentialDirectory: the copy of the list is kept while the store version and
+// the number of credentials stay the same, against a board played by the test on a pty.
+
+#include "../directory.h"
+#include "test.h"
+
+#include <poll.h>
+#include <unistd.h>
+
+using namespace authenticator;
+
+namespace {
+
+/**
+ * @brief Board side of a pty: reads one command byte sent by the device and answers it.
+ */
+class FakeBoard {
+public:
+    FakeBoard() : master_(open_pseudo_terminal(path_)) {}
+    ~FakeBoard() { ::close(master_); }
+
+    const std::string &path() const { return path_; }
+
+    /**
+     * @brief Runs `device` until it has sent a command, and answers `response`.
+     *
+     * @return The command byte, or -1 if none came.
+     */
+    int answer(Device &device, const std::vector<uint8_t> &response) {
+        uint8_t command;
+
+        for (int i = 0; i < 50; i++) {
+            struct pollfd in = {master_, POLLIN, 0};
+
+            device.run_once(std::chrono::milliseconds(0));
+            if (poll(&in, 1, 10) == 1 && ::read(master_, &command, 1) == 1) {
+                if (::write(master_, response.data(), response.size()) != static_cast<ssize_t>(response.size())) {
+                    return -1;
+                }
+                return command;
+            }
+        }
+        return -1;
+    }
+
+private:
+    std::string path_;
+    int master_;
+};
+
+std::vector<uint8_t> listing(uint8_t count) {
+    std::vector<uint8_t> response = {static_cast<uint8_t>(Status::Ok), count};
+
+    for (uint8_t i = 0; i < count; i++) {
+        response.insert(response.end(), CREDENTIAL_ID_SIZE, i);  // credential_id
+        response.insert(response.end(), APP_ID_SIZE, 0x40 + i); // app_id
+    }
+    return response;
+}
+
+void run_until(Device &device, const bool &done) {
+    for (int i = 0; i < 100 && !done; i++) {
+        device.run_once(std::chrono::milliseconds(10));
+    }
+}
+
+// Lists, or serves the copy, and checks which commands the device sent
+void test_revalidation() {
+    FakeBoard board;
+    Device device(board.path());
+    CredentialDirectory directory(device);
+    size_t count = 0;
+    bool done = false;
+    auto got = [&](const ListResult &result) {
+        CHECK(result.error == Error::None);
+        count = result.credentials.size();
+        done = true;
+    };
+
+    // First call: version, then the list
+    directory.credentials(got);
+    CHECK(board.answer(device, {0, 7, 1}) == static_cast<int>(Command::StoreVersion));
+    CHECK(board.answer(device, listing(1)) == static_cast<int>(Command::ListCredentials));
+    run_until(device, done);
+    CHECK(done && count == 1);
+
+    // Same version and count: the copy
+    done = false;
+    directory.credentials(got);
+    CHECK(board.answer(device, {0, 7, 1}) == static_cast<int>(Command::StoreVersion));
+    run_until(device, done);
+    CHECK(done && count == 1);
+
+    // Same version after 256 changes, another count: listed again
+    done = false;
+    directory.credentials(got);
+    CHECK(board.answer(device, {0, 7, 2}) == static_cast<int>(Command::StoreVersion));
+    CHECK(board.answer(device, listing(2)) == static_cast<int>(Command::ListCredentials));
+    run_until(device, done);
+    CHECK(done && count == 2);
+
+    // Another version: listed again
+    done = false;
+    directory.credentials(got);
+    CHECK(board.answer(device, {0, 8, 2}) == static_cast<int>(Command::StoreVersion));
+    CHECK(board.answer(device, listing(2)) == static_cast<int>(Command::ListCredentials));
+    run_until(device, done);
+    CHECK(done && count == 2);
+
+    // Dropped copy: listed again
+    done = false;
+    directory.invalidate();
+    directory.credentials(got);
+    CHECK(board.answer(device, {0, 8, 2}) == static_cast<int>(Command::StoreVersion));
+    CHECK(board.answer(device, listing(2)) == static_cast<int>(Command::ListCredentials));
+    run_until(device, done);
+    CHECK(done && count == 2);
+    CHECK(device.pending() == 0);
+}
+
+// A firmware without StoreVersion is listed every time
+void test_unversioned() {
+    FakeBoard board;
+    Device device(board.path());
+    CredentialDirectory directory(device);
+
+    for (int i = 0; i < 2; i++) {
+        bool done = false;
+
+        directory.credentials([&done](const ListResult &result) {
+            CHECK(result.credentials.size() == 1);
+            done = true;
+        });
+        CHECK(board.answer(device, {static_cast<uint8_t>(Status::CommandUnknown)}) ==
+              static_cast<int>(Command::StoreVersion));
+        CHECK(board.answer(device, listing(1)) == static_cast<int>(Command::ListCredentials));
+        run_until(device, done);
+        CHECK(done);
+    }
+}
+
+} // namespace
+
+int main() {
+    test_revalidation();
+    test_unversioned();
+    return TEST_RESULT();
+}
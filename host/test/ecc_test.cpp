@@ -0,0 +1,204 @@
+// Unit tests of micro-ecc as the firmware builds it (secp160r1, and the secp256r1 copy): keys,
+// deterministic signatures and point compression. The library carries no uECC_verify(), so the
+// expected keys and signatures below were checked once with an independent implementation of the
+// curve arithmetic (Q = d.G, and the ECDSA verification equation on SHA-256("abc")).
+
+#include "../../ecc/uECC.h"
+#include "../../ecc/uECC_secp256r1.h"
+#include "test.h"
+
+extern "C" {
+#include "../../sha256.h"
+}
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+uint8_t rng_seed;
+
+// Deterministic "RNG": the keys it gives are reproducible
+int test_rng(uint8_t *dest, unsigned size) {
+    for (unsigned i = 0; i < size; i++) {
+        dest[i] = rng_seed += 37;
+    }
+    return 1;
+}
+
+int other_rng(uint8_t *dest, unsigned size) {
+    std::memset(dest, 0x5a, size);
+    return 1;
+}
+
+std::vector<uint8_t> from_hex(const std::string &hex) {
+    std::vector<uint8_t> bytes;
+
+    for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+        bytes.push_back(static_cast<uint8_t>(std::stoul(hex.substr(i, 2), nullptr, 16)));
+    }
+    return bytes;
+}
+
+bool equal(const uint8_t *bytes, const std::string &hex) {
+    std::vector<uint8_t> expected = from_hex(hex);
+    return std::memcmp(bytes, expected.data(), expected.size()) == 0;
+}
+
+// Same hash context as sign_deterministic() in uart.c
+struct SHA256_HashContext {
+    uECC_HashContext uECC;
+    SHA256_CTX ctx;
+};
+
+void init_SHA256(uECC_HashContext *base) {
+    sha256_init(&reinterpret_cast<SHA256_HashContext *>(base)->ctx);
+}
+
+void update_SHA256(uECC_HashContext *base, const uint8_t *message, unsigned message_size) {
+    sha256_update(&reinterpret_cast<SHA256_HashContext *>(base)->ctx, message, message_size);
+}
+
+void finish_SHA256(uECC_HashContext *base, uint8_t *hash_result) {
+    sha256_final(&reinterpret_cast<SHA256_HashContext *>(base)->ctx, hash_result);
+}
+
+class HashContext {
+public:
+    HashContext() : context_{{&init_SHA256, &update_SHA256, &finish_SHA256, SHA256_BLOCK_SIZE, SHA256_DIGEST_SIZE, tmp_}, {}} {}
+    uECC_HashContext *get() { return &context_.uECC; }
+
+private:
+    uint8_t tmp_[2 * SHA256_DIGEST_SIZE + SHA256_BLOCK_SIZE];
+    SHA256_HashContext context_;
+};
+
+const std::string PRIVATE_160 = "e5c09b76512c07e2bd98734e2904dfba95704b26";
+const std::string PUBLIC_160 = "0554dbf92afbf25c9116a044cbf5e66dba6f94cd"
+                               "9dcfbedf87ebdea5293fefee7671796cc1049ae3";
+const std::string SIGNATURE_160 = "855bd1c5861380abdf779f2b3ab0e609f0ca0955"
+                                  "b9a70602458f7ed8a09350225cfb765f718dff2b";
+const std::string PRIVATE_256 = "a17c57320de8c39e79542f0ae5c09b76512c07e2bd98734e2904dfba95704b26";
+const std::string PUBLIC_256 = "50c26de8ee675b3314b8aeb4f0938ce283799a4c7387fb5579d63ece241d77fe"
+                               "45350f529d8b8fd732a9b2ad704f84cf36e3f78e4a34942540db2c2d527c65b4";
+const std::string SIGNATURE_256 = "d07bd2130ad2e515c33c6ef9a6ed04f93e5a80682170c06a0ad710029fdf602e"
+                                  "f85ce10e3a5a76811d4a708f221635857d6592156313270c8f12789f92eb76df";
+
+uint64_t scratch[(uECC_secp256r1_SCRATCH_SIZE + 7) / 8];
+
+void digest_abc(uint8_t hash[SHA256_DIGEST_SIZE]) {
+    SHA256_CTX ctx;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, reinterpret_cast<const uint8_t *>("abc"), 3);
+    sha256_final(&ctx, hash);
+}
+
+// Key pairs drawn from a known RNG output
+void test_make_key() {
+    uint8_t public_key[2 * uECC_secp256r1_BYTES];
+    uint8_t private_key[uECC_secp256r1_BYTES];
+
+    rng_seed = 1;
+    CHECK(uECC_make_key(public_key, private_key) == 1);
+    CHECK(equal(private_key, PRIVATE_160));
+    CHECK(equal(public_key, PUBLIC_160));
+
+    rng_seed = 1;
+    CHECK(uECC_secp256r1_make_key(public_key, private_key) == 1);
+    CHECK(equal(private_key, PRIVATE_256));
+    CHECK(equal(public_key, PUBLIC_256));
+}
+
+// RFC 6979 style signatures: known answers, and the same result whatever the blinding RNG draws
+void test_sign_deterministic() {
+    HashContext context;
+    std::vector<uint8_t> private_160 = from_hex(PRIVATE_160);
+    std::vector<uint8_t> private_256 = from_hex(PRIVATE_256);
+    uint8_t hash[SHA256_DIGEST_SIZE];
+    uint8_t signature[2 * uECC_secp256r1_BYTES];
+    uint8_t again[2 * uECC_secp256r1_BYTES];
+
+    digest_abc(hash);
+    CHECK(uECC_sign_deterministic(private_160.data(), hash, context.get(), signature) == 1);
+    CHECK(equal(signature, SIGNATURE_160));
+    CHECK(uECC_secp256r1_sign_deterministic(private_256.data(), hash, context.get(), signature) == 1);
+    CHECK(equal(signature, SIGNATURE_256));
+
+    uECC_set_rng(&other_rng);
+    uECC_secp256r1_set_rng(&other_rng);
+    CHECK(uECC_sign_deterministic(private_160.data(), hash, context.get(), again) == 1);
+    CHECK(equal(again, SIGNATURE_160));
+    CHECK(uECC_secp256r1_sign_deterministic(private_256.data(), hash, context.get(), again) == 1);
+    CHECK(equal(again, SIGNATURE_256));
+    uECC_set_rng(&test_rng);
+    uECC_secp256r1_set_rng(&test_rng);
+
+    hash[0] ^= 1; // Another message, another signature
+    CHECK(uECC_sign_deterministic(private_160.data(), hash, context.get(), again) == 1);
+    CHECK(std::memcmp(again, signature, 2 * uECC_BYTES) != 0);
+    CHECK(uECC_secp256r1_sign_deterministic(private_256.data(), hash, context.get(), again) == 1);
+    CHECK(!equal(again, SIGNATURE_256));
+}
+
+// Compressed keys carry the parity of y, and decompress back to the full key
+void test_compress() {
+    std::vector<uint8_t> public_160 = from_hex(PUBLIC_160);
+    std::vector<uint8_t> public_256 = from_hex(PUBLIC_256);
+    uint8_t compressed[uECC_secp256r1_BYTES + 1];
+    uint8_t public_key[2 * uECC_secp256r1_BYTES];
+    uint8_t private_key[uECC_secp256r1_BYTES];
+
+    uECC_compress(public_160.data(), compressed);
+    CHECK(compressed[0] == 0x03 && equal(compressed + 1, PUBLIC_160.substr(0, 2 * uECC_BYTES)));
+    uECC_decompress(compressed, public_key);
+    CHECK(equal(public_key, PUBLIC_160));
+
+    uECC_secp256r1_compress(public_256.data(), compressed);
+    CHECK(compressed[0] == 0x02 && equal(compressed + 1, PUBLIC_256.substr(0, 2 * uECC_secp256r1_BYTES)));
+    uECC_secp256r1_decompress(compressed, public_key);
+    CHECK(equal(public_key, PUBLIC_256));
+
+    // Both parities, on fresh keys
+    for (int i = 0; i < 16; i++) {
+        uint8_t decompressed[2 * uECC_secp256r1_BYTES];
+
+        CHECK(uECC_make_key(public_key, private_key) == 1);
+        uECC_compress(public_key, compressed);
+        uECC_decompress(compressed, decompressed);
+        CHECK(std::memcmp(decompressed, public_key, 2 * uECC_BYTES) == 0);
+
+        CHECK(uECC_secp256r1_make_key(public_key, private_key) == 1);
+        uECC_secp256r1_compress(public_key, compressed);
+        uECC_secp256r1_decompress(compressed, decompressed);
+        CHECK(std::memcmp(decompressed, public_key, 2 * uECC_secp256r1_BYTES) == 0);
+    }
+}
+
+// An arena smaller than uECC_SCRATCH_SIZE is refused, and every function fails until a large one is set
+void test_scratch() {
+    uint8_t public_key[2 * uECC_BYTES];
+    uint8_t private_key[uECC_BYTES];
+
+    CHECK(uECC_set_scratch(scratch, uECC_SCRATCH_SIZE - 1) == 0);
+    CHECK(uECC_make_key(public_key, private_key) == 0);
+    CHECK(uECC_set_scratch(scratch, sizeof(scratch)) == 1);
+    CHECK(uECC_make_key(public_key, private_key) == 1);
+    CHECK(uECC_scratch_peak() <= uECC_SCRATCH_SIZE);
+}
+
+} // namespace
+
+int main() {
+    CHECK(uECC_set_scratch(scratch, sizeof(scratch)) == 1);
+    CHECK(uECC_secp256r1_set_scratch(scratch, sizeof(scratch)) == 1);
+    uECC_set_rng(&test_rng);
+    uECC_secp256r1_set_rng(&test_rng);
+
+    test_make_key();
+    test_sign_deterministic();
+    test_compress();
+    test_scratch();
+    return TEST_RESULT();
+}
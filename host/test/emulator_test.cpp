@@ -0,0 +1,215 @@
+// Unit tests of the host build of the firmware (farm/firmware.c), which the farm, the emulator,
+// the recorder and the bench answer with: request and response framing of each command, as the
+// board sends it, and the line time the virtual clock gives to the frames.
+
+#include "../farm/firmware.h"
+#include "test.h"
+
+extern "C" {
+#include "../../sha256.h"
+}
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const uint8_t LIST_CREDENTIALS = 0;
+const uint8_t MAKE_CREDENTIAL = 1;
+const uint8_t GET_ASSERTION = 2;
+const uint8_t GET_ASSERTION_RAW = 4;
+const uint8_t MAKE_CREDENTIAL_COMPRESSED = 5;
+const uint8_t MAKE_CREDENTIAL_SECP256R1 = 7;
+const uint8_t DELETE_CREDENTIAL = 12;
+const uint8_t STORE_VERSION = 16;
+
+const uint8_t STATUS_OK = 0;
+const uint8_t STATUS_ERR_COMMAND_UNKNOWN = 1;
+const uint8_t STATUS_ERR_NOT_FOUND = 4;
+const uint8_t STATUS_ERR_APPROVAL = 6;
+
+const size_t APP_ID_SIZE = 20;
+const size_t CLIENT_DATA_SIZE = 20;
+const size_t CREDENTIAL_ID_SIZE = 16;
+const size_t COUNTER_SIZE = 4;
+
+class Emulated {
+public:
+    explicit Emulated(FirmwareApproval approval) : device_(firmware_device_new(approval)) {}
+    ~Emulated() { firmware_device_free(device_); }
+
+    std::vector<uint8_t> transact(const std::vector<uint8_t> &request, FirmwareLatency *latency = nullptr) {
+        std::vector<uint8_t> response(FIRMWARE_MAX_RESPONSE_SIZE);
+
+        response.resize(firmware_transact_timed(device_, request.data(), request.size(), response.data(),
+                                                response.size(), latency));
+        return response;
+    }
+
+private:
+    FirmwareDevice *device_;
+};
+
+std::vector<uint8_t> frame(uint8_t command, uint8_t app, size_t client_data_size = 0) {
+    std::vector<uint8_t> request = {command};
+
+    request.insert(request.end(), APP_ID_SIZE, app);
+    request.insert(request.end(), client_data_size, 0x77);
+    return request;
+}
+
+uint32_t counter_of(const std::vector<uint8_t> &response) {
+    size_t end = response.size();
+
+    return (uint32_t)response[end - 4] << 24 | (uint32_t)response[end - 3] << 16 |
+           (uint32_t)response[end - 2] << 8 | response[end - 1];
+}
+
+// Response sizes of the credential and assertion commands, for each curve and key format
+void test_sizes() {
+    Emulated board(FIRMWARE_APPROVE);
+    std::vector<uint8_t> response;
+
+    response = board.transact(frame(MAKE_CREDENTIAL, 1));
+    CHECK(response.size() == 1 + CREDENTIAL_ID_SIZE + 40 && response[0] == STATUS_OK);
+    response = board.transact(frame(MAKE_CREDENTIAL_COMPRESSED, 2));
+    CHECK(response.size() == 1 + CREDENTIAL_ID_SIZE + 21 && response[0] == STATUS_OK);
+    CHECK(response[1 + CREDENTIAL_ID_SIZE] == 0x02 || response[1 + CREDENTIAL_ID_SIZE] == 0x03);
+    response = board.transact(frame(MAKE_CREDENTIAL_SECP256R1, 3));
+    CHECK(response.size() == 1 + CREDENTIAL_ID_SIZE + 64 && response[0] == STATUS_OK);
+
+    response = board.transact(frame(GET_ASSERTION, 1, CLIENT_DATA_SIZE));
+    CHECK(response.size() == 1 + CREDENTIAL_ID_SIZE + 40 + COUNTER_SIZE && response[0] == STATUS_OK);
+    response = board.transact(frame(GET_ASSERTION, 3, CLIENT_DATA_SIZE));
+    CHECK(response.size() == 1 + CREDENTIAL_ID_SIZE + 64 + COUNTER_SIZE && response[0] == STATUS_OK);
+
+    CHECK(board.transact(frame(GET_ASSERTION, 9, CLIENT_DATA_SIZE)) == std::vector<uint8_t>{STATUS_ERR_NOT_FOUND});
+    CHECK(board.transact({0xEE}) == std::vector<uint8_t>{STATUS_ERR_COMMAND_UNKNOWN});
+}
+
+// The listing, the store version and a delete agree with the credentials made
+void test_store_commands() {
+    Emulated board(FIRMWARE_APPROVE);
+    std::vector<uint8_t> made[2];
+    std::vector<uint8_t> response;
+
+    for (uint8_t i = 0; i < 2; i++) {
+        made[i] = board.transact(frame(MAKE_CREDENTIAL, 0x40 + i));
+    }
+
+    response = board.transact({LIST_CREDENTIALS});
+    CHECK(response.size() == 2 + 2 * (CREDENTIAL_ID_SIZE + APP_ID_SIZE));
+    CHECK(response[0] == STATUS_OK && response[1] == 2);
+    for (size_t i = 0; i < 2 && response.size() == 2 + 2 * (CREDENTIAL_ID_SIZE + APP_ID_SIZE); i++) {
+        const uint8_t *entry = &response[2 + i * (CREDENTIAL_ID_SIZE + APP_ID_SIZE)];
+        size_t app = entry[CREDENTIAL_ID_SIZE] - 0x40;
+
+        CHECK(app < 2 && std::memcmp(entry, &made[app][1], CREDENTIAL_ID_SIZE) == 0);
+    }
+
+    response = board.transact({STORE_VERSION});
+    CHECK(response.size() == 3 && response[0] == STATUS_OK && response[2] == 2);
+    uint8_t version = response[1];
+
+    std::vector<uint8_t> request = {DELETE_CREDENTIAL};
+    request.insert(request.end(), made[0].begin() + 1, made[0].begin() + 1 + CREDENTIAL_ID_SIZE);
+    CHECK(board.transact(request) == std::vector<uint8_t>{STATUS_OK});
+    CHECK(board.transact(request) == std::vector<uint8_t>{STATUS_ERR_NOT_FOUND});
+    CHECK(board.transact(frame(GET_ASSERTION, 0x40, CLIENT_DATA_SIZE)) == std::vector<uint8_t>{STATUS_ERR_NOT_FOUND});
+
+    response = board.transact({STORE_VERSION});
+    CHECK(response.size() == 3 && response[1] != version && response[2] == 1);
+    response = board.transact({LIST_CREDENTIALS});
+    CHECK(response.size() == 2 + CREDENTIAL_ID_SIZE + APP_ID_SIZE && response[1] == 1);
+}
+
+// Incomplete and oversized frames are not answered, and leave the store as it was
+void test_incomplete_frames() {
+    Emulated board(FIRMWARE_APPROVE);
+    std::vector<uint8_t> request = frame(MAKE_CREDENTIAL, 1);
+
+    request.pop_back();
+    CHECK(board.transact(request).empty());
+    CHECK(board.transact(frame(GET_ASSERTION, 1, CLIENT_DATA_SIZE - 1)).empty());
+    CHECK(board.transact(std::vector<uint8_t>(FIRMWARE_MAX_REQUEST_SIZE + 1, LIST_CREDENTIALS)).empty());
+    CHECK(board.transact({LIST_CREDENTIALS}) == (std::vector<uint8_t>{STATUS_OK, 0}));
+}
+
+// The signature counter goes up with each assertion; a refused approval answers one status byte
+void test_counter_and_approval() {
+    Emulated board(FIRMWARE_APPROVE);
+    Emulated refusing(FIRMWARE_REFUSE);
+    uint32_t previous = 0;
+
+    board.transact(frame(MAKE_CREDENTIAL, 1));
+    for (int i = 0; i < 70; i++) { // Past COUNTER_STEP, so a new limit is reserved
+        std::vector<uint8_t> response = board.transact(frame(GET_ASSERTION, 1, CLIENT_DATA_SIZE));
+
+        CHECK(response.size() == 1 + CREDENTIAL_ID_SIZE + 40 + COUNTER_SIZE);
+        CHECK(counter_of(response) > previous);
+        previous = counter_of(response);
+    }
+
+    CHECK(refusing.transact(frame(MAKE_CREDENTIAL, 1)) == std::vector<uint8_t>{STATUS_ERR_APPROVAL});
+}
+
+// GetAssertionRaw signs the leftmost 20 bytes of the SHA-256 of the data, as GetAssertion would
+void test_get_assertion_raw() {
+    Emulated board(FIRMWARE_APPROVE);
+    std::vector<uint8_t> data(37); // authenticatorData
+    std::vector<uint8_t> request = frame(GET_ASSERTION_RAW, 1);
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    SHA256_CTX ctx;
+
+    for (size_t i = 0; i < data.size(); i++) {
+        data[i] = static_cast<uint8_t>(3 * i);
+    }
+    request.push_back(0);
+    request.push_back(static_cast<uint8_t>(data.size()));
+    request.insert(request.end(), data.begin(), data.end());
+    sha256_init(&ctx);
+    sha256_update(&ctx, data.data(), data.size());
+    sha256_final(&ctx, digest);
+
+    std::vector<uint8_t> hashed = frame(GET_ASSERTION, 1);
+    hashed.insert(hashed.end(), digest, digest + CLIENT_DATA_SIZE);
+
+    board.transact(frame(MAKE_CREDENTIAL, 1));
+    std::vector<uint8_t> raw = board.transact(request);
+    std::vector<uint8_t> reference = board.transact(hashed);
+    CHECK(raw.size() == reference.size() && raw.size() == 1 + CREDENTIAL_ID_SIZE + 40 + COUNTER_SIZE);
+    CHECK(raw.size() == reference.size() && std::equal(raw.begin(), raw.end() - COUNTER_SIZE, reference.begin()));
+    CHECK(counter_of(reference) > counter_of(raw));
+}
+
+// Frames take 10 bits per byte on the line, at the rate of the board
+void test_line_time() {
+    Emulated board(FIRMWARE_APPROVE);
+    FirmwareLatency latency;
+    const uint64_t byte_ns = 10 * 1000000000ULL / FIRMWARE_TIMING_DEFAULT.baud;
+    std::vector<uint8_t> response;
+
+    response = board.transact(frame(MAKE_CREDENTIAL, 1), &latency);
+    CHECK(latency.request_us == 21 * byte_ns / 1000);
+    CHECK(latency.processing_us > 0);
+    CHECK(latency.response_us >= response.size() * byte_ns / 1000);
+
+    response = board.transact({LIST_CREDENTIALS}, &latency);
+    CHECK(latency.request_us == byte_ns / 1000);
+    CHECK(latency.approval_us == 0);
+    CHECK(latency.response_us >= response.size() * byte_ns / 1000);
+}
+
+} // namespace
+
+int main() {
+    firmware_thread_init();
+
+    test_sizes();
+    test_store_commands();
+    test_incomplete_frames();
+    test_counter_and_approval();
+    test_get_assertion_raw();
+    test_line_time();
+    return TEST_RESULT();
+}
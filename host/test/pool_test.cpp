@@ -0,0 +1,98 @@
+// Unit tests of DevicePool: sharding, and requests to a port that cannot be opened or fails.
+
+#include "../pool.h"
+#include "test.h"
+
+#include <set>
+
+#include <unistd.h>
+
+using namespace authenticator;
+
+namespace {
+
+AppId app_id_of(uint32_t n) {
+    AppId app_id{};
+
+    for (size_t i = 0; i < app_id.size(); i++) {
+        app_id[i] = static_cast<uint8_t>((n * 2654435761u) >> (8 * (i % 4))) ^ static_cast<uint8_t>(i);
+    }
+    return app_id;
+}
+
+// The shard of an app ID depends on the paths only, and adding a port moves about 1/n of them
+void test_shard() {
+    DevicePool four({"/nonexistent/a", "/nonexistent/b", "/nonexistent/c", "/nonexistent/d"});
+    DevicePool reordered({"/nonexistent/d", "/nonexistent/c", "/nonexistent/b", "/nonexistent/a"});
+    DevicePool five({"/nonexistent/a", "/nonexistent/b", "/nonexistent/c", "/nonexistent/d", "/nonexistent/e"});
+    std::set<size_t> used;
+    size_t moved = 0;
+    const size_t count = 10000;
+
+    for (uint32_t n = 0; n < count; n++) {
+        AppId app_id = app_id_of(n);
+        size_t shard = four.shard(app_id);
+
+        used.insert(shard);
+        CHECK(reordered.shard(app_id) == 3 - shard);
+        if (five.shard(app_id) != shard) {
+            CHECK(five.shard(app_id) == 4); // Only to the new port
+            moved++;
+        }
+    }
+    CHECK(used.size() == 4);
+    CHECK(moved > count / 10 && moved < count * 3 / 10);
+}
+
+// A port that cannot be opened fails its requests with Error::Io, and the pool keeps running
+void test_unopenable_port() {
+    DevicePool pool({"/nonexistent/a"});
+    int calls = 0;
+
+    for (int i = 0; i < 2; i++) {
+        pool.get_assertion(app_id_of(i), ClientData{}, Curve::Secp160r1, [&calls](const AssertionResult &result) {
+            CHECK(result.error == Error::Io);
+            calls++;
+        });
+        pool.run_once(std::chrono::milliseconds(0));
+        pool.run_once(std::chrono::milliseconds(0));
+    }
+    CHECK(calls == 2);
+    CHECK(pool.stats()[0].failed == 2);
+    CHECK(!pool.stats()[0].healthy);
+}
+
+// A port closed by the board fails the request in flight and the held ones, then is retried
+void test_closed_port() {
+    std::string path;
+    int master = open_pseudo_terminal(path);
+    DevicePool pool({path});
+    int calls = 0;
+
+    for (int i = 0; i < 3; i++) {
+        pool.make_credential(app_id_of(i), Curve::Secp160r1, false, [&calls](const MakeCredentialResult &result) {
+            CHECK(result.error == Error::Io);
+            calls++;
+        });
+    }
+    CHECK(pool.stats()[0].queue_depth == 3); // Held until the board has booted
+    ::close(master);
+
+    auto deadline = std::chrono::steady_clock::now() + DevicePool::BOOT_DELAY + std::chrono::seconds(2);
+    while (calls < 3 && std::chrono::steady_clock::now() < deadline) {
+        pool.run_once(std::chrono::milliseconds(100));
+    }
+    CHECK(calls == 3);
+    CHECK(pool.stats()[0].failed == 3);
+    pool.run_once(DevicePool::REOPEN_DELAY); // Reopening the vanished pty fails again, quietly
+    CHECK(!pool.stats()[0].healthy);
+}
+
+} // namespace
+
+int main() {
+    test_shard();
+    test_unopenable_port();
+    test_closed_port();
+    return TEST_RESULT();
+}
@@ -0,0 +1,135 @@
+// Unit tests of the SHA-256 and HMAC-SHA256 engine of the firmware (sha256.c): FIPS 180-4 and
+// RFC 4231 vectors, updates split at any offset, and HMAC contexts copied after hmac_sha256_init().
+
+#include "test.h"
+
+extern "C" {
+#include "../../sha256.h"
+}
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string to_hex(const uint8_t *bytes, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+
+    for (size_t i = 0; i < size; i++) {
+        hex += digits[bytes[i] >> 4];
+        hex += digits[bytes[i] & 0x0f];
+    }
+    return hex;
+}
+
+const uint8_t *bytes_of(const std::string &text) {
+    return reinterpret_cast<const uint8_t *>(text.data());
+}
+
+std::string sha256(const std::string &message) {
+    SHA256_CTX ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, bytes_of(message), message.size());
+    sha256_final(&ctx, digest);
+    return to_hex(digest, sizeof(digest));
+}
+
+std::string hmac_sha256(const std::string &key, const std::string &message) {
+    HMAC_SHA256_CTX hmac;
+    uint8_t mac[SHA256_DIGEST_SIZE];
+
+    hmac_sha256_init(&hmac, bytes_of(key), key.size());
+    hmac_sha256_update(&hmac, bytes_of(message), message.size());
+    hmac_sha256_final(&hmac, mac);
+    return to_hex(mac, sizeof(mac));
+}
+
+// FIPS 180-4 examples
+void test_sha256_vectors() {
+    SHA256_CTX ctx;
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    std::string thousand(1000, 'a');
+
+    CHECK(sha256("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    CHECK(sha256("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    CHECK(sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    // One million 'a': more than 16 bits of length, in updates of the size the firmware accepts
+    sha256_init(&ctx);
+    for (int i = 0; i < 1000; i++) {
+        sha256_update(&ctx, bytes_of(thousand), thousand.size());
+    }
+    sha256_final(&ctx, digest);
+    CHECK(to_hex(digest, sizeof(digest)) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+// Bytes hashed as they arrive (GetAssertionRaw) give the digest of the whole message
+void test_sha256_split() {
+    std::vector<uint8_t> message(200);
+
+    for (size_t i = 0; i < message.size(); i++) {
+        message[i] = static_cast<uint8_t>(i);
+    }
+    for (size_t split = 0; split <= message.size(); split++) {
+        SHA256_CTX ctx;
+        uint8_t digest[SHA256_DIGEST_SIZE];
+
+        sha256_init(&ctx);
+        sha256_update(&ctx, message.data(), split);
+        for (size_t i = split; i < message.size(); i++) {
+            sha256_update(&ctx, &message[i], 1);
+        }
+        sha256_final(&ctx, digest);
+        CHECK(to_hex(digest, sizeof(digest)) == "1901da1c9f699b48f6b2636e65cbf73abf99d0441ef67f5c540a42f7051dec6f");
+    }
+}
+
+// RFC 4231 test cases 1, 2, 6 and 7 (keys shorter and longer than a block)
+void test_hmac_vectors() {
+    std::string long_key(131, '\xaa');
+
+    CHECK(hmac_sha256(std::string(20, '\x0b'), "Hi There") ==
+          "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7");
+    CHECK(hmac_sha256("Jefe", "what do ya want for nothing?") ==
+          "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843");
+    CHECK(hmac_sha256(long_key, "Test Using Larger Than Block-Size Key - Hash Key First") ==
+          "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54");
+    CHECK(hmac_sha256(long_key, "This is a test using a larger than block-size key and a larger than block-size data. "
+                                "The key needs to be hashed before being used by the HMAC algorithm.") ==
+          "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2");
+}
+
+// A context copied after hmac_sha256_init() authenticates several messages under the same key
+void test_hmac_copied_context() {
+    HMAC_SHA256_CTX keyed;
+    const std::string messages[] = {"what do ya want for nothing?", "Hi There"};
+    const char *expected[] = {"5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+                              "6bfb115ca30df3be0dfdffe79a51cbee88186db55acc287af148d7ff6220f92e"};
+
+    hmac_sha256_init(&keyed, bytes_of("Jefe"), 4);
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 2; i++) {
+            HMAC_SHA256_CTX hmac = keyed;
+            uint8_t mac[SHA256_DIGEST_SIZE];
+
+            hmac_sha256_update(&hmac, bytes_of(messages[i]), messages[i].size());
+            hmac_sha256_final(&hmac, mac);
+            CHECK(to_hex(mac, sizeof(mac)) == expected[i]);
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    test_sha256_vectors();
+    test_sha256_split();
+    test_hmac_vectors();
+    test_hmac_copied_context();
+    return TEST_RESULT();
+}
@@ -0,0 +1,25 @@
+#ifndef HOST_TEST_TEST_H
+#define HOST_TEST_TEST_H
+
+// Checks of the unit tests of host/ (make test). A failed check is printed and counted, and the
+// test program returns the number of failures.
+
+#include <cstdio>
+
+namespace test {
+
+inline int failures = 0;
+
+} // namespace test
+
+#define CHECK(condition)                                                              \
+    do {                                                                              \
+        if (!(condition)) {                                                           \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            test::failures++;                                                         \
+        }                                                                             \
+    } while (0)
+
+#define TEST_RESULT() (test::failures == 0 ? 0 : 1)
+
+#endif
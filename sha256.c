@@ -0,0 +1,245 @@
+#include "sha256.h"
+
+#include <avr/pgmspace.h>
+#include <string.h>
+
+#if defined(__AVR__)
+/* avr-gcc expands 32-bit rotations by anything other than a multiple of 8 into bit-shift
+   loops. Rotations are instead split into a free byte permutation and at most 3 single-bit
+   rotations done with the carry flag. */
+static inline uint32_t rotr1(uint32_t x) {
+    __asm__ (
+        "bst %A0, 0 \n\t"
+        "lsr %D0 \n\t"
+        "ror %C0 \n\t"
+        "ror %B0 \n\t"
+        "ror %A0 \n\t"
+        "bld %D0, 7 \n\t"
+        : "+r" (x)
+    );
+    return x;
+}
+
+static inline uint32_t rotl1(uint32_t x) {
+    __asm__ (
+        "lsl %A0 \n\t"
+        "rol %B0 \n\t"
+        "rol %C0 \n\t"
+        "rol %D0 \n\t"
+        "adc %A0, __zero_reg__ \n\t"
+        : "+r" (x)
+    );
+    return x;
+}
+#else
+static inline uint32_t rotr1(uint32_t x) {
+    return (x >> 1) | (x << 31);
+}
+
+static inline uint32_t rotl1(uint32_t x) {
+    return (x << 1) | (x >> 31);
+}
+#endif
+
+#define ROTR8(x) (((x) >> 8) | ((x) << 24))
+#define ROTR16(x) (((x) >> 16) | ((x) << 16))
+#define ROTR24(x) (((x) >> 24) | ((x) << 8))
+
+static inline uint32_t rotr2(uint32_t x) { return rotr1(rotr1(x)); }
+static inline uint32_t rotr6(uint32_t x) { return rotl1(rotl1(ROTR8(x))); }
+static inline uint32_t rotr7(uint32_t x) { return rotl1(ROTR8(x)); }
+static inline uint32_t rotr11(uint32_t x) { return rotr1(rotr1(rotr1(ROTR8(x)))); }
+static inline uint32_t rotr13(uint32_t x) { return rotl1(rotl1(rotl1(ROTR16(x)))); }
+static inline uint32_t rotr17(uint32_t x) { return rotr1(ROTR16(x)); }
+static inline uint32_t rotr18(uint32_t x) { return rotr1(rotr1(ROTR16(x))); }
+static inline uint32_t rotr19(uint32_t x) { return rotr1(rotr1(rotr1(ROTR16(x)))); }
+static inline uint32_t rotr22(uint32_t x) { return rotl1(rotl1(ROTR24(x))); }
+static inline uint32_t rotr25(uint32_t x) { return rotr1(ROTR24(x)); }
+
+#define CH(x, y, z) (((x) & (y)) ^ (~(x) & (z)))
+#define MAJ(x, y, z) (((x) & (y)) | ((z) & ((x) | (y))))
+#define BSIG0(x) (rotr2(x) ^ rotr13(x) ^ rotr22(x))
+#define BSIG1(x) (rotr6(x) ^ rotr11(x) ^ rotr25(x))
+#define SSIG0(x) (rotr7(x) ^ rotr18(x) ^ ((x) >> 3))
+#define SSIG1(x) (rotr17(x) ^ rotr19(x) ^ ((x) >> 10))
+
+// Round constants, kept in flash to save 256 bytes of RAM
+static const uint32_t K[64] PROGMEM = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/**
+ * @brief Compresses the 64-byte block held in the context buffer into the hash state.
+ *        The message schedule is kept in a 16-word circular window instead of 64 words.
+ *
+ * @param ctx Pointer to the SHA-256 context.
+ * @return None.
+ */
+static void sha256_compress(SHA256_CTX *ctx) {
+    uint32_t w[16];
+    uint32_t a, b, c, d, e, f, g, h, t1, t2;
+    uint8_t i;
+
+    for (i = 0; i < 16; i++) {
+        const uint8_t *p = &ctx->buffer[i << 2];
+        w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+
+    a = ctx->state[0]; b = ctx->state[1]; c = ctx->state[2]; d = ctx->state[3];
+    e = ctx->state[4]; f = ctx->state[5]; g = ctx->state[6]; h = ctx->state[7];
+
+    for (i = 0; i < 64; i++) {
+        if (i >= 16) {
+            // w[i] = s1(w[i-2]) + w[i-7] + s0(w[i-15]) + w[i-16], computed in place
+            w[i & 15] += SSIG1(w[(i - 2) & 15]) + w[(i - 7) & 15] + SSIG0(w[(i - 15) & 15]);
+        }
+        t1 = h + BSIG1(e) + CH(e, f, g) + pgm_read_dword(&K[i]) + w[i & 15];
+        t2 = BSIG0(a) + MAJ(a, b, c);
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+
+    ctx->state[0] += a; ctx->state[1] += b; ctx->state[2] += c; ctx->state[3] += d;
+    ctx->state[4] += e; ctx->state[5] += f; ctx->state[6] += g; ctx->state[7] += h;
+}
+
+/**
+ * @brief Initializes a SHA-256 context with the standard initial hash value.
+ *
+ * @param ctx Pointer to the SHA-256 context.
+ * @return None.
+ */
+void sha256_init(SHA256_CTX *ctx) {
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->length = 0;
+}
+
+/**
+ * @brief Feeds data into a SHA-256 computation.
+ *
+ * @param ctx Pointer to the SHA-256 context.
+ * @param data Pointer to the data to hash.
+ * @param size Number of bytes to hash.
+ * @return None.
+ */
+void sha256_update(SHA256_CTX *ctx, const uint8_t *data, uint16_t size) {
+    while (size--) {
+        ctx->buffer[ctx->length & (SHA256_BLOCK_SIZE - 1)] = *data++;
+        ctx->length++;
+        if ((ctx->length & (SHA256_BLOCK_SIZE - 1)) == 0) {
+            sha256_compress(ctx); // Block is full
+        }
+    }
+}
+
+/**
+ * @brief Pads the message, finishes the computation and writes the digest.
+ *
+ * @param ctx Pointer to the SHA-256 context.
+ * @param digest Pointer to the output buffer (32 bytes).
+ * @return None.
+ */
+void sha256_final(SHA256_CTX *ctx, uint8_t *digest) {
+    uint32_t bits = ctx->length << 3;
+    uint8_t used = ctx->length & (SHA256_BLOCK_SIZE - 1);
+    uint8_t i;
+
+    ctx->buffer[used++] = 0x80;
+    if (used > SHA256_BLOCK_SIZE - 8) {
+        memset(&ctx->buffer[used], 0, SHA256_BLOCK_SIZE - used);
+        sha256_compress(ctx); // No room left for the length
+        used = 0;
+    }
+    memset(&ctx->buffer[used], 0, SHA256_BLOCK_SIZE - 4 - used);
+    ctx->buffer[SHA256_BLOCK_SIZE - 4] = bits >> 24; // Message length in bits, big endian
+    ctx->buffer[SHA256_BLOCK_SIZE - 3] = bits >> 16;
+    ctx->buffer[SHA256_BLOCK_SIZE - 2] = bits >> 8;
+    ctx->buffer[SHA256_BLOCK_SIZE - 1] = bits;
+    sha256_compress(ctx);
+
+    for (i = 0; i < 8; i++) {
+        digest[(i << 2)] = ctx->state[i] >> 24;
+        digest[(i << 2) + 1] = ctx->state[i] >> 16;
+        digest[(i << 2) + 2] = ctx->state[i] >> 8;
+        digest[(i << 2) + 3] = ctx->state[i];
+    }
+}
+
+/**
+ * @brief Starts an HMAC-SHA256 computation. Keys longer than one block are hashed first.
+ *        Both padded keys are hashed here, so that a copy of the context can be reused.
+ *
+ * @param hmac Pointer to the HMAC context.
+ * @param key Pointer to the key.
+ * @param key_size Size of the key in bytes.
+ * @return None.
+ */
+void hmac_sha256_init(HMAC_SHA256_CTX *hmac, const uint8_t *key, uint16_t key_size) {
+    uint8_t padded[SHA256_BLOCK_SIZE];
+    uint8_t i;
+
+    memset(padded, 0, SHA256_BLOCK_SIZE);
+    if (key_size > SHA256_BLOCK_SIZE) {
+        sha256_init(&hmac->ctx);
+        sha256_update(&hmac->ctx, key, key_size);
+        sha256_final(&hmac->ctx, padded);
+    } else {
+        memcpy(padded, key, key_size);
+    }
+
+    for (i = 0; i < SHA256_BLOCK_SIZE; i++) {
+        padded[i] ^= 0x5c; // Outer pad
+    }
+    sha256_init(&hmac->ctx);
+    sha256_update(&hmac->ctx, padded, SHA256_BLOCK_SIZE);
+    memcpy(hmac->outer, hmac->ctx.state, sizeof(hmac->outer));
+
+    for (i = 0; i < SHA256_BLOCK_SIZE; i++) {
+        padded[i] ^= 0x5c ^ 0x36; // Outer pad to inner pad
+    }
+    sha256_init(&hmac->ctx);
+    sha256_update(&hmac->ctx, padded, SHA256_BLOCK_SIZE);
+    memset(padded, 0, SHA256_BLOCK_SIZE);
+}
+
+/**
+ * @brief Feeds data into an HMAC-SHA256 computation.
+ *
+ * @param hmac Pointer to the HMAC context.
+ * @param data Pointer to the data to authenticate.
+ * @param size Number of bytes.
+ * @return None.
+ */
+void hmac_sha256_update(HMAC_SHA256_CTX *hmac, const uint8_t *data, uint16_t size) {
+    sha256_update(&hmac->ctx, data, size);
+}
+
+/**
+ * @brief Finishes an HMAC-SHA256 computation and wipes the key state from the context.
+ *
+ * @param hmac Pointer to the HMAC context.
+ * @param mac Pointer to the output buffer (32 bytes).
+ * @return None.
+ */
+void hmac_sha256_final(HMAC_SHA256_CTX *hmac, uint8_t *mac) {
+    sha256_final(&hmac->ctx, mac);
+    memcpy(hmac->ctx.state, hmac->outer, sizeof(hmac->outer)); // Resume after the outer padded key
+    hmac->ctx.length = SHA256_BLOCK_SIZE;
+    sha256_update(&hmac->ctx, mac, SHA256_DIGEST_SIZE);
+    sha256_final(&hmac->ctx, mac);
+    memset(hmac, 0, sizeof(*hmac));
+}
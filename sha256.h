@@ -0,0 +1,45 @@
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+
+#define SHA256_BLOCK_SIZE 64 // SHA-256 processes 64-byte blocks
+#define SHA256_DIGEST_SIZE 32 // SHA-256 produces a 32-byte digest
+
+/**
+ * @brief Running state of a SHA-256 computation.
+ *
+ * Fields:
+ * - state: Intermediate hash value (8 words).
+ * - buffer: Partial block waiting to be compressed.
+ * - length: Total number of bytes hashed so far.
+ */
+typedef struct {
+    uint32_t state[8];
+    uint8_t buffer[SHA256_BLOCK_SIZE];
+    uint32_t length;
+} SHA256_CTX;
+
+/**
+ * @brief Running state of an HMAC-SHA256 computation. A context copied right after
+ *        hmac_sha256_init() authenticates another message under the same key, without
+ *        hashing the padded key again.
+ *
+ * Fields:
+ * - ctx: Underlying SHA-256 context, started with the key xored with the inner pad.
+ * - outer: SHA-256 state after the key xored with the outer pad.
+ */
+typedef struct {
+    SHA256_CTX ctx;
+    uint32_t outer[8];
+} HMAC_SHA256_CTX;
+
+void sha256_init(SHA256_CTX *ctx);
+void sha256_update(SHA256_CTX *ctx, const uint8_t *data, uint16_t size);
+void sha256_final(SHA256_CTX *ctx, uint8_t *digest);
+
+void hmac_sha256_init(HMAC_SHA256_CTX *hmac, const uint8_t *key, uint16_t key_size);
+void hmac_sha256_update(HMAC_SHA256_CTX *hmac, const uint8_t *data, uint16_t size);
+void hmac_sha256_final(HMAC_SHA256_CTX *hmac, uint8_t *mac);
+
+#endif
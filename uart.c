@@ -12,6 +12,25 @@
 #define COMMAND_MAKE_CREDENTIAL 1
 #define COMMAND_GET_ASSERTION 2
 #define COMMAND_RESET 3
+#define COMMAND_GET_ASSERTION_RAW 4
+#define COMMAND_MAKE_CREDENTIAL_COMPRESSED 5
+#define COMMAND_MEMORY_USAGE 6
+#define COMMAND_MAKE_CREDENTIAL_SECP256R1 7
+#define COMMAND_LIST_CREDENTIALS_FILTERED 8
+#define COMMAND_GET_ASSERTION_ALLOW_LIST 9
+#define COMMAND_MAKE_CREDENTIAL_USER 10
+#define COMMAND_GET_ASSERTION_USER 11
+#define COMMAND_DELETE_CREDENTIAL 12
+#define COMMAND_IMPORT_CREDENTIALS 13
+#define COMMAND_EXPORT_BACKUP 14
+#define COMMAND_IMPORT_BACKUP 15
+#define COMMAND_STORE_VERSION 16
+#define COMMAND_SET_BAUD_RATE 17
+
+// Filters of COMMAND_LIST_CREDENTIALS_FILTERED
+#define FILTER_NONE 0
+#define FILTER_APP_ID_PREFIX 1
+#define FILTER_CREDENTIAL_ID 2
 
 
 #define STATUS_OK 0
@@ -21,16 +40,60 @@
 #define STATUS_ERR_NOT_FOUND 4
 #define STATUS_ERR_STORAGE_FULL 5
 #define STATUS_ERR_APPROVAL 6
+#define STATUS_ERR_AUTHENTICATION 7
+
+// Curve tags stored with each credential
+#define CURVE_SECP160R1 0
+#define CURVE_SECP256R1 1
+#define CURVE_DELETED 0xFF // Tombstone of a deleted credential, until its slot is compacted
 
 #define SHA1_SIZE 20 // 20 bytes for the application ID
 #define PRIVATE_KEY_SIZE 21 // secp160r1 requires 21 bytes for the private key
 #define PUBLIC_KEY_SIZE 40 // secp160r1 requires 40 bytes for the public key
+#define COMPRESSED_PUBLIC_KEY_SIZE 21 // Parity byte (0x02 or 0x03) followed by the x coordinate
+#define P256_PRIVATE_KEY_SIZE 32 // secp256r1 requires 32 bytes for the private key
+#define P256_PUBLIC_KEY_SIZE 64 // secp256r1 requires 64 bytes for the public key (and the signature)
+#define PRIVATE_KEY_MAX_SIZE P256_PRIVATE_KEY_SIZE
 #define CREDENTIAL_ID_SIZE 16 // 128 bits for the credential ID
-#define EEPROM_MAX_ENTRIES 17 // Maximum entries that fit in 1024 bytes ~ 1024/(SHA1_SIZE+PRIVATE_KEY_SIZE+CREDENTIAL_ID_SIZE)
-
-volatile uint8_t state_button = 1;    // Button state (1 = released, 0 = pressed)
-volatile uint8_t count_button = 0;    // Counter for debounce stability
-volatile uint8_t pressed_button = 0;  // Flag for a confirmed button press  
+#define USER_HANDLE_SIZE 8 // Account identifier within an app ID (truncated CTAP user handle)
+#define IMPORT_RECORD_SIZE (SHA1_SIZE + CREDENTIAL_ID_SIZE + USER_HANDLE_SIZE + 1 + PRIVATE_KEY_MAX_SIZE)
+#define IMPORT_CHALLENGE_SIZE 16 // Random bytes covered by the MAC of an import, so that it cannot be replayed
+#define BACKUP_KEY_SIZE 32 // Backup key chosen by the user (e.g. derived from a passphrase by the client)
+#define BACKUP_NONCE_SIZE 16
+#define BACKUP_CHUNK_SIZE SHA256_DIGEST_SIZE // One keystream block
+#define BACKUP_SIZE (1 + sizeof(eeprom_data)) // nb_credentials followed by eeprom_data
+#define COUNTER_CELLS 2 // EEPROM cells written in turn for the signature counter of a credential
+#define COUNTER_STEP 64 // Signature counter values reserved by each counter write
+#define COUNTER_UNUSED 0xFF // counter_headroom of a credential that has not signed since boot
+#define COMMIT_NONE 0xFF // commit_slot when counter_commit_step is not writing a limit
+#define STORE_MAGIC 0xA7 // First byte of store_layout
+#define STORE_LAYOUT_VERSION 1 // Incremented with each change of Credential or of the EEMEM variables
+#define EEPROM_MAX_ENTRIES 12 // Maximum entries that fit in 1024 bytes ~ 1020/(SHA1_SIZE+CREDENTIAL_ID_SIZE+USER_HANDLE_SIZE+1+PRIVATE_KEY_MAX_SIZE+4*COUNTER_CELLS)
+#define UART_RX_BUFFER_SIZE 64 // Must be a power of 2, holds one SHA-256 block worth of bytes
+#define BAUD_CONFIRM_MS 250 // Time given to the host to confirm a new baud rate, at that rate
+// Fastest rate (index in baud_ubrr) of GetAssertionRaw, which compresses a SHA-256 block between
+// two bytes: the 63 free bytes of rx_buffer last 5.4 ms at 115200, 2.5 ms at 250000. The
+// compression time is not measured on the board yet (simavr), so the command stays at 115200
+#define STREAM_MAX_RATE 0
+#define STACK_CANARY 0xC5 // Value painted over the free RAM to measure the stack peak
+#define ECC_SCRATCH_SIZE (uECC_secp256r1_SCRATCH_SIZE > uECC_SCRATCH_SIZE ? uECC_secp256r1_SCRATCH_SIZE : uECC_SCRATCH_SIZE)
+
+FIRMWARE_STATE volatile uint8_t state_button = 1;    // Button state (1 = released, 0 = pressed)
+FIRMWARE_STATE volatile uint8_t count_button = 0;    // Counter for debounce stability
+FIRMWARE_STATE volatile uint8_t pressed_button = 0;  // Flag for a confirmed button press  
+
+FIRMWARE_STATE volatile uint8_t rx_buffer[UART_RX_BUFFER_SIZE]; // Bytes received by the RX interrupt
+FIRMWARE_STATE volatile uint8_t rx_head = 0; // Next slot written by the RX interrupt
+FIRMWARE_STATE volatile uint8_t rx_tail = 0; // Next slot read by UART_getc
+
+// UBRR0 (with U2X0, at 16 MHz) of each rate of COMMAND_SET_BAUD_RATE: 115200 (the rate at reset,
+// 2.1% fast), 250000, 500000, 1000000 and 2000000 baud (exact)
+const uint8_t baud_ubrr[] = {16, 7, 3, 1, 0};
+FIRMWARE_STATE uint8_t baud_rate = 0; // Index in baud_ubrr of the current rate
+
+FIRMWARE_STATE uint8_t ecc_scratch[ECC_SCRATCH_SIZE]; // Temporaries of every uECC computation, shared by both curves
+
+extern uint8_t __heap_start; // First byte after .data and .bss, provided by the linker
 
 /**
  * @brief Structure representing a data entry for the authenticator.
@@ -38,100 +101,103 @@ volatile uint8_t pressed_button = 0;  // Flag for a confirmed button press
  * This structure is used to store information associated with:
  * - an application identifier (`app_id`),
  * - a credential identifier (`credential_id`),
- * - and a private key (`private_key`).
+ * - the account it belongs to (`user_handle`),
+ * - the curve of the key pair (`curve`),
+ * - a private key (`private_key`),
+ * - and the reserved values of its signature counter (`counter_limit`).
  * 
  * It is saved in EEPROM memory for persistent storage.
  * 
  * Fields:
  * - app_id: SHA-1 hash associated with the application (20 bytes).
- * - credential_id: Unique identifier generated for the key pair (16 bytes).
- * - private_key: Private key used for signing data (21 bytes for secp160r1).
+ * - credential_id: Random identifier generated for the key pair (16 bytes).
+ * - user_handle: Account within the application, several accounts may share an app_id (8 bytes).
+ * - curve: CURVE_SECP160R1 or CURVE_SECP256R1.
+ * - private_key: Private key used for signing data (21 bytes for secp160r1, 32 bytes for secp256r1).
+ * - counter_limit: Highest signature counter value that may be sent; the largest cell is the
+ *   current one, and the cells are written in turn to spread the wear (see counter_commit).
+ * 
+ * Packed so that the host build of the handlers (host/farm) has the EEPROM layout of the board.
  */
-typedef struct {
+typedef struct __attribute__((packed)) {
     uint8_t app_id[SHA1_SIZE];
     uint8_t credential_id[CREDENTIAL_ID_SIZE];
-    uint8_t private_key[PRIVATE_KEY_SIZE];
+    uint8_t user_handle[USER_HANDLE_SIZE];
+    uint8_t curve;
+    uint8_t private_key[PRIVATE_KEY_MAX_SIZE];
+    uint32_t counter_limit[COUNTER_CELLS];
 } Credential;
 
+uint8_t EEMEM store_layout[2] = {STORE_MAGIC, STORE_LAYOUT_VERSION}; // Layout of the store, checked at boot
 Credential EEMEM eeprom_data[EEPROM_MAX_ENTRIES] ; // Persistent storage in EEPROM
 uint8_t EEMEM nb_credentials = 0 ; // Number of credentials in EEPROM
+uint8_t EEMEM store_version = 0 ; // Incremented (modulo 256) each time the listed credentials change
+
+FIRMWARE_STATE uint8_t credential_index[EEPROM_MAX_ENTRIES]; // credential_tag() of the credential_id stored in each slot
+FIRMWARE_STATE uint8_t app_index[EEPROM_MAX_ENTRIES]; // app_tag() of the app_id stored in each slot
+FIRMWARE_STATE uint16_t deleted_slots = 0; // Bit i set if slot i holds a deleted credential (see store_compact_step)
+FIRMWARE_STATE uint32_t sign_counter[EEPROM_MAX_ENTRIES]; // Last signature counter value sent for each slot
+FIRMWARE_STATE uint8_t counter_headroom[EEPROM_MAX_ENTRIES]; // Values left before reaching counter_limit in EEPROM
+FIRMWARE_STATE uint8_t commit_slot = COMMIT_NONE; // Slot whose limit counter_commit_step is writing, byte by byte
+FIRMWARE_STATE uint8_t commit_cell; // Cell of counter_limit being written
+FIRMWARE_STATE uint32_t commit_limit; // Limit being written
+
+#ifdef PROVISIONING_KEY
+const uint8_t provisioning_key[SHA256_DIGEST_SIZE] PROGMEM = PROVISIONING_KEY; // Factory key authenticating COMMAND_IMPORT_CREDENTIALS, kept out of RAM
+#endif
+
+#if EEPROM_MAX_ENTRIES > 16
+#error "deleted_slots holds one bit per slot"
+#endif
+
+#if COUNTER_STEP >= COUNTER_UNUSED
+#error "counter_headroom holds COUNTER_STEP and COUNTER_UNUSED"
+#endif
+
+#define SLOT_LIVE(i) (!(deleted_slots & (1 << (i))))
 
 //--------------------------------- Setup ---------------------------------
 
 /**
  * @brief Configures the RNG, initializes pins for LED and button, and sets up UART.
+ *        The LED stays on if uECC refuses the scratch arena.
  * 
  * @param None.
  * @return None.
  */
 void config(void) {
-    // Initialize seed for the pseudo-random number generator
-    srand(random_seed());
+    uint8_t arena_ok;
+
+    // Start the background entropy collector and the DRBG
+    entropy_init();
     uECC_set_rng(avr_rng);
+    uECC_secp256r1_set_rng(avr_rng);
+    arena_ok = uECC_set_scratch(ecc_scratch, sizeof(ecc_scratch));
+    arena_ok &= uECC_secp256r1_set_scratch(ecc_scratch, sizeof(ecc_scratch));
+    stack_paint();
+
+    store_check_layout(); // Before anything reads the store
+    index_build(); // Index the stored credential IDs
 
     // Initialize GPIO pins
     DDRD |= (1 << LED_PIN);    // Configure PD6 as output for the LED
     DDRD &= ~(1 << BUTTON_PIN);   // Configure PD2 as input for the button
     PORTD |= (1 << BUTTON_PIN);   // Enable the internal pull-up resistor for the button
+    if (!arena_ok) {
+        PORTD |= (1 << LED_PIN); // Steady LED: ecc_scratch is too small, every key and signature fails
+    }
 
     // Initialize UART
     UART_init();
 }
 
 
-//--------------------------------- Random ---------------------------------
-
-/**
- * @brief Reads an analog value using the ADC (Analog-to-Digital Converter).
- * 
- * @param None.
- * @return uint16_t : The result of the ADC conversion.
- */
-uint16_t read_adc() {
-    // Configure ADC
-    ADMUX = (1 << REFS0);  // Use AVcc as the reference voltage
-    ADCSRA = (1 << ADEN) | (1 << ADSC) | (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
-    // (1 << ADEN) enables the ADC. (1 << ADSC) starts the conversion.
-    // (1 << ADPS0:2) sets the prescaler to 128 for a 125 kHz ADC clock.
-
-    // Wait for the conversion to complete (ADSC is cleared upon completion)
-    while (ADCSRA & (1 << ADSC));
-
-    return ADC; // Return the ADC result
-}
-
-/**
- * @brief Generates a random seed based on ADC readings.
- * 
- * @param None.
- * @return int : The generated seed value.
- */
-int random_seed() {
-    uint32_t seed = 0;
-    for (int i = 0; i < 4; i++) {
-        seed ^= (read_adc() & 0xFF) << (i << 3); // Combine the 8 significant bits
-    }
-    return seed;
-}
-
-/**
- * @brief Generates pseudo-random bytes and stores them in the specified buffer.
- * 
- * @param dest Pointer to the buffer where random bytes will be stored.
- * @param size Number of bytes to generate.
- * @return int : Always returns 1 (success).
- */
-int avr_rng(uint8_t *dest, unsigned size) {
-    for (unsigned i = 0; i < size; i++) {
-        dest[i] = (uint8_t)(rand() & 0xFF); // Generate a pseudo-random byte
-    }
-    return 1; // Success
-}
-
 // --------------------------------- Button methods ---------------------------------
 
 /**
  * @brief Debounces a button to ensure stable state transitions.
+ *        With BENCHMARK_AUTO_APPROVE (make BENCHMARK=1), the button is pressed by the firmware
+ *        itself: each approval is granted after 4 polls (45 ms), without anyone at the board.
  * 
  * @param None.
  * @return None.
@@ -139,12 +205,19 @@ int avr_rng(uint8_t *dest, unsigned size) {
 void debounce(void) {
     uint8_t current_state = PIND & (1 << BUTTON_PIN); // Read the current button state (PD2)
 
+#ifdef BENCHMARK_AUTO_APPROVE
+    current_state = 0; // Benchmark build: BUTTON_PIN reads as pressed (active low)
+#endif
+
     if (current_state != state_button) { // If the state has changed
         count_button++;                  // Increment the counter
         if (count_button >= 4) {         // If stable for 4 cycles
             state_button = current_state; // Update the button state
             if (state_button == 0) {      // If the button is confirmed pressed
                 pressed_button = 1;       // Flag the press
+#ifdef BENCHMARK_AUTO_APPROVE
+                state_button = 1 << BUTTON_PIN; // Released at once: every approval takes 4 polls
+#endif
             }
             count_button = 0;            // Reset the counter
         }
@@ -204,7 +277,7 @@ void UART_init() {
     UCSR0A &= ~(1 << U2X0); // Use normal speed mode
     #endif
 
-    UCSR0B = (1 << RXEN0) | (1 << TXEN0);   // Enable UART receiver and transmitter
+    UCSR0B = (1 << RXEN0) | (1 << TXEN0) | (1 << RXCIE0); // Enable receiver, transmitter and RX interrupt
     UCSR0C = (1 << UCSZ01) | (1 << UCSZ00); // Configure 8 data bits, 1 stop bit
 }
 
@@ -221,6 +294,21 @@ void UART_putc(uint8_t data) {
     UDR0 = data; // Send the byte
 }
 
+/**
+ * @brief Changes the baud rate once the bytes already sent have left the shift register.
+ *        TXC0 must have been cleared before the last byte was sent.
+ * 
+ * @param ubrr UBRR0 value, with U2X0 set.
+ * @return None.
+ */
+void UART_set_ubrr(uint8_t ubrr) {
+    while (!(UCSR0A & (1 << TXC0))) {
+        // Wait until the last byte is on the line
+    }
+    UBRR0H = 0;
+    UBRR0L = ubrr;
+}
+
 /**
  * @brief Sends a sequence of bytes (a pattern) over UART.
  * 
@@ -234,6 +322,44 @@ void send_pattern(const char* pattern, uint8_t length) {
     }
 }
 
+/**
+ * @brief Sends a sequence of bytes straight from EEPROM over UART, without copying it to RAM.
+ *        Each byte is read while the previous one is still being shifted out by the UART.
+ * 
+ * @param src Pointer to the data in EEPROM.
+ * @param length Number of bytes to send.
+ * @return None.
+ */
+void send_eeprom(const uint8_t *src, uint8_t length) {
+    for (uint8_t i = 0; i < length; i++) {
+        UART_putc(eeprom_read_byte(src + i));
+    }
+}
+
+/**
+ * @brief Stores each received byte in the RX ring buffer, so that bytes keep arriving
+ *        while the main loop is busy (e.g. compressing a SHA-256 block).
+ */
+ISR(USART_RX_vect) {
+    uint8_t data = UDR0;
+    uint8_t next = (rx_head + 1) & (UART_RX_BUFFER_SIZE - 1);
+
+    if (next != rx_tail) { // Drop the byte if the buffer is full
+        rx_buffer[rx_head] = data;
+        rx_head = next;
+    }
+}
+
+/**
+ * @brief Tells whether a received byte is waiting in the RX ring buffer.
+ * 
+ * @param None.
+ * @return uint8_t - 1 if UART_getc would return immediately, 0 otherwise.
+ */
+uint8_t UART_available(void) {
+    return rx_head != rx_tail;
+}
+
 /**
  * @brief Receives a single byte of data from UART.
  * 
@@ -241,10 +367,14 @@ void send_pattern(const char* pattern, uint8_t length) {
  * @return uint8_t - The received byte.
  */
 uint8_t UART_getc(void) {
-    while (!(UCSR0A & (1 << RXC0))) {
-        // Wait until data is available
+    uint8_t data;
+
+    while (rx_head == rx_tail) {
+        UART_RX_WAIT(); // Wait until data is available
     }
-    return UDR0; // Return the received byte
+    data = rx_buffer[rx_tail];
+    rx_tail = (rx_tail + 1) & (UART_RX_BUFFER_SIZE - 1);
+    return data; // Return the received byte
 }
 
 /**
@@ -267,6 +397,50 @@ void UART_handle_command(uint8_t data) {
         case COMMAND_RESET:
             UART_handle_reset();
             break;
+        case COMMAND_GET_ASSERTION_RAW:
+            UART_handle_get_assertion_raw();
+            break;
+        case COMMAND_MAKE_CREDENTIAL_COMPRESSED:
+            UART_handle_make_credential_compressed();
+            break;
+        case COMMAND_MEMORY_USAGE:
+            UART_handle_memory_usage();
+            break;
+        case COMMAND_MAKE_CREDENTIAL_SECP256R1:
+            UART_handle_make_credential_secp256r1();
+            break;
+        case COMMAND_LIST_CREDENTIALS_FILTERED:
+            UART_handle_list_credentials_filtered();
+            break;
+        case COMMAND_GET_ASSERTION_ALLOW_LIST:
+            UART_handle_get_assertion_allow_list();
+            break;
+        case COMMAND_MAKE_CREDENTIAL_USER:
+            UART_handle_make_credential_user();
+            break;
+        case COMMAND_GET_ASSERTION_USER:
+            UART_handle_get_assertion_user();
+            break;
+        case COMMAND_DELETE_CREDENTIAL:
+            UART_handle_delete_credential();
+            break;
+#ifdef PROVISIONING_KEY
+        case COMMAND_IMPORT_CREDENTIALS:
+            UART_handle_import_credentials();
+            break;
+#endif
+        case COMMAND_EXPORT_BACKUP:
+            UART_handle_export_backup();
+            break;
+        case COMMAND_IMPORT_BACKUP:
+            UART_handle_import_backup();
+            break;
+        case COMMAND_STORE_VERSION:
+            UART_handle_store_version();
+            break;
+        case COMMAND_SET_BAUD_RATE:
+            UART_handle_set_baud_rate();
+            break;
         default:
             UART_putc(STATUS_ERR_COMMAND_UNKNOWN); // Send error for unknown command
     }
@@ -274,75 +448,143 @@ void UART_handle_command(uint8_t data) {
 
 // --------------------------------- MakeCredential ---------------------------------
 
+/**
+ * @brief Writes a record to a slot so that a power loss never leaves a live mix of two
+ *        records: eeprom_update_block writes the last byte first, so the slot is tombstoned
+ *        before the other fields are written, and its curve byte is written last.
+ * 
+ * @param slot Index of the slot in EEPROM.
+ * @param entry Record to write.
+ * @return None.
+ */
+static void store_write_record(uint8_t slot, const Credential *entry) {
+    eeprom_update_byte(&eeprom_data[slot].curve, CURVE_DELETED);
+    eeprom_update_block(entry, &eeprom_data[slot], offsetof(Credential, curve));
+    eeprom_update_block(entry->private_key, eeprom_data[slot].private_key,
+                        sizeof(Credential) - offsetof(Credential, private_key));
+    eeprom_update_byte(&eeprom_data[slot].curve, entry->curve);
+}
+
+/**
+ * @brief Tombstones in EEPROM the deleted slots that still read as live: the copy of a
+ *        compaction move not switched to yet, or the last slot of a move just switched to.
+ *        Called before a command deletes or replaces a credential, so that a power loss
+ *        cannot bring back the old copy.
+ * 
+ * @param None.
+ * @return None.
+ */
+void store_settle(void) {
+    uint8_t nb = eeprom_read_byte(&nb_credentials);
+
+    for (uint8_t i = 0; i < nb; i++) {
+        if (!SLOT_LIVE(i)) {
+            eeprom_update_byte(&eeprom_data[i].curve, CURVE_DELETED);
+        }
+    }
+}
+
 /**
  * @brief Stores the given key and credential information in EEPROM.
+ *        An app ID may hold several credentials, one per user handle: registering the same
+ *        user handle again replaces its credential, any other one takes a new slot.
  * 
  * @param app_id Pointer to the application ID (20-byte SHA1 hash).
+ * @param user_handle Pointer to the user handle (8 bytes).
  * @param credential_id Pointer to the credential ID (16 bytes).
- * @param private_key Pointer to the private key (21 bytes).
- * @param public_key Pointer to the public key (40 bytes).
+ * @param curve Curve of the key pair (CURVE_SECP160R1 or CURVE_SECP256R1).
+ * @param private_key Pointer to the private key (PRIVATE_KEY_MAX_SIZE bytes, zero padded).
+ * @param public_key Pointer to the public key sent back to the client.
+ * @param public_key_size Size of the public key (40 bytes, 21 bytes when compressed, 64 bytes for secp256r1).
  * @return None.
  */
-void store_in_eeprom(uint8_t *app_id, uint8_t *credential_id, uint8_t *private_key, uint8_t *public_key) {
+void store_in_eeprom(uint8_t *app_id, uint8_t *user_handle, uint8_t *credential_id, uint8_t curve, uint8_t *private_key, uint8_t *public_key, uint8_t public_key_size) {
     Credential current_entry;
     uint8_t nb = eeprom_read_byte(&nb_credentials);
-    uint8_t app_id_found = 0;
-
-    // Check if the EEPROM is full
-    if (nb == EEPROM_MAX_ENTRIES) {
+    int8_t account = find_account(app_id, user_handle);
+    uint8_t slot = (account >= 0) ? account : nb; // The same account is replaced
+
+    // Check if the EEPROM is full, reusing a deleted slot not compacted yet
+    if (slot == EEPROM_MAX_ENTRIES) {
+        for (uint8_t i = 0; i < nb; i++) {
+            if (!SLOT_LIVE(i)) {
+                slot = i;
+                break;
+            }
+        }
+    }
+    if (slot == EEPROM_MAX_ENTRIES) {
         UART_putc(STATUS_ERR_STORAGE_FULL); // EEPROM is full
         return;
     }
 
-    // Stops when finding an empty entry or the app_id
-    for (uint8_t i = 0; i < nb; i++) {
-        eeprom_read_block(&current_entry, &eeprom_data[i], sizeof(Credential));
-        if (memcmp(current_entry.app_id, app_id, SHA1_SIZE) == 0) {
-            app_id_found = 1; // App ID already exists
-            break;
-        }
+    // Store the entry in EEPROM, then count it
+    store_settle();
+    memcpy(current_entry.app_id, app_id, SHA1_SIZE);
+    memcpy(current_entry.credential_id, credential_id, CREDENTIAL_ID_SIZE);
+    memcpy(current_entry.user_handle, user_handle, USER_HANDLE_SIZE);
+    current_entry.curve = curve;
+    memcpy(current_entry.private_key, private_key, PRIVATE_KEY_MAX_SIZE);
+    current_entry.counter_limit[0] = COUNTER_STEP; // The first values are reserved with the record
+    for (uint8_t i = 1; i < COUNTER_CELLS; i++) {
+        current_entry.counter_limit[i] = 0;
     }
-
-    // Store the new entry in EEPROM
-    if (!app_id_found) {
-        memcpy(current_entry.app_id, app_id, SHA1_SIZE); // Store new app ID
-        eeprom_update_byte(&nb_credentials, nb + 1);     // Increment credential count
+    store_write_record(slot, &current_entry); // A replaced credential is lost, never mixed, on a power loss
+    sign_counter[slot] = 0;
+    counter_headroom[slot] = COUNTER_STEP;
+    credential_index[slot] = credential_tag(credential_id);
+    app_index[slot] = app_tag(app_id);
+    deleted_slots &= ~(1 << slot);
+    if (slot == nb) {
+        eeprom_update_byte(&nb_credentials, nb + 1); // Increment credential count
     }
-    memcpy(current_entry.credential_id, credential_id, CREDENTIAL_ID_SIZE);
-    memcpy(current_entry.private_key, private_key, PRIVATE_KEY_SIZE);
-    eeprom_update_block(&current_entry, &eeprom_data[nb], sizeof(Credential));
+    store_changed();
 
     // Send confirmation message
     UART_putc(STATUS_OK);
     send_pattern((const char*)credential_id, CREDENTIAL_ID_SIZE);
-    send_pattern((const char*)public_key, PUBLIC_KEY_SIZE);
+    send_pattern((const char*)public_key, public_key_size);
 }
 /**
  * @brief Generates a new key pair, associates it with an app ID, and stores the data in EEPROM.
  * 
  * @param app_id Pointer to the application ID (20-byte SHA1 hash).
+ * @param user_handle Pointer to the user handle (8 bytes).
+ * @param curve Curve of the new key pair (CURVE_SECP160R1 or CURVE_SECP256R1).
+ * @param compressed 1 to send back the 21-byte compressed public key, 0 for the 40-byte one
+ *        (secp160r1 only).
  * @return None.
  */
-void gen_new_keys(uint8_t *app_id) {
+void gen_new_keys(uint8_t *app_id, uint8_t *user_handle, uint8_t curve, uint8_t compressed) {
     if (!ask_for_approval()) {
         UART_putc(STATUS_ERR_APPROVAL); // Approval not granted
         return;
     }
 
-    uint8_t private_key[PRIVATE_KEY_SIZE];
-    uint8_t public_key[PUBLIC_KEY_SIZE];
+    uint8_t private_key[PRIVATE_KEY_MAX_SIZE] = {0};
+    uint8_t public_key[P256_PUBLIC_KEY_SIZE];
     uint8_t credential_id[CREDENTIAL_ID_SIZE];
+    int made;
 
-    if (!uECC_make_key(public_key, private_key)) {
+    if (curve == CURVE_SECP256R1) {
+        made = uECC_secp256r1_make_key(public_key, private_key);
+    } else {
+        made = uECC_make_key(public_key, private_key);
+    }
+    if (!made || !avr_rng(credential_id, CREDENTIAL_ID_SIZE)) { // Random, so that accounts of an app ID get distinct IDs
         UART_putc(STATUS_ERR_CRYPTO_FAILED); // Key generation failed
         return;
     }
 
-    for (int i = 0; i < CREDENTIAL_ID_SIZE; i++) {
-        credential_id[i] = app_id[i]; // Generate credential ID based on app ID
+    if (curve == CURVE_SECP256R1) {
+        store_in_eeprom(app_id, user_handle, credential_id, curve, private_key, public_key, P256_PUBLIC_KEY_SIZE);
+    } else if (compressed) {
+        uint8_t compressed_key[COMPRESSED_PUBLIC_KEY_SIZE];
+        uECC_compress(public_key, compressed_key);
+        store_in_eeprom(app_id, user_handle, credential_id, curve, private_key, compressed_key, COMPRESSED_PUBLIC_KEY_SIZE);
+    } else {
+        store_in_eeprom(app_id, user_handle, credential_id, curve, private_key, public_key, PUBLIC_KEY_SIZE);
     }
-
-    store_in_eeprom(app_id, credential_id, private_key, public_key);
 }
 /**
  * @brief Handles the MakeCredential command by generating a new key pair and storing it.
@@ -356,21 +598,192 @@ void UART_handle_make_credential(void) {
     for (int i = 0; i < SHA1_SIZE; i++) {
         app_id[i] = UART_getc(); // Read the application ID from UART
     }
-    gen_new_keys(app_id); // Generate and store new keys
+    uint8_t user_handle[USER_HANDLE_SIZE] = {0};
+
+    gen_new_keys(app_id, user_handle, CURVE_SECP160R1, 0); // Generate and store new keys
+}
+
+/**
+ * @brief Handles the MakeCredential command, answering with the compressed public key.
+ *        Firmware without this command would read the app ID as commands, so clients first
+ *        send COMMAND_STORE_VERSION (no payload, added later): if it is unknown, they use
+ *        COMMAND_MAKE_CREDENTIAL instead.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_make_credential_compressed(void) {
+    uint8_t app_id[SHA1_SIZE]; // Buffer to store the application ID
+
+    for (int i = 0; i < SHA1_SIZE; i++) {
+        app_id[i] = UART_getc(); // Read the application ID from UART
+    }
+    uint8_t user_handle[USER_HANDLE_SIZE] = {0};
+
+    gen_new_keys(app_id, user_handle, CURVE_SECP160R1, 1); // Generate and store new keys
+}
+
+/**
+ * @brief Handles the MakeCredential command with a secp256r1 key pair, for relying parties
+ *        that do not accept secp160r1. Answers with the 64-byte public key, and later
+ *        assertions made with this credential carry a 64-byte signature.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_make_credential_secp256r1(void) {
+    uint8_t app_id[SHA1_SIZE]; // Buffer to store the application ID
+
+    for (int i = 0; i < SHA1_SIZE; i++) {
+        app_id[i] = UART_getc(); // Read the application ID from UART
+    }
+    uint8_t user_handle[USER_HANDLE_SIZE] = {0};
+
+    gen_new_keys(app_id, user_handle, CURVE_SECP256R1, 0); // Generate and store new keys
+}
+
+/**
+ * @brief Handles the MakeCredential command for one account of the application: an app ID
+ *        holds one credential per user handle. The other MakeCredential commands use the
+ *        all-zero user handle.
+ *        Frame: app_id (20 bytes), curve (1 byte), user_handle (8 bytes).
+ *        Answers with the credential ID and the uncompressed public key.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_make_credential_user(void) {
+    uint8_t app_id[SHA1_SIZE];
+    uint8_t user_handle[USER_HANDLE_SIZE];
+    uint8_t curve;
+
+    for (int i = 0; i < SHA1_SIZE; i++) {
+        app_id[i] = UART_getc(); // Read the application ID from UART
+    }
+    curve = UART_getc();
+    for (int i = 0; i < USER_HANDLE_SIZE; i++) {
+        user_handle[i] = UART_getc(); // Read the user handle from UART
+    }
+
+    if (curve != CURVE_SECP160R1 && curve != CURVE_SECP256R1) {
+        UART_putc(STATUS_ERR_BAD_PARAMETER);
+        return;
+    }
+    gen_new_keys(app_id, user_handle, curve, 0); // Generate and store new keys
 }
 
 // --------------------------------- GetAssertion ---------------------------------
 
+/**
+ * @brief Hash context handed to `uECC_sign_deterministic`, backed by the SHA-256 engine.
+ *
+ * Fields:
+ * - uECC: Generic hash interface expected by uECC (must come first).
+ * - ctx: SHA-256 state.
+ */
+typedef struct {
+    uECC_HashContext uECC;
+    SHA256_CTX ctx;
+} SHA256_HashContext;
+
+static void init_SHA256(uECC_HashContext *base) {
+    SHA256_HashContext *context = (SHA256_HashContext *)base;
+    sha256_init(&context->ctx);
+}
+
+static void update_SHA256(uECC_HashContext *base, const uint8_t *message, unsigned message_size) {
+    SHA256_HashContext *context = (SHA256_HashContext *)base;
+    sha256_update(&context->ctx, message, message_size);
+}
+
+static void finish_SHA256(uECC_HashContext *base, uint8_t *hash_result) {
+    SHA256_HashContext *context = (SHA256_HashContext *)base;
+    sha256_final(&context->ctx, hash_result);
+}
+
+/**
+ * @brief Signs a hash with an RFC 6979 deterministic nonce (HMAC-SHA256), so signing
+ *        never draws nonce bytes from the RNG.
+ *
+ * @param curve Curve of the private key (CURVE_SECP160R1 or CURVE_SECP256R1).
+ * @param private_key Pointer to the private key.
+ * @param hash Pointer to the hash to sign (20 bytes, 32 bytes for secp256r1).
+ * @param signature Pointer to the output buffer (40 bytes, 64 bytes for secp256r1).
+ * @return int : 1 on success, 0 otherwise (including an unknown curve).
+ */
+int sign_deterministic(uint8_t curve, const uint8_t *private_key, const uint8_t *hash, uint8_t *signature) {
+    uint8_t tmp[2 * SHA256_DIGEST_SIZE + SHA256_BLOCK_SIZE];
+    SHA256_HashContext context = {
+        .uECC = {&init_SHA256, &update_SHA256, &finish_SHA256, SHA256_BLOCK_SIZE, SHA256_DIGEST_SIZE, tmp}
+    };
+    int result = 0;
+
+    if (curve == CURVE_SECP160R1) {
+        result = uECC_sign_deterministic(private_key, hash, &context.uECC, signature);
+    } else if (curve == CURVE_SECP256R1) {
+        result = uECC_secp256r1_sign_deterministic(private_key, hash, &context.uECC, signature);
+    }
+
+    memset(tmp, 0, sizeof(tmp)); // K and V are derived from the private key
+    return result;
+}
+
+/**
+ * @brief Signs client data with the credential stored in the given slot and sends the
+ *        credential ID, the signature and the signature counter (4 bytes, big endian) over UART.
+ * 
+ * @param slot Index of the credential in EEPROM.
+ * @param client_data Pointer to the hash of the client data to sign (at least 20 bytes).
+ *        secp160r1 signs its leftmost 20 bytes; secp256r1 signs up to 32 bytes, a shorter
+ *        hash being zero padded on the left (same integer, as in ECDSA).
+ * @param client_data_size Size of the hash (20 or 32 bytes).
+ * @return None.
+ */
+void sign_credential(uint8_t slot, uint8_t *client_data, uint8_t client_data_size) {
+    Credential current_entry;
+    uint32_t counter;
+    uint8_t signature[P256_PUBLIC_KEY_SIZE];
+    uint8_t signature_size = PUBLIC_KEY_SIZE;
+    uint8_t padded[SHA256_DIGEST_SIZE] = {0};
+    const uint8_t *hash = client_data;
+
+    eeprom_read_block(&current_entry, &eeprom_data[slot], sizeof(Credential));
+
+    if (current_entry.curve == CURVE_SECP256R1) {
+        if (client_data_size > SHA256_DIGEST_SIZE) {
+            client_data_size = SHA256_DIGEST_SIZE;
+        }
+        memcpy(padded + SHA256_DIGEST_SIZE - client_data_size, client_data, client_data_size);
+        hash = padded;
+        signature_size = P256_PUBLIC_KEY_SIZE;
+    }
+
+    // Sign the client data using the private key
+    if (!sign_deterministic(current_entry.curve, current_entry.private_key, hash, signature)) {
+        UART_putc(STATUS_ERR_CRYPTO_FAILED); // Signing failed
+        return;
+    }
+    counter = counter_next(slot);
+
+    // Send the signed data over UART
+    UART_putc(STATUS_OK);
+    send_pattern((const char*)current_entry.credential_id, CREDENTIAL_ID_SIZE);
+    send_pattern((const char*)signature, signature_size);
+    for (int8_t shift = 24; shift >= 0; shift -= 8) {
+        UART_putc(counter >> shift); // Signature counter, big endian
+    }
+}
+
 /**
  * @brief Signs client data using the private key associated with the given app ID.
  * 
  * @param app_id Pointer to the application ID (20-byte SHA1 hash).
- * @param client_data Pointer to the client data to sign (20 bytes).
+ * @param client_data Pointer to the hash of the client data to sign (see sign_credential).
+ * @param client_data_size Size of the hash (20 or 32 bytes).
  * @return None.
  */
-void sign_data(uint8_t *app_id, uint8_t *client_data) {
-    Credential current_entry;
-    uint8_t nb = eeprom_read_byte(&nb_credentials);
+void sign_data(uint8_t *app_id, uint8_t *client_data, uint8_t client_data_size) {
+    uint8_t slots[EEPROM_MAX_ENTRIES];
 
     if (!ask_for_approval()) {
         // If the user does not approve, return an error
@@ -378,25 +791,10 @@ void sign_data(uint8_t *app_id, uint8_t *client_data) {
         return;
     }
 
-    for (uint8_t i = 0; i < nb; i++) {
-        eeprom_read_block(&current_entry, &eeprom_data[i], sizeof(Credential));
-
-        // Check if the app ID matches the current entry
-        if (memcmp(current_entry.app_id, app_id, SHA1_SIZE) == 0) {
-
-            // Sign the client data using the private key
-            uint8_t signature[40];
-            if (!uECC_sign(current_entry.private_key, client_data, signature)) {
-                UART_putc(STATUS_ERR_CRYPTO_FAILED); // Signing failed
-                return;
-            }
-            
-            // Send the signed data over UART
-            UART_putc(STATUS_OK);
-            send_pattern((const char*)current_entry.credential_id, CREDENTIAL_ID_SIZE);
-            send_pattern((const char*)signature, PUBLIC_KEY_SIZE);
-            return;
-        }
+    // Sign with the first credential of the app ID
+    if (find_app_credentials(app_id, slots) > 0) {
+        sign_credential(slots[0], client_data, client_data_size);
+        return;
     }
 
     UART_putc(STATUS_ERR_NOT_FOUND); // App ID not found
@@ -419,71 +817,1220 @@ void UART_handle_get_assertion(void) {
         client_data[i] = UART_getc(); // Read client data from UART
     }
 
-    sign_data(app_id, client_data);
+    sign_data(app_id, client_data, SHA1_SIZE);
 }
 
-
-// --------------------------------- ListCredentials ---------------------------------
-
 /**
- * @brief Lists the credentials stored in EEPROM, including `app_id` and `credential_id`.
- *        Sends the credentials information over UART.
+ * @brief Handles the GetAssertion command with raw client data (e.g. authenticatorData ||
+ *        clientDataHash) instead of a pre-computed hash. The data is hashed with SHA-256 as
+ *        each byte is received, and the leftmost 20 bytes of the digest are signed.
+ *        Frame: app_id (20 bytes), length (2 bytes, big endian), data (length bytes).
+ *        Above STREAM_MAX_RATE, the data is dropped and STATUS_ERR_BAD_PARAMETER answered.
  * 
  * @param None.
  * @return None.
  */
-void UART_handle_list_credentials(void) {
-    Credential current_entry;
-    uint8_t nb = eeprom_read_byte(&nb_credentials);
-    uint8_t i = 0;
+void UART_handle_get_assertion_raw(void) {
+    uint8_t app_id[SHA1_SIZE];
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    SHA256_CTX ctx;
+    uint16_t length;
 
-    UART_putc(STATUS_OK); // Indicate success
-    UART_putc(nb); // Send the number of stored credentials
+    for (int i = 0; i < SHA1_SIZE; i++) {
+        app_id[i] = UART_getc(); // Read application ID from UART
+    }
+    length = (uint16_t)UART_getc() << 8; // Read data length from UART
+    length |= UART_getc();
+
+    if (baud_rate > STREAM_MAX_RATE) {
+        // No flow control: the data would overflow rx_buffer during the compressions
+        while (length--) {
+            UART_getc(); // Drop the data, read as fast as it arrives
+        }
+        UART_putc(STATUS_ERR_BAD_PARAMETER);
+        return;
+    }
 
-    // Iterate through the stored credentials
-    while (i < nb) {
-        eeprom_read_block(&current_entry, &eeprom_data[i], sizeof(Credential));
-        send_pattern((const char*)current_entry.credential_id, CREDENTIAL_ID_SIZE); // Send credential_id
-        send_pattern((const char*)current_entry.app_id, SHA1_SIZE); // Send app_id
-        i++;
+    sha256_init(&ctx);
+    while (length--) {
+        uint8_t data = UART_getc();
+        sha256_update(&ctx, &data, 1); // Compressions overlap with the reception of the next bytes
     }
+    sha256_final(&ctx, digest);
+
+    sign_data(app_id, digest, SHA256_DIGEST_SIZE); // secp160r1 signs the leftmost SHA1_SIZE bytes
 }
 
-// --------------------------------- Reset ---------------------------------
 
 /**
- * @brief Resets the EEPROM by clearing all stored credentials and resetting the counter (`nb_credentials`).
- *        Requires user approval before executing the reset.
+ * @brief Handles the GetAssertion command with a CTAP allowList: the client sends the
+ *        credential IDs it accepts, and the first one stored for the app ID is signed.
+ *        Each credential ID is looked up through `credential_index` while the next one is
+ *        still being received. An empty allowList falls back to the app ID lookup.
+ *        Frame: app_id (20 bytes), client_data (20 bytes), count (1 byte), count credential IDs.
  * 
  * @param None.
  * @return None.
  */
-void UART_handle_reset(void) {
-    if (!ask_for_approval()) {
-        UART_putc(STATUS_ERR_APPROVAL); // Approval not granted
-        return;
-    }
+void UART_handle_get_assertion_allow_list(void) {
+    uint8_t app_id[SHA1_SIZE];
+    uint8_t client_data[SHA1_SIZE];
+    uint8_t credential_id[CREDENTIAL_ID_SIZE];
+    uint8_t count;
+    int8_t slot = -1;
 
-    uint8_t nb = eeprom_read_byte(&nb_credentials); // Read the current number of credentials
-    Credential empty_entry = {0}; // Define an empty credential structure
+    for (int i = 0; i < SHA1_SIZE; i++) {
+        app_id[i] = UART_getc(); // Read application ID from UART
+    }
+    for (int i = 0; i < SHA1_SIZE; i++) {
+        client_data[i] = UART_getc(); // Read client data from UART
+    }
+    count = UART_getc();
 
-    // Overwrite each stored entry with the empty structure
-    for (uint8_t i = 0; i < nb; i++) {
-        eeprom_write_block(&empty_entry, &eeprom_data[i], sizeof(Credential));
+    if (count == 0) {
+        sign_data(app_id, client_data, SHA1_SIZE);
+        return;
     }
 
-    // Reset the counter
-    eeprom_write_byte(&nb_credentials, 0);
+    while (count--) {
+        for (int i = 0; i < CREDENTIAL_ID_SIZE; i++) {
+            credential_id[i] = UART_getc(); // Read the whole allowList, even after a match
+        }
+        if (slot < 0) {
+            slot = find_credential(credential_id, app_id);
+        }
+    }
 
-    UART_putc(STATUS_OK); // Indicate success
+    if (slot < 0) {
+        UART_putc(STATUS_ERR_NOT_FOUND); // No allowed credential is stored for this app ID
+        return;
+    }
+    if (!ask_for_approval()) {
+        UART_putc(STATUS_ERR_APPROVAL); // Approval not granted
+        return;
+    }
+    sign_credential(slot, client_data, SHA1_SIZE);
 }
 
-
-// --------------------------------- Main ---------------------------------
-
 /**
- * @brief Main function that configures peripherals and executes an infinite loop 
- *        to handle commands received via UART.
+ * @brief Handles the GetAssertion command for one account of the application, selected by
+ *        its user handle, in a single round trip.
+ *        Frame: app_id (20 bytes), client_data (20 bytes), user_handle (8 bytes).
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_get_assertion_user(void) {
+    uint8_t app_id[SHA1_SIZE];
+    uint8_t client_data[SHA1_SIZE];
+    uint8_t user_handle[USER_HANDLE_SIZE];
+    uint8_t slots[EEPROM_MAX_ENTRIES];
+    uint8_t count;
+
+    for (int i = 0; i < SHA1_SIZE; i++) {
+        app_id[i] = UART_getc(); // Read application ID from UART
+    }
+    for (int i = 0; i < SHA1_SIZE; i++) {
+        client_data[i] = UART_getc(); // Read client data from UART
+    }
+    for (int i = 0; i < USER_HANDLE_SIZE; i++) {
+        user_handle[i] = UART_getc(); // Read the user handle from UART
+    }
+
+    count = find_app_credentials(app_id, slots);
+    for (uint8_t i = 0; i < count; i++) {
+        if (eeprom_matches(eeprom_data[slots[i]].user_handle, user_handle, USER_HANDLE_SIZE)) {
+            if (!ask_for_approval()) {
+                UART_putc(STATUS_ERR_APPROVAL); // Approval not granted
+                return;
+            }
+            sign_credential(slots[i], client_data, SHA1_SIZE);
+            return;
+        }
+    }
+
+    UART_putc(STATUS_ERR_NOT_FOUND); // No such account for this app ID
+}
+
+// --------------------------------- Credential index ---------------------------------
+
+/**
+ * @brief Computes the one-byte tag of a credential ID used by `credential_index`.
+ * 
+ * @param credential_id Pointer to the credential ID (16 bytes).
+ * @return uint8_t : The tag.
+ */
+uint8_t credential_tag(const uint8_t *credential_id) {
+    uint8_t tag = 0;
+
+    for (uint8_t i = 0; i < CREDENTIAL_ID_SIZE; i++) {
+        tag = (uint8_t)((tag << 1) | (tag >> 7)) ^ credential_id[i];
+    }
+    return tag;
+}
+
+/**
+ * @brief Computes the one-byte tag of an app ID used by `app_index`. App IDs are hashes,
+ *        so their first byte is enough.
+ * 
+ * @param app_id Pointer to the application ID (20 bytes).
+ * @return uint8_t : The tag.
+ */
+uint8_t app_tag(const uint8_t *app_id) {
+    return app_id[0];
+}
+
+/**
+ * @brief Builds `credential_index`, `app_index` and `deleted_slots` from the credentials stored in EEPROM,
+ *        and loads the signature counters.
+ *        Called once at boot, then kept up to date by store_in_eeprom.
+ * 
+ * @param None.
+ * @return None.
+ */
+void index_build(void) {
+    uint8_t credential_id[CREDENTIAL_ID_SIZE];
+    uint8_t nb = eeprom_read_byte(&nb_credentials);
+
+    for (uint8_t i = 0; i < nb && i < EEPROM_MAX_ENTRIES; i++) {
+        eeprom_read_block(credential_id, eeprom_data[i].credential_id, CREDENTIAL_ID_SIZE);
+        credential_index[i] = credential_tag(credential_id);
+        app_index[i] = eeprom_read_byte(eeprom_data[i].app_id);
+        if (eeprom_read_byte(&eeprom_data[i].curve) == CURVE_DELETED) {
+            deleted_slots |= 1 << i; // Deleted before the last power off, compaction resumes
+        }
+        counter_load(i);
+    }
+
+    // Power lost during a move of store_compact_step: the last record is live in its hole too,
+    // whose counter cells may be older. The move is finished from the last record.
+    if (nb > 1 && nb <= EEPROM_MAX_ENTRIES && SLOT_LIVE(nb - 1)) {
+        int8_t hole;
+        Credential entry;
+
+        eeprom_read_block(credential_id, eeprom_data[nb - 1].credential_id, CREDENTIAL_ID_SIZE);
+        hole = find_credential(credential_id, NULL);
+        if (hole >= 0 && hole < nb - 1) {
+            eeprom_read_block(&entry, &eeprom_data[nb - 1], sizeof(Credential));
+            store_write_record(hole, &entry);
+            memset(&entry, 0, sizeof(Credential));
+            counter_load(hole);
+            eeprom_update_byte(&eeprom_data[nb - 1].curve, CURVE_DELETED);
+            deleted_slots |= 1 << (nb - 1);
+            store_changed(); // The move may have been interrupted before its version increment
+        }
+    }
+}
+
+/**
+ * @brief Finds the slots of all the credentials of an app ID. Only the slots whose tag
+ *        matches are compared in EEPROM.
+ * 
+ * @param app_id Pointer to the application ID (20 bytes).
+ * @param slots Output array of at least EEPROM_MAX_ENTRIES slots, in storage order.
+ * @return uint8_t : The number of credentials found.
+ */
+uint8_t find_app_credentials(const uint8_t *app_id, uint8_t *slots) {
+    uint8_t nb = eeprom_read_byte(&nb_credentials);
+    uint8_t tag = app_tag(app_id);
+    uint8_t count = 0;
+
+    for (uint8_t i = 0; i < nb; i++) {
+        if (app_index[i] == tag && SLOT_LIVE(i) && eeprom_matches(eeprom_data[i].app_id, app_id, SHA1_SIZE)) {
+            slots[count++] = i;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Finds the slot of the credential of an account (app ID and user handle).
+ * 
+ * @param app_id Pointer to the application ID (20 bytes).
+ * @param user_handle Pointer to the user handle (8 bytes).
+ * @return int8_t : The slot of the credential, -1 if the account has none.
+ */
+int8_t find_account(const uint8_t *app_id, const uint8_t *user_handle) {
+    uint8_t slots[EEPROM_MAX_ENTRIES];
+    uint8_t count = find_app_credentials(app_id, slots);
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (eeprom_matches(eeprom_data[slots[i]].user_handle, user_handle, USER_HANDLE_SIZE)) {
+            return slots[i];
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Finds the slot of a credential from its ID and app ID. Only the slots whose tag
+ *        matches are compared in EEPROM.
+ * 
+ * @param credential_id Pointer to the credential ID (16 bytes).
+ * @param app_id Pointer to the application ID (20 bytes), NULL to accept any app ID.
+ * @return int8_t : The slot of the credential, -1 if it is not stored.
+ */
+int8_t find_credential(const uint8_t *credential_id, const uint8_t *app_id) {
+    uint8_t nb = eeprom_read_byte(&nb_credentials);
+    uint8_t tag = credential_tag(credential_id);
+
+    for (uint8_t i = 0; i < nb; i++) {
+        if (credential_index[i] != tag || !SLOT_LIVE(i)) {
+            continue;
+        }
+        if (app_id != NULL && (app_index[i] != app_tag(app_id) ||
+                               !eeprom_matches(eeprom_data[i].app_id, app_id, SHA1_SIZE))) {
+            continue;
+        }
+        if (eeprom_matches(eeprom_data[i].credential_id, credential_id, CREDENTIAL_ID_SIZE)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// --------------------------------- Signature counter ---------------------------------
+
+/**
+ * @brief Loads the signature counter of a slot at boot. Every value up to the stored limit
+ *        may have been sent before the power off, so counting resumes from the limit, and a
+ *        new limit must be committed before the next value is sent. That commit is left to the
+ *        first signature (COUNTER_UNUSED): a boot writes nothing for the credentials that do not sign.
+ * 
+ * @param slot Index of the credential in EEPROM.
+ * @return None.
+ */
+void counter_load(uint8_t slot) {
+    uint32_t limit = 0;
+
+    for (uint8_t i = 0; i < COUNTER_CELLS; i++) {
+        uint32_t cell = eeprom_read_dword(&eeprom_data[slot].counter_limit[i]);
+
+        if (cell > limit) {
+            limit = cell;
+        }
+    }
+    sign_counter[slot] = limit;
+    counter_headroom[slot] = COUNTER_UNUSED;
+}
+
+/**
+ * @brief Finds the cell of a signature counter to overwrite: the one holding the smallest limit.
+ * 
+ * @param slot Index of the credential in EEPROM.
+ * @return uint8_t : Index of the cell in counter_limit.
+ */
+uint8_t counter_oldest(uint8_t slot) {
+    uint8_t oldest = 0;
+    uint32_t oldest_value = 0xFFFFFFFF;
+
+    for (uint8_t i = 0; i < COUNTER_CELLS; i++) {
+        uint32_t cell = eeprom_read_dword(&eeprom_data[slot].counter_limit[i]);
+
+        if (cell < oldest_value) {
+            oldest = i;
+            oldest_value = cell;
+        }
+    }
+    return oldest;
+}
+
+/**
+ * @brief Reserves the next COUNTER_STEP values of a signature counter in EEPROM. The new
+ *        limit overwrites the smallest cell, so each cell is written once every
+ *        COUNTER_CELLS * COUNTER_STEP signatures, and a write interrupted by a power loss
+ *        leaves the previous limit in the other cell.
+ * 
+ * @param slot Index of the credential in EEPROM.
+ * @return None.
+ */
+void counter_commit(uint8_t slot) {
+    eeprom_update_dword(&eeprom_data[slot].counter_limit[counter_oldest(slot)], sign_counter[slot] + COUNTER_STEP);
+    counter_headroom[slot] = COUNTER_STEP;
+}
+
+/**
+ * @brief Increments the signature counter of a slot. The EEPROM is only written here for the
+ *        first signature since boot, or if the idle commits (counter_commit_step) could not keep up.
+ * 
+ * @param slot Index of the credential in EEPROM.
+ * @return uint32_t : The new counter value.
+ */
+uint32_t counter_next(uint8_t slot) {
+    if (counter_headroom[slot] == 0 || counter_headroom[slot] == COUNTER_UNUSED) {
+        counter_commit(slot);
+    }
+    counter_headroom[slot]--;
+    return ++sign_counter[slot];
+}
+
+/**
+ * @brief Commits, one byte per call, the limit of a signature counter that used half of its
+ *        reserved values. Called when no command is pending and the EEPROM is ready, so that a
+ *        request arriving meanwhile waits for one byte write (3.3 ms) at most. The main loop
+ *        drops the commit in progress before each command: the cell left half written holds
+ *        a mix of two limits, and the largest cell still bounds the values already sent.
+ *        Credentials that have not signed since boot are skipped.
+ * 
+ * @param None.
+ * @return uint8_t : 1 if the call did some work, 0 if no counter needs a commit.
+ */
+uint8_t counter_commit_step(void) {
+    uint8_t nb = eeprom_read_byte(&nb_credentials);
+    uint8_t *cell;
+
+    if (commit_slot == COMMIT_NONE) {
+        for (uint8_t i = 0; i < nb; i++) {
+            if (SLOT_LIVE(i) && counter_headroom[i] < COUNTER_STEP / 2) { // COUNTER_UNUSED is above
+                commit_slot = i;
+                commit_cell = counter_oldest(i);
+                commit_limit = sign_counter[i] + COUNTER_STEP;
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    cell = (uint8_t *)&eeprom_data[commit_slot].counter_limit[commit_cell];
+    for (uint8_t i = 0; i < sizeof(commit_limit); i++) {
+        uint8_t byte = ((const uint8_t *)&commit_limit)[i];
+
+        if (eeprom_read_byte(cell + i) != byte) {
+            eeprom_write_byte(cell + i, byte);
+            return 1;
+        }
+    }
+    counter_headroom[commit_slot] = COUNTER_STEP; // No signature since commit_limit was set
+    commit_slot = COMMIT_NONE;
+    return 1;
+}
+
+// --------------------------------- ListCredentials ---------------------------------
+
+/**
+ * @brief Counts the listed credentials: deleted credentials waiting for compaction are not.
+ * 
+ * @param None.
+ * @return uint8_t : Number of live credentials.
+ */
+uint8_t live_credentials(void) {
+    uint8_t nb = eeprom_read_byte(&nb_credentials);
+    uint8_t live = 0;
+
+    for (uint8_t i = 0; i < nb; i++) {
+        live += SLOT_LIVE(i);
+    }
+    return live;
+}
+
+/**
+ * @brief Lists the credentials stored in EEPROM, including `app_id` and `credential_id`.
+ *        Both fields are streamed from EEPROM to the UART, so no credential is copied to RAM.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_list_credentials(void) {
+    uint8_t nb = eeprom_read_byte(&nb_credentials);
+    uint8_t i = 0;
+
+    UART_putc(STATUS_OK); // Indicate success
+    UART_putc(live_credentials()); // Send the number of stored credentials
+
+    // Iterate through the stored credentials, the private keys are never read
+    for (i = 0; i < nb; i++) {
+        if (!SLOT_LIVE(i)) {
+            continue;
+        }
+        send_eeprom(eeprom_data[i].credential_id, CREDENTIAL_ID_SIZE); // Send credential_id
+        send_eeprom(eeprom_data[i].app_id, SHA1_SIZE); // Send app_id
+    }
+}
+
+// --------------------------------- StoreVersion ---------------------------------
+
+/**
+ * @brief Records a change of the listed credentials (stored, deleted, imported or reset),
+ *        so that a client can tell whether its copy of the list is still up to date.
+ *        One EEPROM byte write (about 3.3 ms), next to the write of the change itself.
+ * 
+ * @param None.
+ * @return None.
+ */
+void store_changed(void) {
+    eeprom_update_byte(&store_version, eeprom_read_byte(&store_version) + 1);
+}
+
+/**
+ * @brief Checks at boot that the EEPROM holds a store of this firmware's layout. A store
+ *        written with another Credential layout (an older firmware, or a blank EEPROM) cannot
+ *        be read: rather than serving its bytes as keys, every slot is wiped and the store
+ *        starts empty. store_layout is written last, so a power loss restarts the wipe.
+ * 
+ * @param None.
+ * @return None.
+ */
+void store_check_layout(void) {
+    Credential empty_entry = {0};
+
+    if (eeprom_read_byte(&store_layout[0]) == STORE_MAGIC &&
+        eeprom_read_byte(&store_layout[1]) == STORE_LAYOUT_VERSION) {
+        return;
+    }
+    for (uint8_t i = 0; i < EEPROM_MAX_ENTRIES; i++) {
+        eeprom_update_block(&empty_entry, &eeprom_data[i], sizeof(Credential));
+    }
+    eeprom_update_byte(&nb_credentials, 0);
+    store_changed();
+    eeprom_update_byte(&store_layout[0], STORE_MAGIC);
+    eeprom_update_byte(&store_layout[1], STORE_LAYOUT_VERSION);
+}
+
+/**
+ * @brief Handles the StoreVersion command: sends STATUS_OK, the store version (1 byte) and the
+ *        number of listed credentials (1 byte). The version is kept in EEPROM, so it stays
+ *        valid across power cycles; after 256 changes it wraps around, and there is no EEPROM
+ *        byte left to widen it (see eeprom_data). A client checks both bytes: a list left
+ *        unchanged by a multiple of 256 changes must also keep its count to be taken as valid.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_store_version(void) {
+    UART_putc(STATUS_OK);
+    UART_putc(eeprom_read_byte(&store_version));
+    UART_putc(live_credentials());
+}
+
+// --------------------------------- SetBaudRate ---------------------------------
+
+/**
+ * @brief Handles the SetBaudRate command: switches the UART to a faster rate, which cuts the
+ *        transfer of a 41 to 85-byte frame from 3.5-7 ms (115200) down to 0.2-0.4 ms (2 Mbaud).
+ *        Frame: rate (1 byte, index in baud_ubrr: 0 = 115200, 1 = 250000, 2 = 500000,
+ *        3 = 1000000, 4 = 2000000 baud).
+ *        The authenticator answers STATUS_OK at the current rate and switches; the host
+ *        switches too and sends the same frame again, answered with STATUS_OK at the new rate.
+ *        Without this confirmation within BAUD_CONFIRM_MS (silence, or bytes garbled by a link
+ *        that cannot keep up), the authenticator falls back to 115200 and answers nothing.
+ *        A reset (e.g. the host opening the port) also comes back to 115200.
+ *        There is no flow control: above 115200, only frames that fit in rx_buffer are safe
+ *        (the handlers read nothing while they compute or write the EEPROM), and
+ *        GetAssertionRaw is refused (STREAM_MAX_RATE). Where the rate cannot change
+ *        (UART_FIXED_RATE), only 115200 is accepted.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_set_baud_rate(void) {
+    uint8_t rate = UART_getc();
+    uint8_t confirmed = 0;
+
+    if (rate >= sizeof(baud_ubrr) || (UART_FIXED_RATE && rate != 0)) {
+        UART_putc(STATUS_ERR_BAD_PARAMETER);
+        return;
+    }
+
+    UCSR0A |= (1 << TXC0); // Cleared by writing 1, set again once STATUS_OK is on the line
+    UART_putc(STATUS_OK);
+    UART_set_ubrr(baud_ubrr[rate]);
+
+    for (uint16_t ms = 0; ms < BAUD_CONFIRM_MS && ((rx_head - rx_tail) & (UART_RX_BUFFER_SIZE - 1)) < 2; ms++) {
+        _delay_ms(1);
+    }
+    if (((rx_head - rx_tail) & (UART_RX_BUFFER_SIZE - 1)) >= 2) {
+        confirmed = (UART_getc() == COMMAND_SET_BAUD_RATE);
+        confirmed &= (UART_getc() == rate);
+    }
+    if (!confirmed) {
+        rx_tail = rx_head; // Drop what was received at the wrong rate
+        UART_set_ubrr(baud_ubrr[0]);
+        baud_rate = 0;
+        return;
+    }
+    baud_rate = rate;
+    UART_putc(STATUS_OK);
+}
+
+/**
+ * @brief Compares bytes stored in EEPROM with bytes in RAM, without copying them to RAM.
+ * 
+ * @param src Pointer to the data in EEPROM.
+ * @param data Pointer to the data in RAM.
+ * @param length Number of bytes to compare.
+ * @return uint8_t : 1 if the bytes are equal, 0 otherwise.
+ */
+uint8_t eeprom_matches(const uint8_t *src, const uint8_t *data, uint8_t length) {
+    for (uint8_t i = 0; i < length; i++) {
+        if (eeprom_read_byte(src + i) != data[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Lists one page of the credentials matching a filter.
+ *        Frame: offset (1 byte), limit (1 byte), filter (1 byte) followed by
+ *        - FILTER_NONE: nothing,
+ *        - FILTER_APP_ID_PREFIX: prefix length (1 byte, at most 20) and the prefix,
+ *        - FILTER_CREDENTIAL_ID: the credential_id (16 bytes).
+ *        Answers with the number of matching credentials, the number of credentials sent
+ *        (at most `limit`, skipping the first `offset` matches), then each credential as in
+ *        UART_handle_list_credentials.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_list_credentials_filtered(void) {
+    uint8_t value[SHA1_SIZE]; // App ID prefix or credential ID to match
+    uint8_t value_size = 0;
+    uint8_t offset = UART_getc();
+    uint8_t limit = UART_getc();
+    uint8_t filter = UART_getc();
+    uint8_t valid = 1;
+    uint8_t nb = eeprom_read_byte(&nb_credentials);
+    uint8_t matches = 0;
+    uint8_t sent = 0;
+
+    if (filter == FILTER_APP_ID_PREFIX) {
+        value_size = UART_getc();
+    } else if (filter == FILTER_CREDENTIAL_ID) {
+        value_size = CREDENTIAL_ID_SIZE;
+    } else if (filter != FILTER_NONE) {
+        valid = 0;
+    }
+    for (uint8_t i = 0; i < value_size; i++) {
+        uint8_t data = UART_getc(); // Read the whole frame, even if too long
+
+        if (i < SHA1_SIZE) {
+            value[i] = data;
+        }
+    }
+    if (!valid || value_size > SHA1_SIZE) {
+        UART_putc(STATUS_ERR_BAD_PARAMETER);
+        return;
+    }
+
+    // First pass: count the matches, so that the page size is sent before the page
+    for (uint8_t i = 0; i < nb; i++) {
+        const uint8_t *field = (filter == FILTER_CREDENTIAL_ID) ? eeprom_data[i].credential_id : eeprom_data[i].app_id;
+        matches += SLOT_LIVE(i) && eeprom_matches(field, value, value_size);
+    }
+    if (matches > offset) {
+        sent = (matches - offset < limit) ? matches - offset : limit;
+    }
+
+    UART_putc(STATUS_OK);
+    UART_putc(matches);
+    UART_putc(sent);
+
+    // Second pass: stream the page
+    for (uint8_t i = 0; i < nb && sent > 0; i++) {
+        const uint8_t *field = (filter == FILTER_CREDENTIAL_ID) ? eeprom_data[i].credential_id : eeprom_data[i].app_id;
+
+        if (!SLOT_LIVE(i) || !eeprom_matches(field, value, value_size)) {
+            continue;
+        }
+        if (offset > 0) {
+            offset--;
+            continue;
+        }
+        send_eeprom(eeprom_data[i].credential_id, CREDENTIAL_ID_SIZE);
+        send_eeprom(eeprom_data[i].app_id, SHA1_SIZE);
+        sent--;
+    }
+}
+
+// --------------------------------- ImportCredentials ---------------------------------
+
+#ifdef PROVISIONING_KEY
+/**
+ * @brief Handles the ImportCredentials command, used for factory provisioning: stores
+ *        pre-generated credentials after a single user approval, without key generation.
+ *        The records are sent one at a time (stop-and-wait), and the whole import is
+ *        authenticated with HMAC-SHA256 under `provisioning_key`, over a fresh challenge of the
+ *        authenticator: a recorded import cannot be replayed, e.g. to bring back credentials
+ *        deleted since.
+ *        1. The client sends count (1 byte); the authenticator asks for approval, then answers
+ *           STATUS_OK and a challenge (IMPORT_CHALLENGE_SIZE random bytes) if count
+ *           credentials fit, an error otherwise.
+ *        2. For each credential, the client sends app_id (20 bytes), credential_id (16 bytes),
+ *           user_handle (8 bytes), curve (1 byte) and private_key (32 bytes, zero padded), and
+ *           waits for STATUS_OK: the record is written after the used slots while the MAC is
+ *           computed, the EEPROM write being far slower than the reception of a record.
+ *        3. The client sends the HMAC of the challenge, count and all the records (32 bytes).
+ *           Only then are
+ *           the records counted, with a single write of `nb_credentials`. If the MAC is wrong,
+ *           a curve is unknown, or a credential ID or account is already stored, the written
+ *           records are wiped instead.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_import_credentials(void) {
+    HMAC_SHA256_CTX hmac;
+    Credential entry;
+    uint8_t mac[SHA256_DIGEST_SIZE];
+    uint8_t challenge[IMPORT_CHALLENGE_SIZE];
+    uint8_t difference = 0;
+    uint8_t valid = 1;
+    uint8_t nb = eeprom_read_byte(&nb_credentials);
+    uint8_t count = UART_getc();
+
+    if (count > EEPROM_MAX_ENTRIES - nb) {
+        UART_putc(STATUS_ERR_STORAGE_FULL);
+        return;
+    }
+    if (!ask_for_approval()) {
+        UART_putc(STATUS_ERR_APPROVAL); // Approval not granted
+        return;
+    }
+    if (!avr_rng(challenge, IMPORT_CHALLENGE_SIZE)) {
+        UART_putc(STATUS_ERR_CRYPTO_FAILED);
+        return;
+    }
+    UART_putc(STATUS_OK); // Ready for the records
+    send_pattern((const char*)challenge, IMPORT_CHALLENGE_SIZE);
+
+    for (uint8_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        mac[i] = pgm_read_byte(&provisioning_key[i]); // The key only stays in RAM during the HMAC setup
+    }
+    hmac_sha256_init(&hmac, mac, SHA256_DIGEST_SIZE);
+    memset(mac, 0, SHA256_DIGEST_SIZE);
+    hmac_sha256_update(&hmac, challenge, IMPORT_CHALLENGE_SIZE);
+    hmac_sha256_update(&hmac, &count, 1);
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t *record = (uint8_t *)&entry; // The record fields are the first fields of Credential
+
+        for (uint8_t j = 0; j < IMPORT_RECORD_SIZE; j++) {
+            record[j] = UART_getc();
+        }
+        hmac_sha256_update(&hmac, record, IMPORT_RECORD_SIZE);
+        if (entry.curve != CURVE_SECP160R1 && entry.curve != CURVE_SECP256R1) {
+            valid = 0;
+        }
+        if (find_credential(entry.credential_id, NULL) >= 0 || find_account(entry.app_id, entry.user_handle) >= 0) {
+            valid = 0; // Already stored
+        }
+        for (uint8_t j = nb; j < nb + i; j++) {
+            if (eeprom_matches(eeprom_data[j].credential_id, entry.credential_id, CREDENTIAL_ID_SIZE) ||
+                (eeprom_matches(eeprom_data[j].app_id, entry.app_id, SHA1_SIZE) &&
+                 eeprom_matches(eeprom_data[j].user_handle, entry.user_handle, USER_HANDLE_SIZE))) {
+                valid = 0; // Sent twice in this import
+            }
+        }
+        entry.counter_limit[0] = COUNTER_STEP;
+        for (uint8_t j = 1; j < COUNTER_CELLS; j++) {
+            entry.counter_limit[j] = 0;
+        }
+        eeprom_update_block(&entry, &eeprom_data[nb + i], sizeof(Credential));
+        UART_putc(STATUS_OK); // Ready for the next record
+    }
+    memset(&entry, 0, sizeof(Credential));
+
+    hmac_sha256_final(&hmac, mac);
+    for (uint8_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        difference |= mac[i] ^ UART_getc(); // Constant time comparison
+    }
+    if (difference != 0 || !valid) {
+        // The records were never counted; wipe their private keys
+        for (uint8_t i = nb; i < nb + count; i++) {
+            eeprom_update_block(&entry, &eeprom_data[i], sizeof(Credential));
+        }
+        UART_putc(difference != 0 ? STATUS_ERR_AUTHENTICATION : STATUS_ERR_BAD_PARAMETER);
+        return;
+    }
+
+    // Commit, then index the new credentials
+    eeprom_update_byte(&nb_credentials, nb + count);
+    store_changed();
+    for (uint8_t i = nb; i < nb + count; i++) {
+        uint8_t credential_id[CREDENTIAL_ID_SIZE];
+
+        eeprom_read_block(credential_id, eeprom_data[i].credential_id, CREDENTIAL_ID_SIZE);
+        credential_index[i] = credential_tag(credential_id);
+        app_index[i] = eeprom_read_byte(eeprom_data[i].app_id);
+        sign_counter[i] = 0;
+        counter_headroom[i] = COUNTER_STEP;
+    }
+
+    UART_putc(STATUS_OK);
+}
+#endif
+
+// --------------------------------- Backup ---------------------------------
+
+/**
+ * @brief Computes one keystream block of a backup: HMAC-SHA256(key, 0x01 || nonce || index).
+ *        The backup is encrypted by xoring it with the keystream (counter mode). The padded
+ *        keys were hashed once for the whole backup: a block costs two SHA-256 compressions.
+ * 
+ * @param keyed HMAC context just initialized with the backup key, left unchanged.
+ * @param nonce Pointer to the nonce of the backup (16 bytes).
+ * @param index Index of the chunk.
+ * @param block Output buffer (32 bytes).
+ * @return None.
+ */
+void backup_keystream(const HMAC_SHA256_CTX *keyed, const uint8_t *nonce, uint16_t index, uint8_t *block) {
+    HMAC_SHA256_CTX hmac = *keyed;
+    uint8_t header[3] = {0x01, index >> 8, index & 0xFF};
+
+    hmac_sha256_update(&hmac, header, 1);
+    hmac_sha256_update(&hmac, nonce, BACKUP_NONCE_SIZE);
+    hmac_sha256_update(&hmac, header + 1, 2);
+    hmac_sha256_final(&hmac, block);
+}
+
+/**
+ * @brief Starts the MAC of a backup: HMAC-SHA256(key, 0x02 || nonce || length || ciphertext).
+ * 
+ * @param hmac HMAC context to initialize.
+ * @param keyed HMAC context just initialized with the backup key, left unchanged.
+ * @param nonce Pointer to the nonce of the backup (16 bytes).
+ * @param length Size of the backup (2 bytes, big endian).
+ * @return None.
+ */
+void backup_mac_init(HMAC_SHA256_CTX *hmac, const HMAC_SHA256_CTX *keyed, const uint8_t *nonce, const uint8_t *length) {
+    uint8_t domain = 0x02;
+
+    *hmac = *keyed;
+    hmac_sha256_update(hmac, &domain, 1);
+    hmac_sha256_update(hmac, nonce, BACKUP_NONCE_SIZE);
+    hmac_sha256_update(hmac, length, 2);
+}
+
+/**
+ * @brief Handles the ExportBackup command: after user approval, streams `nb_credentials` and
+ *        the whole `eeprom_data` array, encrypted and authenticated with the backup key sent by
+ *        the client. Deleted credentials are compacted first, and the slots after the live ones
+ *        are sent as zeros, so that no deleted private key ends up in the backup. Only one chunk
+ *        of the backup is in RAM at a time.
+ *        Frame: key (32 bytes).
+ *        Answer: nonce (16 bytes), length (2 bytes, big endian), ciphertext (length bytes),
+ *        MAC (32 bytes).
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_export_backup(void) {
+    HMAC_SHA256_CTX keyed, mac;
+    uint8_t key[BACKUP_KEY_SIZE];
+    uint8_t nonce[BACKUP_NONCE_SIZE];
+    uint8_t chunk[BACKUP_CHUNK_SIZE];
+    uint8_t length[2] = {BACKUP_SIZE >> 8, BACKUP_SIZE & 0xFF};
+    uint16_t offset = 0;
+    uint16_t used;
+    uint8_t nb;
+
+    for (int i = 0; i < BACKUP_KEY_SIZE; i++) {
+        key[i] = UART_getc(); // Read the backup key from UART
+    }
+    if (!ask_for_approval()) {
+        UART_putc(STATUS_ERR_APPROVAL); // Approval not granted
+        return;
+    }
+    if (!avr_rng(nonce, BACKUP_NONCE_SIZE)) {
+        UART_putc(STATUS_ERR_CRYPTO_FAILED);
+        return;
+    }
+    hmac_sha256_init(&keyed, key, BACKUP_KEY_SIZE); // Padded keys hashed once for the whole backup
+    memset(key, 0, sizeof(key));
+    while (deleted_slots != 0) {
+        store_compact_step(); // The live credentials are then slots 0 to nb - 1
+    }
+    nb = eeprom_read_byte(&nb_credentials);
+    used = 1 + nb * sizeof(Credential);
+
+    UART_putc(STATUS_OK);
+    send_pattern((const char*)nonce, BACKUP_NONCE_SIZE);
+    send_pattern((const char*)length, 2);
+    backup_mac_init(&mac, &keyed, nonce, length);
+
+    for (uint16_t index = 0; offset < BACKUP_SIZE; index++) {
+        uint8_t size = (BACKUP_SIZE - offset < BACKUP_CHUNK_SIZE) ? BACKUP_SIZE - offset : BACKUP_CHUNK_SIZE;
+
+        backup_keystream(&keyed, nonce, index, chunk);
+        for (uint8_t i = 0; i < size; i++) {
+            uint16_t position = offset + i;
+
+            if (position == 0) {
+                chunk[i] ^= nb;
+            } else if (position < used) {
+                chunk[i] ^= eeprom_read_byte((const uint8_t *)eeprom_data + position - 1);
+            }
+        }
+        hmac_sha256_update(&mac, chunk, size);
+        send_pattern((const char*)chunk, size);
+        offset += size;
+    }
+
+    hmac_sha256_final(&mac, chunk);
+    send_pattern((const char*)chunk, SHA256_DIGEST_SIZE);
+    memset(&keyed, 0, sizeof(keyed));
+}
+
+/**
+ * @brief Receives one pass of a backup: each chunk of the ciphertext, acknowledged with
+ *        STATUS_OK, then the MAC. The chunk buffer first holds the keystream, and each
+ *        ciphertext byte is xored into it as it is received.
+ * 
+ * @param keyed HMAC context just initialized with the backup key, left unchanged.
+ * @param nonce Pointer to the nonce of the backup (16 bytes).
+ * @param length Size of the backup (2 bytes, big endian).
+ * @param nb Output for `nb_credentials` of the backup, NULL to check the MAC only. Otherwise
+ *        the rest of the backup is written to `eeprom_data` as it is received.
+ * @return uint8_t : 1 if the MAC is correct, 0 otherwise.
+ */
+uint8_t backup_receive(const HMAC_SHA256_CTX *keyed, const uint8_t *nonce, const uint8_t *length, uint8_t *nb) {
+    HMAC_SHA256_CTX mac;
+    uint8_t chunk[BACKUP_CHUNK_SIZE];
+    uint8_t difference = 0;
+    uint16_t offset = 0;
+
+    backup_mac_init(&mac, keyed, nonce, length);
+    for (uint16_t index = 0; offset < BACKUP_SIZE; index++) {
+        uint8_t size = (BACKUP_SIZE - offset < BACKUP_CHUNK_SIZE) ? BACKUP_SIZE - offset : BACKUP_CHUNK_SIZE;
+        uint8_t start = (offset == 0);
+
+        if (nb != NULL) {
+            backup_keystream(keyed, nonce, index, chunk); // The client waits for STATUS_OK, the chunk fits in the RX buffer
+        }
+        for (uint8_t i = 0; i < size; i++) {
+            uint8_t byte = UART_getc();
+
+            hmac_sha256_update(&mac, &byte, 1);
+            if (nb != NULL) {
+                chunk[i] ^= byte;
+            }
+        }
+        if (nb != NULL) {
+            if (start) {
+                *nb = chunk[0]; // Counted by the caller
+            }
+            eeprom_update_block(chunk + start, (uint8_t *)eeprom_data + offset + start - 1, size - start);
+        }
+        offset += size;
+        UART_putc(STATUS_OK); // Ready for the next chunk
+    }
+
+    hmac_sha256_final(&mac, chunk);
+    for (uint8_t i = 0; i < SHA256_DIGEST_SIZE; i++) {
+        difference |= chunk[i] ^ UART_getc(); // Constant time comparison
+    }
+    memset(chunk, 0, sizeof(chunk));
+    return difference == 0;
+}
+
+/**
+ * @brief Handles the ImportBackup command: after user approval, replaces all the credentials
+ *        with a backup made by ExportBackup (possibly on another authenticator). The client
+ *        sends the backup twice: the first pass only checks its MAC, so that a wrong key or a
+ *        corrupted backup leaves the store untouched; the second pass decrypts each chunk and
+ *        writes it as soon as it is received, and the credentials are counted once its MAC is
+ *        verified again.
+ *        Frame: key (32 bytes), nonce (16 bytes), length (2 bytes, big endian); the
+ *        authenticator answers STATUS_OK, then for each pass the client sends each 32-byte
+ *        chunk of the ciphertext and waits for STATUS_OK, and finally sends the MAC (32 bytes).
+ *        The first pass is answered with STATUS_OK (ready for the second pass) or an error.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_import_backup(void) {
+    HMAC_SHA256_CTX keyed;
+    uint8_t key[BACKUP_KEY_SIZE];
+    uint8_t nonce[BACKUP_NONCE_SIZE];
+    uint8_t length[2];
+    uint8_t nb = 0;
+    uint8_t valid;
+
+    for (int i = 0; i < BACKUP_KEY_SIZE; i++) {
+        key[i] = UART_getc(); // Read the backup key from UART
+    }
+    for (int i = 0; i < BACKUP_NONCE_SIZE; i++) {
+        nonce[i] = UART_getc(); // Read the nonce from UART
+    }
+    length[0] = UART_getc();
+    length[1] = UART_getc();
+
+    if ((((uint16_t)length[0] << 8) | length[1]) != BACKUP_SIZE) {
+        UART_putc(STATUS_ERR_BAD_PARAMETER); // Backup of another store layout
+        return;
+    }
+    if (!ask_for_approval()) {
+        UART_putc(STATUS_ERR_APPROVAL); // Approval not granted
+        return;
+    }
+    hmac_sha256_init(&keyed, key, BACKUP_KEY_SIZE); // Padded keys hashed once for both passes
+    memset(key, 0, sizeof(key));
+    UART_putc(STATUS_OK); // Ready for the first pass
+
+    if (!backup_receive(&keyed, nonce, length, NULL)) {
+        memset(&keyed, 0, sizeof(keyed));
+        UART_putc(STATUS_ERR_AUTHENTICATION); // Nothing was written
+        return;
+    }
+
+    // The backup is authentic: empty the store, then write the second pass over it
+    eeprom_update_byte(&nb_credentials, 0);
+    deleted_slots = 0;
+    store_changed(); // The client cannot list in between: one change covers the whole import
+    UART_putc(STATUS_OK); // Ready for the second pass
+
+    valid = backup_receive(&keyed, nonce, length, &nb);
+    memset(&keyed, 0, sizeof(keyed));
+    if (!valid || nb > EEPROM_MAX_ENTRIES) {
+        // The second pass differs from the first one: wipe what it wrote
+        Credential empty_entry = {0};
+
+        for (uint8_t i = 0; i < EEPROM_MAX_ENTRIES; i++) {
+            eeprom_update_block(&empty_entry, &eeprom_data[i], sizeof(Credential));
+        }
+        UART_putc(valid ? STATUS_ERR_BAD_PARAMETER : STATUS_ERR_AUTHENTICATION);
+        return;
+    }
+
+    eeprom_update_byte(&nb_credentials, nb);
+    index_build(); // Counters resume from the limits of the backup
+
+    UART_putc(STATUS_OK);
+}
+
+// --------------------------------- DeleteCredential ---------------------------------
+
+/**
+ * @brief Handles the DeleteCredential command: deletes the credential with the given ID
+ *        after user approval. Only a tombstone byte is written, so the answer is immediate;
+ *        the slot is then compacted by store_compact_step while the authenticator is idle.
+ *        Frame: credential_id (16 bytes).
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_delete_credential(void) {
+    uint8_t credential_id[CREDENTIAL_ID_SIZE];
+    int8_t slot;
+
+    for (int i = 0; i < CREDENTIAL_ID_SIZE; i++) {
+        credential_id[i] = UART_getc(); // Read the credential ID from UART
+    }
+
+    slot = find_credential(credential_id, NULL);
+    if (slot < 0) {
+        UART_putc(STATUS_ERR_NOT_FOUND);
+        return;
+    }
+    if (!ask_for_approval()) {
+        UART_putc(STATUS_ERR_APPROVAL); // Approval not granted
+        return;
+    }
+
+    store_settle();
+    eeprom_update_byte(&eeprom_data[slot].curve, CURVE_DELETED);
+    deleted_slots |= 1 << slot;
+    store_changed();
+
+    UART_putc(STATUS_OK);
+}
+
+/**
+ * @brief Finds the first byte that differs between two records in EEPROM, curve excluded.
+ * 
+ * @param slot Index of the first record.
+ * @param other Index of the second record.
+ * @return uint8_t : Offset of the byte in Credential, sizeof(Credential) if the records match.
+ */
+uint8_t record_difference(uint8_t slot, uint8_t other) {
+    const uint8_t *record = (const uint8_t *)&eeprom_data[slot];
+    const uint8_t *other_record = (const uint8_t *)&eeprom_data[other];
+
+    for (uint8_t i = 0; i < sizeof(Credential); i++) {
+        if (i != offsetof(Credential, curve) && eeprom_read_byte(record + i) != eeprom_read_byte(other_record + i)) {
+            return i;
+        }
+    }
+    return sizeof(Credential);
+}
+
+/**
+ * @brief Compacts the credential store by at most one EEPROM byte, called when no command is
+ *        pending and the EEPROM is ready: a request arriving meanwhile waits for one byte
+ *        write (3.3 ms) at most. The last record is copied into the first deleted slot, which
+ *        only becomes live once the copy is complete; the RAM indexes then switch to the copy
+ *        and the last slot is tombstoned, wiped and dropped from `nb_credentials`, so the
+ *        live credentials stay in slots 0 to nb_credentials - 1.
+ *        No state is kept between calls: each call starts again from the EEPROM and
+ *        `deleted_slots`, so a command may change the store in between. A deleted slot is
+ *        first tombstoned in EEPROM again if needed, unless it is the live copy of the last
+ *        record. A move changes the order of the listed credentials, so it increments
+ *        store_version: offsets of a paginated listing are no longer valid. A move
+ *        interrupted by a power loss is finished by index_build.
+ * 
+ * @param None.
+ * @return uint8_t : 1 if the call did some work, 0 if no slot is deleted.
+ */
+uint8_t store_compact_step(void) {
+    uint8_t *record;
+    uint8_t nb, last, hole, offset, copied;
+
+    if (deleted_slots == 0) {
+        return 0;
+    }
+    nb = eeprom_read_byte(&nb_credentials);
+    last = nb - 1;
+    for (hole = 0; SLOT_LIVE(hole); hole++) {
+        // The first deleted slot, before the last one if that one is live
+    }
+    offset = SLOT_LIVE(last) ? record_difference(hole, last) : 0;
+    copied = (offset == sizeof(Credential));
+
+    // A deleted slot must still read as deleted after a power loss (see store_settle)
+    for (uint8_t i = 0; i < nb; i++) {
+        if (!SLOT_LIVE(i) && eeprom_read_byte(&eeprom_data[i].curve) != CURVE_DELETED &&
+            !(i == hole && copied && eeprom_read_byte(&eeprom_data[i].curve) == eeprom_read_byte(&eeprom_data[last].curve))) {
+            eeprom_write_byte(&eeprom_data[i].curve, CURVE_DELETED);
+            return 1;
+        }
+    }
+
+    if (!SLOT_LIVE(last)) {
+        // Wipe the private key, then drop the slot
+        record = (uint8_t *)&eeprom_data[last];
+        for (uint8_t i = 0; i < sizeof(Credential); i++) {
+            if (i != offsetof(Credential, curve) && eeprom_read_byte(record + i) != 0) {
+                eeprom_write_byte(record + i, 0);
+                return 1;
+            }
+        }
+        eeprom_write_byte(&nb_credentials, last);
+        deleted_slots &= ~(1 << last);
+        return 1;
+    }
+
+    if (!copied) {
+        // Copy one byte, the hole still reads as deleted
+        record = (uint8_t *)&eeprom_data[hole];
+        eeprom_write_byte(record + offset, eeprom_read_byte((const uint8_t *)&eeprom_data[last] + offset));
+        return 1;
+    }
+    if (eeprom_read_byte(&eeprom_data[hole].curve) == CURVE_DELETED) {
+        // The copy is complete: make it live, index_build finishes the move from here
+        eeprom_write_byte(&eeprom_data[hole].curve, eeprom_read_byte(&eeprom_data[last].curve));
+        return 1;
+    }
+
+    // Switch to the copy; the last slot is tombstoned by the next call
+    store_changed();
+    credential_index[hole] = credential_index[last];
+    app_index[hole] = app_index[last];
+    sign_counter[hole] = sign_counter[last];
+    counter_headroom[hole] = counter_headroom[last];
+    deleted_slots &= ~(1 << hole);
+    deleted_slots |= 1 << last;
+    return 1;
+}
+
+// --------------------------------- Reset ---------------------------------
+
+/**
+ * @brief Resets the EEPROM by clearing all stored credentials and resetting the counter (`nb_credentials`).
+ *        Requires user approval before executing the reset.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_reset(void) {
+    if (!ask_for_approval()) {
+        UART_putc(STATUS_ERR_APPROVAL); // Approval not granted
+        return;
+    }
+
+    uint8_t nb = eeprom_read_byte(&nb_credentials); // Read the current number of credentials
+    Credential empty_entry = {0}; // Define an empty credential structure
+
+    // Overwrite each stored entry with the empty structure
+    for (uint8_t i = 0; i < nb; i++) {
+        eeprom_write_block(&empty_entry, &eeprom_data[i], sizeof(Credential));
+    }
+
+    // Reset the counter
+    eeprom_write_byte(&nb_credentials, 0);
+    deleted_slots = 0;
+    store_changed();
+
+    UART_putc(STATUS_OK); // Indicate success
+}
+
+
+// --------------------------------- Memory usage ---------------------------------
+
+/**
+ * @brief Fills the free RAM between the end of .bss and the stack with STACK_CANARY.
+ *        Interrupts are disabled so that no interrupt frame is overwritten.
+ * 
+ * @param None.
+ * @return None.
+ */
+void stack_paint(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint8_t *p = &__heap_start;
+        uint8_t *top = (uint8_t *)SP - 16; // Keep clear of the current frame
+
+        while (p < top) {
+            *p++ = STACK_CANARY;
+        }
+    }
+}
+
+/**
+ * @brief Computes the largest stack size reached since the last call to stack_paint(),
+ *        from the number of canary bytes still intact above the end of .bss.
+ * 
+ * @param None.
+ * @return uint16_t - The stack peak in bytes.
+ */
+uint16_t stack_peak(void) {
+    const uint8_t *p = &__heap_start;
+
+    while (*p == STACK_CANARY && p < (const uint8_t *)SP) {
+        p++;
+    }
+    return RAMEND + 1 - (size_t)p;
+}
+
+/**
+ * @brief Sends the stack peak and the uECC scratch arena peak (2 bytes each, big endian)
+ *        reached since the previous COMMAND_MEMORY_USAGE (or since boot), then starts a new
+ *        measurement. Sending this command after another one gives the memory used by it.
+ * 
+ * @param None.
+ * @return None.
+ */
+void UART_handle_memory_usage(void) {
+    uint16_t stack = stack_peak();
+    uint16_t scratch = uECC_scratch_peak();
+    uint16_t scratch_secp256r1 = uECC_secp256r1_scratch_peak();
+
+    if (scratch_secp256r1 > scratch) {
+        scratch = scratch_secp256r1; // Both curves share the arena
+    }
+
+    UART_putc(STATUS_OK);
+    UART_putc(stack >> 8);
+    UART_putc(stack & 0xFF);
+    UART_putc(scratch >> 8);
+    UART_putc(scratch & 0xFF);
+
+    stack_paint();
+}
+
+// --------------------------------- Main ---------------------------------
+
+/**
+ * @brief Main function that configures peripherals and executes an infinite loop 
+ *        to handle commands received via UART.
  * 
  * @param None.
  * @return int : Returns 0 if the program executes without errors.
@@ -492,8 +2039,17 @@ int main(void) {
     config(); // Initialize peripherals and configuration
 
     while (1) {
-        uint8_t command = UART_getc(); // Wait for a command via UART
-        UART_handle_command(command); // Process the received command
+        if (UART_available()) {
+            uint8_t command = UART_getc(); // Read a command via UART
+            commit_slot = COMMIT_NONE; // The command may sign or move credentials
+            UART_handle_command(command); // Process the received command
+        } else if (eeprom_is_ready()) {
+            // Idle: compact the credential store, then reserve signature counter values, one
+            // EEPROM byte at a time so that rx_buffer is read again before it can fill up
+            if (!store_compact_step()) {
+                counter_commit_step();
+            }
+        }
     }
     return 0;
 }
@@ -4,32 +4,93 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include <util/delay.h>
 #include "ecc/uECC.h"
+#include "ecc/uECC_secp256r1.h"
+#include "entropy.h"
+#include "sha256.h"
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-uint16_t read_adc();
-int random_seed();
-int avr_rng(uint8_t *dest, unsigned size);
+// Storage class of the RAM state of the firmware. Empty on the ATmega328p; the host build of
+// the handlers (host/farm) defines it as _Thread_local, each thread emulating one device at a time.
+#ifndef FIRMWARE_STATE
+#define FIRMWARE_STATE
+#endif
+
+// Run while UART_getc() waits for a byte. Empty on the ATmega328p, where the RX interrupt fills
+// the buffer; the host build ends the command there, since no byte can arrive meanwhile.
+#ifndef UART_RX_WAIT
+#define UART_RX_WAIT()
+#endif
+
+// 1 where the line rate cannot change: SetBaudRate then answers STATUS_ERR_BAD_PARAMETER to any
+// rate but 115200. 0 on the ATmega328p; 1 in the host build, served on pseudo-terminals.
+#ifndef UART_FIXED_RATE
+#define UART_FIXED_RATE 0
+#endif
 
 void config(void);
 void UART_init(void);
+uint8_t UART_available(void);
 uint8_t UART_getc(void);
 void UART_putc(uint8_t data);
+void UART_set_ubrr(uint8_t ubrr);
 void UART_handle_command(uint8_t data);
 void UART_handle_make_credential(void);
+void UART_handle_make_credential_compressed(void);
+void UART_handle_make_credential_secp256r1(void);
+void UART_handle_make_credential_user(void);
 void UART_handle_get_assertion(void);
+void UART_handle_get_assertion_raw(void);
+void UART_handle_get_assertion_allow_list(void);
+void UART_handle_get_assertion_user(void);
+uint8_t live_credentials(void);
 void UART_handle_list_credentials(void);
+void UART_handle_list_credentials_filtered(void);
+void UART_handle_delete_credential(void);
+void UART_handle_import_credentials(void);
+void UART_handle_export_backup(void);
+void UART_handle_import_backup(void);
+void UART_handle_store_version(void);
+void UART_handle_set_baud_rate(void);
 void UART_handle_reset(void);
+void UART_handle_memory_usage(void);
 
 int ask_for_approval(void);
 void debounce(void);
-void gen_new_keys(uint8_t *app_id);
-void sign_data(uint8_t *app_id, uint8_t* client_data);
+void gen_new_keys(uint8_t *app_id, uint8_t *user_handle, uint8_t curve, uint8_t compressed);
+int sign_deterministic(uint8_t curve, const uint8_t *private_key, const uint8_t *hash, uint8_t *signature);
+void sign_credential(uint8_t slot, uint8_t *client_data, uint8_t client_data_size);
+void sign_data(uint8_t *app_id, uint8_t* client_data, uint8_t client_data_size);
+uint8_t credential_tag(const uint8_t *credential_id);
+uint8_t app_tag(const uint8_t *app_id);
+void index_build(void);
+uint8_t find_app_credentials(const uint8_t *app_id, uint8_t *slots);
+int8_t find_credential(const uint8_t *credential_id, const uint8_t *app_id);
+int8_t find_account(const uint8_t *app_id, const uint8_t *user_handle);
 void send_pattern(const char* pattern, uint8_t length);
-void store_in_eeprom(uint8_t *app_id, uint8_t *credential_id, uint8_t *private_key, uint8_t *public_key);
+void send_eeprom(const uint8_t *src, uint8_t length);
+uint8_t eeprom_matches(const uint8_t *src, const uint8_t *data, uint8_t length);
+void backup_keystream(const HMAC_SHA256_CTX *keyed, const uint8_t *nonce, uint16_t index, uint8_t *block);
+void backup_mac_init(HMAC_SHA256_CTX *hmac, const HMAC_SHA256_CTX *keyed, const uint8_t *nonce, const uint8_t *length);
+uint8_t backup_receive(const HMAC_SHA256_CTX *keyed, const uint8_t *nonce, const uint8_t *length, uint8_t *nb);
+uint8_t store_compact_step(void);
+uint8_t record_difference(uint8_t slot, uint8_t other);
+void store_changed(void);
+void store_settle(void);
+void store_check_layout(void);
+void counter_load(uint8_t slot);
+void counter_commit(uint8_t slot);
+uint32_t counter_next(uint8_t slot);
+uint8_t counter_commit_step(void);
+uint8_t counter_oldest(uint8_t slot);
+void stack_paint(void);
+uint16_t stack_peak(void);
+void store_in_eeprom(uint8_t *app_id, uint8_t *user_handle, uint8_t *credential_id, uint8_t curve, uint8_t *private_key, uint8_t *public_key, uint8_t public_key_size);
 
 #endif
\ No newline at end of file